@@ -0,0 +1,96 @@
+#define _GNU_SOURCE
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define ARENA_ALIGN  64
+#define ARENA_CHUNK  (1 << 20)
+#define CHUNK_HEADER ARENA_ALIGN
+
+/* A mapping the arena bumps through; data starts CHUNK_HEADER bytes in */
+typedef struct Chunk {
+    struct Chunk *prev;
+    char *end;
+} Chunk;
+
+typedef struct {
+    Chunk *chunk;       /* chunk being filled, NULL before the first allocation */
+    char *top;          /* next free byte in chunk */
+    Chunk *spare;       /* last chunk a release emptied, kept for reuse */
+} Arena;
+
+/* Every thread has its own, so allocation never takes a lock */
+static _Thread_local Arena regions;
+static _Thread_local Arena permanent;
+
+static void out_of_memory(void) {
+    fprintf(stderr, "E: out of memory\n");
+    abort();
+}
+
+/* Fresh anonymous memory, so it starts zeroed */
+static Chunk *chunk_new(size_t bytes) {
+    size_t size = bytes + CHUNK_HEADER;
+    size = size <= ARENA_CHUNK ? ARENA_CHUNK : (size + ARENA_CHUNK - 1) & ~(size_t)(ARENA_CHUNK - 1);
+    Chunk *c = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (c == MAP_FAILED) out_of_memory();
+#ifdef MADV_HUGEPAGE
+    if (size >= LP_HUGE_ARRAY) madvise(c, size, MADV_HUGEPAGE);
+#endif
+    c->prev = NULL;
+    c->end = (char *)c + size;
+    return c;
+}
+
+static char *chunk_data(Chunk *c) {
+    return (char *)c + CHUNK_HEADER;
+}
+
+static void *arena_alloc(Arena *a, int64_t bytes) {
+    if (bytes < 0) out_of_memory();
+    size_t size = ((size_t)bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (a->chunk && (size_t)(a->chunk->end - a->top) >= size) {
+        void *p = a->top;
+        a->top += size;
+        return p;
+    }
+    
+    /* The rest of the current chunk is left unused */
+    Chunk *c = a->spare;
+    if (c && (size_t)(c->end - chunk_data(c)) >= size) {
+        a->spare = NULL;
+    } else {
+        c = chunk_new(size);
+    }
+    c->prev = a->chunk;
+    a->chunk = c;
+    a->top = chunk_data(c) + size;
+    return chunk_data(c);
+}
+
+void *__lp_alloc(int64_t bytes) {
+    return arena_alloc(&permanent, bytes);
+}
+
+void *__lp_region_alloc(int64_t bytes) {
+    return arena_alloc(&regions, bytes);
+}
+
+void *__lp_region_mark(void) {
+    return regions.top;
+}
+
+void __lp_region_release(void *mark) {
+    Arena *a = &regions;
+    char *m = mark;
+    
+    /* Chunks opened since the mark go back, the last one is kept as the spare */
+    while (a->chunk && !(m >= chunk_data(a->chunk) && m <= a->chunk->end)) {
+        Chunk *c = a->chunk;
+        a->chunk = c->prev;
+        if (a->spare) munmap(a->spare, a->spare->end - (char *)a->spare);
+        a->spare = c;
+    }
+    a->top = m;
+}
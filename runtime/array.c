@@ -0,0 +1,56 @@
+#define _GNU_SOURCE
+#include "runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+/* Map at least bytes, aligned to LP_HUGE_ARRAY so the range can be backed by huge pages */
+static void *map_huge(size_t bytes) {
+    size_t len = (bytes + LP_HUGE_ARRAY - 1) & ~(size_t)(LP_HUGE_ARRAY - 1);
+    char *raw = mmap(NULL, len + LP_HUGE_ARRAY, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return NULL;
+    
+    /* Trim the slack on both sides of the aligned range */
+    char *base = (char *)(((uintptr_t)raw + LP_HUGE_ARRAY - 1) & ~(uintptr_t)(LP_HUGE_ARRAY - 1));
+    if (base > raw) munmap(raw, base - raw);
+    char *end = raw + len + LP_HUGE_ARRAY;
+    if (end > base + len) munmap(base + len, end - (base + len));
+    
+#ifdef MADV_HUGEPAGE
+    madvise(base, len, MADV_HUGEPAGE);
+#endif
+    return base;
+}
+
+static int64_t array_bytes(int64_t count, int64_t elem_size) {
+    if (count < 0 || (elem_size > 0 && count > INT64_MAX / elem_size)) {
+        fprintf(stderr, "E: invalid array length %lld\n", (long long)count);
+        exit(1);
+    }
+    return count * elem_size;
+}
+
+void *__lp_alloc_array(int64_t count, int64_t elem_size) {
+    int64_t bytes = array_bytes(count, elem_size);
+    
+    /* Fresh mappings and the permanent arena are already zero */
+    void *p = bytes >= LP_HUGE_ARRAY ? map_huge((size_t)bytes) : NULL;
+    return p ? p : __lp_alloc(bytes);
+}
+
+void *__lp_region_array(int64_t count, int64_t elem_size) {
+    return __lp_region_alloc(array_bytes(count, elem_size));
+}
+
+void __lp_bounds_fail(int64_t index, int64_t len) {
+    fprintf(stderr, "E: index %lld out of bounds for length %lld\n",
+            (long long)index, (long long)len);
+    exit(1);
+}
+
+void __lp_lanes_fail(int64_t index, int64_t lanes, int64_t len) {
+    fprintf(stderr, "E: %lld lanes at index %lld out of bounds for length %lld\n",
+            (long long)lanes, (long long)index, (long long)len);
+    exit(1);
+}
@@ -0,0 +1,114 @@
+#include "runtime.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct LpTask {
+    void *coro;         /* coroutine frame, freed by the coroutine itself */
+    LpTask *waiters;    /* tasks suspended in await on this one */
+    LpTask *next;       /* ready queue / waiter list link */
+    int done;
+    _Alignas(16) char result[LP_TASK_RESULT];
+};
+
+static struct {
+    pthread_mutex_t lock;
+    LpTask *head;
+    LpTask *tail;
+    int running;        /* tasks being resumed right now */
+} ready = { PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0 };
+
+/* Caller holds ready.lock */
+static void enqueue(LpTask *t) {
+    t->next = NULL;
+    if (ready.tail) ready.tail->next = t;
+    else ready.head = t;
+    ready.tail = t;
+}
+
+/* Caller holds ready.lock */
+static LpTask *dequeue(void) {
+    LpTask *t = ready.head;
+    if (t) {
+        ready.head = t->next;
+        if (!ready.head) ready.tail = NULL;
+    }
+    return t;
+}
+
+/* Switched-resume ABI: the frame starts with the resume function pointer */
+static void resume(void *coro) {
+    void (*fn)(void *) = *(void (**)(void *))coro;
+    fn(coro);
+}
+
+/* Tasks live until exit, so they come zeroed from the permanent arena */
+LpTask *__lp_task_new(void) {
+    return __lp_alloc(sizeof(LpTask));
+}
+
+void __lp_task_start(LpTask *task, void *coro) {
+    task->coro = coro;
+    pthread_mutex_lock(&ready.lock);
+    enqueue(task);
+    pthread_mutex_unlock(&ready.lock);
+}
+
+void *__lp_task_result(LpTask *task) {
+    return task->result;
+}
+
+void __lp_task_finish(LpTask *task) {
+    pthread_mutex_lock(&ready.lock);
+    task->done = 1;
+    LpTask *w = task->waiters;
+    task->waiters = NULL;
+    while (w) {
+        LpTask *next = w->next;
+        enqueue(w);
+        w = next;
+    }
+    pthread_mutex_unlock(&ready.lock);
+}
+
+int32_t __lp_task_await(LpTask *task, LpTask *self) {
+    pthread_mutex_lock(&ready.lock);
+    int suspend = !task->done;
+    if (suspend) {
+        self->next = task->waiters;
+        task->waiters = self;
+    }
+    pthread_mutex_unlock(&ready.lock);
+    return suspend;
+}
+
+void __lp_task_wait(LpTask *task) {
+    for (;;) {
+        pthread_mutex_lock(&ready.lock);
+        if (task->done) {
+            pthread_mutex_unlock(&ready.lock);
+            return;
+        }
+        LpTask *t = dequeue();
+        int busy = ready.running;
+        if (t) ready.running++;
+        pthread_mutex_unlock(&ready.lock);
+
+        if (!t) {
+            /* Another thread may be running the task we wait for */
+            if (busy) {
+                sched_yield();
+                continue;
+            }
+            fprintf(stderr, "E: await on a task that can never finish\n");
+            abort();
+        }
+
+        resume(t->coro);
+
+        pthread_mutex_lock(&ready.lock);
+        ready.running--;
+        pthread_mutex_unlock(&ready.lock);
+    }
+}
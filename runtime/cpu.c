@@ -0,0 +1,59 @@
+#include "runtime.h"
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+int32_t __lp_cpu_level = 1;
+
+#if defined(__x86_64__)
+
+#define BIT(n) (1u << (n))
+
+/* Register state the OS saves on context switches */
+static uint64_t xgetbv(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static int all(uint32_t reg, uint32_t bits) {
+    return (reg & bits) == bits;
+}
+
+/* Feature sets of the x86-64 psABI micro-architecture levels */
+static int32_t cpu_level(void) {
+    uint32_t eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 1;
+    uint32_t ecx1 = ecx;
+    
+    uint32_t ecx_ext = 0;
+    if (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx)) ecx_ext = ecx;
+    
+    /* SSE3 SSSE3 CX16 SSE4.1 SSE4.2 POPCNT, LAHF */
+    if (!all(ecx1, BIT(0) | BIT(9) | BIT(13) | BIT(19) | BIT(20) | BIT(23)) || !(ecx_ext & BIT(0))) {
+        return 1;
+    }
+    
+    /* FMA MOVBE OSXSAVE AVX F16C, LZCNT, then AVX2 BMI1 BMI2 with YMM state enabled */
+    uint32_t ebx7 = 0;
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) ebx7 = ebx;
+    if (!all(ecx1, BIT(12) | BIT(22) | BIT(27) | BIT(28) | BIT(29)) || !(ecx_ext & BIT(5))) {
+        return 2;
+    }
+    uint64_t xcr0 = xgetbv();
+    if (!all(ebx7, BIT(3) | BIT(5) | BIT(8)) || (xcr0 & 0x6) != 0x6) return 2;
+    
+    /* AVX512 F DQ CD BW VL with opmask and ZMM state enabled */
+    if (!all(ebx7, BIT(16) | BIT(17) | BIT(28) | BIT(30) | BIT(31)) || (xcr0 & 0xe6) != 0xe6) {
+        return 3;
+    }
+    return 4;
+}
+
+__attribute__((constructor))
+static void detect_cpu(void) {
+    __lp_cpu_level = cpu_level();
+}
+
+#endif
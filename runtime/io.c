@@ -0,0 +1,297 @@
+#define _GNU_SOURCE
+#include "runtime.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* ========== Input ========== */
+
+/* Any non-null address for an empty file; it is never dereferenced */
+static char empty_file[1];
+
+void *__lp_mmap(const char *path, int64_t *len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "E: cannot open %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    *len = st.st_size;
+    if (st.st_size == 0) {
+        close(fd);
+        return empty_file;
+    }
+    
+    /* Private and writable: the file is never changed, a stored-to page is copied */
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "E: cannot map %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+    madvise(p, (size_t)st.st_size, MADV_WILLNEED);
+    return p;
+}
+
+int64_t *__lp_lines(const uint8_t *data, int64_t len, int64_t *count) {
+    /* One pass to size the index, one to fill it; memchr does the scanning */
+    int64_t lines = 0;
+    const uint8_t *end = data + len;
+    for (const uint8_t *p = data; p < end; p++) {
+        p = memchr(p, '\n', (size_t)(end - p));
+        if (!p) break;
+        lines++;
+    }
+    if (len > 0 && data[len - 1] != '\n') lines++;
+    
+    int64_t *starts = __lp_alloc_array(lines + 1, sizeof(int64_t));
+    int64_t k = 0;
+    starts[k++] = 0;
+    for (const uint8_t *p = data; p < end && k <= lines; p++) {
+        p = memchr(p, '\n', (size_t)(end - p));
+        if (!p) break;
+        starts[k++] = p + 1 - data;
+    }
+    starts[lines] = len;
+    *count = lines + 1;
+    return starts;
+}
+
+void __lp_slice_fail(int64_t lo, int64_t hi, int64_t len) {
+    fprintf(stderr, "E: slice %lld..%lld out of bounds for length %lld\n",
+            (long long)lo, (long long)hi, (long long)len);
+    exit(1);
+}
+
+/* ========== Output ========== */
+
+#define OUT_BUFFER (64 << 10)
+
+/* Each thread prints into its own buffer; all are listed for the flush at exit */
+typedef struct OutBuffer {
+    struct OutBuffer *next;
+    size_t len;
+    char data[OUT_BUFFER];
+} OutBuffer;
+
+static _Thread_local OutBuffer *out;
+static OutBuffer *buffers;
+static pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+static int interactive;     /* stdout is a terminal: flush every line */
+
+static void write_all(const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(STDOUT_FILENO, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+}
+
+static void flush_buffer(OutBuffer *b) {
+    write_all(b->data, b->len);
+    b->len = 0;
+}
+
+static void flush_all(void) {
+    pthread_mutex_lock(&buffers_lock);
+    for (OutBuffer *b = buffers; b; b = b->next) flush_buffer(b);
+    pthread_mutex_unlock(&buffers_lock);
+}
+
+static OutBuffer *out_buffer(void) {
+    if (!out) {
+        out = __lp_alloc(sizeof(OutBuffer));
+        pthread_mutex_lock(&buffers_lock);
+        if (!buffers) {
+            interactive = isatty(STDOUT_FILENO);
+            atexit(flush_all);
+        }
+        out->next = buffers;
+        buffers = out;
+        pthread_mutex_unlock(&buffers_lock);
+    }
+    return out;
+}
+
+/* Room for n more bytes at the end of the calling thread's buffer */
+static char *out_reserve(size_t n) {
+    OutBuffer *b = out_buffer();
+    if (b->len + n > OUT_BUFFER) flush_buffer(b);
+    return b->data + b->len;
+}
+
+/* The line ending at end is complete */
+static void out_commit(char *end) {
+    out->len = (size_t)(end - out->data);
+    if (interactive) flush_buffer(out);
+}
+
+void __lp_flush(void) {
+    if (out) flush_buffer(out);
+}
+
+static const char digit_pairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static char *format_u64(char *p, uint64_t v) {
+    char tmp[20];
+    char *t = tmp + sizeof(tmp);
+    while (v >= 100) {
+        t -= 2;
+        memcpy(t, digit_pairs + (v % 100) * 2, 2);
+        v /= 100;
+    }
+    if (v >= 10) {
+        t -= 2;
+        memcpy(t, digit_pairs + v * 2, 2);
+    } else {
+        *--t = (char)('0' + v);
+    }
+    size_t n = (size_t)(tmp + sizeof(tmp) - t);
+    memcpy(p, t, n);
+    return p + n;
+}
+
+static char *format_i64(char *p, int64_t v) {
+    if (v < 0) {
+        *p++ = '-';
+        return format_u64(p, 0 - (uint64_t)v);
+    }
+    return format_u64(p, (uint64_t)v);
+}
+
+static const double pow10_table[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19
+};
+
+static int reads_back(const char *s, double x, int single) {
+    return single ? strtof(s, NULL) == (float)x : strtod(s, NULL) == x;
+}
+
+/*
+ * Shortest decimal that reads back as x (as a float if single), with at
+ * least one fractional digit. Most values have few enough digits to be
+ * found exactly in 53-bit integers: the fewest decimals d for which
+ * round(x * 10^d) / 10^d == x. Both operands are exact below 2^53 and
+ * 10^19, so the division rounds correctly. Very large or small
+ * magnitudes, and the rest, go through %g.
+ */
+static char *format_double(char *p, double x, int single) {
+    if (isnan(x)) {
+        memcpy(p, "nan", 3);
+        return p + 3;
+    }
+    if (signbit(x)) {
+        *p++ = '-';
+        x = -x;
+    }
+    if (isinf(x)) {
+        memcpy(p, "inf", 3);
+        return p + 3;
+    }
+    
+    char buf[40];
+    if (x < 1e15 && (x >= 1e-5 || x == 0)) {
+        for (int d = 0; d < (int)(sizeof(pow10_table) / sizeof(pow10_table[0])); d++) {
+            double scaled = x * pow10_table[d];
+            if (scaled >= 9007199254740992.0) break;
+            uint64_t m = (uint64_t)(scaled + 0.5);
+            double back = (double)m / pow10_table[d];
+            if (single ? (float)back != (float)x : back != x) continue;
+            
+            /* m / 10^d with d decimals */
+            uint64_t scale = (uint64_t)pow10_table[d];
+            char *q = format_u64(buf, m / scale);
+            *q++ = '.';
+            uint64_t frac = m % scale;
+            if (d == 0) {
+                *q++ = '0';
+            } else {
+                char digits[24];
+                char *end = format_u64(digits, frac);
+                size_t n = (size_t)(end - digits);
+                memset(q, '0', (size_t)d - n);
+                memcpy(q + d - n, digits, n);
+                q += d;
+            }
+            *q = '\0';
+            
+            /* double rounding can fool the float test; confirm it */
+            if (single && !reads_back(buf, x, 1)) continue;
+            size_t len = (size_t)(q - buf);
+            memcpy(p, buf, len);
+            return p + len;
+        }
+    }
+    
+    /* Fewest digits that read back; 9 / 17 always do, and %g drops trailing zeros */
+    int prec = 1;
+    for (; prec < (single ? 9 : 17); prec++) {
+        snprintf(buf, sizeof(buf), "%.*g", prec, x);
+        if (reads_back(buf, x, single)) break;
+    }
+    size_t len = (size_t)snprintf(buf, sizeof(buf), "%.*g", prec, x);
+    if (!strpbrk(buf, ".e")) {
+        memcpy(buf + len, ".0", 3);
+        len += 2;
+    }
+    memcpy(p, buf, len);
+    return p + len;
+}
+
+void __lp_print_i64(int64_t v) {
+    char *p = format_i64(out_reserve(24), v);
+    *p++ = '\n';
+    out_commit(p);
+}
+
+void __lp_print_u64(uint64_t v) {
+    char *p = format_u64(out_reserve(24), v);
+    *p++ = '\n';
+    out_commit(p);
+}
+
+void __lp_print_f64(double v) {
+    char *p = format_double(out_reserve(48), v, 0);
+    *p++ = '\n';
+    out_commit(p);
+}
+
+void __lp_print_f32(float v) {
+    char *p = format_double(out_reserve(48), v, 1);
+    *p++ = '\n';
+    out_commit(p);
+}
+
+void __lp_print_str(const char *s) {
+    size_t n = strlen(s);
+    if (n + 1 > OUT_BUFFER) {
+        /* Too long to buffer: whatever is queued goes first */
+        __lp_flush();
+        out_buffer();
+        write_all(s, n);
+        write_all("\n", 1);
+        return;
+    }
+    char *p = out_reserve(n + 1);
+    memcpy(p, s, n);
+    p[n] = '\n';
+    out_commit(p + n + 1);
+}
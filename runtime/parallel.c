@@ -0,0 +1,520 @@
+#define _GNU_SOURCE
+#include "runtime.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LP_MAX_WORKERS 256
+#define LP_DEQUE_CAP   128   /* binary splitting keeps depth <= 64 per block */
+#define LP_SPLIT_FACTOR 8    /* target chunks per worker */
+
+typedef struct {
+    int64_t lo;
+    int64_t hi;
+} Range;
+
+/* Per-worker deque: owner pushes/pops at the tail, thieves take the head */
+typedef struct {
+    atomic_flag lock;
+    unsigned head;
+    unsigned tail;
+    Range items[LP_DEQUE_CAP];
+} __attribute__((aligned(64))) Deque;
+
+typedef struct {
+    LpBodyFn body;
+    void *ctx;
+    int64_t start;
+    int64_t end;
+    int schedule;
+    int64_t chunk;                  /* grain for LP_SCHED_STEAL */
+    atomic_int_fast64_t remaining;  /* iterations not yet executed (stealing) */
+    atomic_int_fast64_t next;       /* next unclaimed iteration (dynamic, guided) */
+    char *slots;                    /* reduction partials, NULL if none */
+} Job;
+
+typedef struct {
+    _Alignas(64) char bytes[LP_REDUCE_SLOT];
+} Slot;
+
+static struct {
+    int nworkers;                   /* including the calling thread */
+    pthread_t threads[LP_MAX_WORKERS];
+    int cpus[LP_MAX_WORKERS];       /* CPU each worker is pinned to */
+    int ncpus;                      /* 0 = threads float */
+    Deque deques[LP_MAX_WORKERS];
+    Slot slots[LP_MAX_WORKERS];     /* partials of the running reduction */
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;            /* new job published */
+    pthread_cond_t idle;            /* last helper left the job */
+    Job *job;
+    uint64_t generation;
+    int active;                     /* helpers still inside job */
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER,
+};
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static _Thread_local int worker_id = 0;
+static _Thread_local int in_parallel = 0;
+static _Thread_local void *reduce_slot = NULL;
+
+/* ========== Deque ========== */
+
+static inline void deque_lock(Deque *d) {
+    while (atomic_flag_test_and_set_explicit(&d->lock, memory_order_acquire))
+        sched_yield();
+}
+
+static inline void deque_unlock(Deque *d) {
+    atomic_flag_clear_explicit(&d->lock, memory_order_release);
+}
+
+static int deque_push(Deque *d, Range r) {
+    int ok = 0;
+    deque_lock(d);
+    if (d->tail - d->head < LP_DEQUE_CAP) {
+        d->items[d->tail++ % LP_DEQUE_CAP] = r;
+        ok = 1;
+    }
+    deque_unlock(d);
+    return ok;
+}
+
+static int deque_pop(Deque *d, Range *out) {
+    int ok = 0;
+    deque_lock(d);
+    if (d->tail != d->head) {
+        *out = d->items[--d->tail % LP_DEQUE_CAP];
+        ok = 1;
+    }
+    deque_unlock(d);
+    return ok;
+}
+
+static int deque_steal(Deque *d, Range *out) {
+    int ok = 0;
+    deque_lock(d);
+    if (d->tail != d->head) {
+        *out = d->items[d->head++ % LP_DEQUE_CAP];
+        ok = 1;
+    }
+    deque_unlock(d);
+    return ok;
+}
+
+/* ========== Scheduling ========== */
+
+static int steal_any(int self, uint32_t *seed, Range *out) {
+    int n = pool.nworkers;
+
+    /* xorshift victim selection, then sweep everyone once */
+    uint32_t x = *seed;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    *seed = x;
+
+    int first = (int)(x % (uint32_t)n);
+    for (int i = 0; i < n; i++) {
+        int victim = (first + i) % n;
+        if (victim == self) continue;
+        if (deque_steal(&pool.deques[victim], out)) return 1;
+    }
+    return 0;
+}
+
+/* Split lazily: keep the lower half, expose the upper half to thieves */
+static void run_range(Job *job, Deque *own, Range r) {
+    while (r.hi - r.lo > job->chunk) {
+        int64_t mid = r.lo + (r.hi - r.lo) / 2;
+        if (!deque_push(own, (Range){ mid, r.hi })) break;
+        r.hi = mid;
+    }
+    job->body(r.lo, r.hi, job->ctx);
+    atomic_fetch_sub_explicit(&job->remaining, r.hi - r.lo, memory_order_acq_rel);
+}
+
+static void run_stealing(Job *job, int self) {
+    Deque *own = &pool.deques[self];
+    uint32_t seed = 2463534242u ^ (uint32_t)(self * 0x9E3779B9u);
+    Range r;
+
+    for (;;) {
+        if (deque_pop(own, &r) || steal_any(self, &seed, &r)) {
+            run_range(job, own, r);
+            continue;
+        }
+        if (atomic_load_explicit(&job->remaining, memory_order_acquire) == 0) break;
+        sched_yield();
+    }
+}
+
+/*
+ * Block w of n equal blocks, measured in units of `unit` iterations so
+ * block edges can be kept off shared pages; the first blocks take the
+ * leftover units and the last block absorbs any partial unit
+ */
+static Range static_block(int64_t start, int64_t end, int w, int n, int64_t unit) {
+    int64_t units = (end - start) / unit;
+    int64_t block = units / n, extra = units % n;
+    int64_t lo = start + (block * w + (w < extra ? w : extra)) * unit;
+    int64_t hi = lo + (block + (w < extra ? 1 : 0)) * unit;
+    if (w == n - 1) hi = end;
+    return (Range){ lo, hi };
+}
+
+static void run_cyclic(Job *job, int self) {
+    int64_t stride = job->chunk * pool.nworkers;
+    for (int64_t lo = job->start + job->chunk * self; lo < job->end; lo += stride) {
+        int64_t hi = job->end - lo > job->chunk ? lo + job->chunk : job->end;
+        job->body(lo, hi, job->ctx);
+    }
+}
+
+static void run_dynamic(Job *job) {
+    for (;;) {
+        int64_t lo = atomic_fetch_add_explicit(&job->next, job->chunk, memory_order_relaxed);
+        if (lo >= job->end) break;
+        int64_t hi = job->end - lo > job->chunk ? lo + job->chunk : job->end;
+        job->body(lo, hi, job->ctx);
+    }
+}
+
+/* Claim remaining / (2 * workers) iterations, never fewer than chunk */
+static void run_guided(Job *job) {
+    int64_t lo = atomic_load_explicit(&job->next, memory_order_relaxed);
+    for (;;) {
+        if (lo >= job->end) break;
+        int64_t size = (job->end - lo) / (2 * (int64_t)pool.nworkers);
+        if (size < job->chunk) size = job->chunk;
+        int64_t hi = job->end - lo > size ? lo + size : job->end;
+        if (!atomic_compare_exchange_weak_explicit(&job->next, &lo, hi,
+                                                   memory_order_relaxed,
+                                                   memory_order_relaxed)) {
+            continue;
+        }
+        job->body(lo, hi, job->ctx);
+        lo = atomic_load_explicit(&job->next, memory_order_relaxed);
+    }
+}
+
+static void run_job(Job *job, int self) {
+    in_parallel = 1;
+    reduce_slot = job->slots ? job->slots + (size_t)self * sizeof(Slot) : NULL;
+
+    switch (job->schedule) {
+        case LP_SCHED_STATIC: {
+            Range r = static_block(job->start, job->end, self, pool.nworkers, job->chunk);
+            if (r.hi > r.lo) job->body(r.lo, r.hi, job->ctx);
+            break;
+        }
+        case LP_SCHED_CYCLIC:  run_cyclic(job, self); break;
+        case LP_SCHED_DYNAMIC: run_dynamic(job); break;
+        case LP_SCHED_GUIDED:  run_guided(job); break;
+        default:               run_stealing(job, self); break;
+    }
+
+    in_parallel = 0;
+    reduce_slot = NULL;
+
+    /* Lines printed by the loop body come out before the loop returns */
+    __lp_flush();
+}
+
+/* ========== Affinity ========== */
+
+/*
+ * LP_CPUS=0,2,8-15   pin workers to these CPUs, in order
+ * LP_AFFINITY=compact fill a socket (core by core) before the next one
+ * LP_AFFINITY=scatter spread consecutive workers across sockets
+ * Worker w always lands on the same CPU, so static blocks first touched
+ * by w stay on w's NUMA node for later loops with the same bounds.
+ */
+typedef struct {
+    int cpu;
+    int package;
+    int core;
+    int rank;       /* position within its package */
+} CpuInfo;
+
+static int read_topology(int cpu, const char *field) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, field);
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    int v = 0;
+    if (fscanf(f, "%d", &v) != 1) v = 0;
+    fclose(f);
+    return v;
+}
+
+static int parse_cpu_list(const char *s, int *cpus, int max) {
+    int n = 0;
+    while (*s && n < max) {
+        char *end;
+        long lo = strtol(s, &end, 10);
+        if (end == s) break;
+        long hi = lo;
+        s = end;
+        if (*s == '-') {
+            hi = strtol(s + 1, &end, 10);
+            s = end;
+        }
+        for (long c = lo; c <= hi && n < max; c++) {
+            if (c >= 0 && c < CPU_SETSIZE) cpus[n++] = (int)c;
+        }
+        if (*s == ',') s++;
+    }
+    return n;
+}
+
+static int cmp_compact(const void *a, const void *b) {
+    const CpuInfo *x = a, *y = b;
+    if (x->package != y->package) return x->package - y->package;
+    if (x->core != y->core) return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+static int cmp_scatter(const void *a, const void *b) {
+    const CpuInfo *x = a, *y = b;
+    if (x->rank != y->rank) return x->rank - y->rank;
+    return x->package - y->package;
+}
+
+/* Fill cpus with the pinning order; 0 means leave threads unpinned */
+static int plan_affinity(int *cpus, int max) {
+    const char *list = getenv("LP_CPUS");
+    if (list && *list) return parse_cpu_list(list, cpus, max);
+
+    const char *mode = getenv("LP_AFFINITY");
+    if (!mode) return 0;
+    int scatter = strcmp(mode, "scatter") == 0;
+    if (!scatter && strcmp(mode, "compact") != 0) return 0;
+
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return 0;
+
+    static CpuInfo info[CPU_SETSIZE];
+    int n = 0;
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (!CPU_ISSET(c, &set)) continue;
+        info[n].cpu = c;
+        info[n].package = read_topology(c, "physical_package_id");
+        info[n].core = read_topology(c, "core_id");
+        n++;
+    }
+    qsort(info, n, sizeof(CpuInfo), cmp_compact);
+
+    if (scatter) {
+        for (int i = 0; i < n; i++) {
+            info[i].rank = (i > 0 && info[i].package == info[i - 1].package)
+                         ? info[i - 1].rank + 1 : 0;
+        }
+        qsort(info, n, sizeof(CpuInfo), cmp_scatter);
+    }
+
+    if (n > max) n = max;
+    for (int i = 0; i < n; i++) cpus[i] = info[i].cpu;
+    return n;
+}
+
+static void pin_self(int w) {
+    if (pool.ncpus == 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(pool.cpus[w % pool.ncpus], &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/* ========== Pool ========== */
+
+static void *worker_main(void *arg) {
+    worker_id = (int)(intptr_t)arg;
+    uint64_t seen = 0;
+
+    pin_self(worker_id);
+
+    for (;;) {
+        pthread_mutex_lock(&pool.lock);
+        while (pool.generation == seen) {
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        }
+        seen = pool.generation;
+        Job *job = pool.job;
+        pthread_mutex_unlock(&pool.lock);
+
+        run_job(job, worker_id);
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.active == 0) pthread_cond_signal(&pool.idle);
+        pthread_mutex_unlock(&pool.lock);
+    }
+    return NULL;
+}
+
+static int default_workers(void) {
+    const char *env = getenv("LP_NUM_THREADS");
+    if (env && *env) {
+        int n = atoi(env);
+        if (n > 0) return n;
+    }
+
+    /* An explicit CPU list sizes the pool */
+    if (pool.ncpus > 0 && getenv("LP_CPUS")) return pool.ncpus;
+
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        int n = CPU_COUNT(&set);
+        if (n > 0) return n;
+    }
+
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static void pool_init(void) {
+    pool.ncpus = plan_affinity(pool.cpus, LP_MAX_WORKERS);
+
+    int n = default_workers();
+    if (n > LP_MAX_WORKERS) n = LP_MAX_WORKERS;
+    pool.nworkers = n;
+
+    for (int i = 0; i < n; i++) {
+        atomic_flag_clear(&pool.deques[i].lock);
+    }
+
+    /* Worker 0 is the calling thread */
+    pin_self(0);
+    for (int i = 1; i < n; i++) {
+        if (pthread_create(&pool.threads[i], NULL, worker_main, (void *)(intptr_t)i) != 0) {
+            pool.nworkers = i;
+            break;
+        }
+        pthread_detach(pool.threads[i]);
+    }
+}
+
+/* ========== Entry Points ========== */
+
+/* Returns 0 if the loop has to run serially on the calling thread */
+static int pool_ready(int64_t count) {
+    if (in_parallel || worker_id != 0) return 0;
+    pthread_once(&pool_once, pool_init);
+    return pool.nworkers > 1 && count > 1;
+}
+
+static int64_t default_chunk(int schedule, int64_t count, int n) {
+    switch (schedule) {
+        case LP_SCHED_STATIC:
+        case LP_SCHED_CYCLIC:
+        case LP_SCHED_GUIDED:
+            return 1;
+        case LP_SCHED_DYNAMIC: {
+            int64_t chunk = count / ((int64_t)n * LP_SPLIT_FACTOR * 8);
+            return chunk > 0 ? chunk : 1;
+        }
+        default: {
+            int64_t grain = count / ((int64_t)n * LP_SPLIT_FACTOR);
+            return grain > 0 ? grain : 1;
+        }
+    }
+}
+
+static void run_parallel(int64_t start, int64_t end, LpBodyFn body, void *ctx,
+                         int schedule, int64_t chunk, char *slots) {
+    int n = pool.nworkers;
+    int64_t count = end - start;
+
+    Job job;
+    job.body = body;
+    job.ctx = ctx;
+    job.start = start;
+    job.end = end;
+    job.schedule = schedule;
+    job.chunk = chunk > 0 ? chunk : default_chunk(schedule, count, n);
+    job.slots = slots;
+    atomic_init(&job.remaining, count);
+    atomic_init(&job.next, start);
+
+    /* Work stealing starts from one contiguous block per worker */
+    if (schedule == LP_SCHED_STEAL) {
+        for (int w = 0; w < n; w++) {
+            Range r = static_block(start, end, w, n, 1);
+            if (r.hi > r.lo) deque_push(&pool.deques[w], r);
+        }
+    }
+
+    /* ...and after anything the caller printed before it */
+    __lp_flush();
+
+    pthread_mutex_lock(&pool.lock);
+    pool.job = &job;
+    pool.active = n - 1;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    run_job(&job, 0);
+
+    /* Job lives on this stack - wait until every helper has let go of it */
+    pthread_mutex_lock(&pool.lock);
+    while (pool.active > 0) {
+        pthread_cond_wait(&pool.idle, &pool.lock);
+    }
+    pool.job = NULL;
+    pthread_mutex_unlock(&pool.lock);
+}
+
+void __lp_parallel_for(int64_t start, int64_t end, LpBodyFn body, void *ctx,
+                       int32_t schedule, int64_t chunk) {
+    if (end <= start) return;
+
+    /* Nested loops run serially inside the enclosing worker */
+    if (!pool_ready(end - start)) {
+        body(start, end, ctx);
+        return;
+    }
+
+    run_parallel(start, end, body, ctx, schedule, chunk, NULL);
+}
+
+void __lp_parallel_reduce(int64_t start, int64_t end, LpBodyFn body, void *ctx,
+                          int32_t schedule, int64_t chunk,
+                          void *result, const void *identity, int64_t size,
+                          LpCombineFn combine) {
+    if (end <= start) return;
+
+    /* Serial: fold straight into the result */
+    if (!pool_ready(end - start)) {
+        void *outer = reduce_slot;
+        reduce_slot = result;
+        body(start, end, ctx);
+        reduce_slot = outer;
+        return;
+    }
+
+    int n = pool.nworkers;
+    for (int w = 0; w < n; w++) {
+        memcpy(pool.slots[w].bytes, identity, (size_t)size);
+    }
+
+    run_parallel(start, end, body, ctx, schedule, chunk, (char *)pool.slots);
+
+    /* Pairwise tree combine, then fold into the initial value */
+    for (int stride = 1; stride < n; stride *= 2) {
+        for (int w = 0; w + stride < n; w += 2 * stride) {
+            combine(pool.slots[w].bytes, pool.slots[w + stride].bytes);
+        }
+    }
+    combine(result, pool.slots[0].bytes);
+}
+
+void *__lp_reduce_slot(void) {
+    return reduce_slot;
+}
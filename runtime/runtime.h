@@ -0,0 +1,160 @@
+#ifndef LP_RUNTIME_H
+#define LP_RUNTIME_H
+
+#include <stdint.h>
+
+/*
+ * Lambda Photon runtime ABI
+ * Entry points called from generated code; names and signatures must
+ * match the declarations built in src/codegen.c
+ */
+
+/*
+ * Bumped, with RUNTIME_ABI in src/codegen.c, whenever code compiled
+ * against an older runtime would misbehave: entry points, layouts, slot
+ * sizes. photon run's object cache is keyed by it.
+ */
+#define LP_RUNTIME_ABI 1
+
+/* Loop schedules; values match Schedule in src/ast.h */
+typedef enum {
+    LP_SCHED_STEAL,     /* work stealing, chunk = minimum split size */
+    LP_SCHED_STATIC,    /* one block per worker, edges on chunk multiples */
+    LP_SCHED_CYCLIC,    /* chunks dealt round-robin to workers */
+    LP_SCHED_DYNAMIC,   /* chunks claimed from a shared counter */
+    LP_SCHED_GUIDED     /* claims shrink with the remaining work, chunk = minimum */
+} LpSchedule;
+
+/* Outlined @parallel loop body - runs iterations [lo, hi) */
+typedef void (*LpBodyFn)(int64_t lo, int64_t hi, void *ctx);
+
+/* Reduction combiner: *dst = *dst op *src */
+typedef void (*LpCombineFn)(void *dst, const void *src);
+
+/* Largest reduction value; one slot per worker, cache-line sized */
+#define LP_REDUCE_SLOT 64
+
+/*
+ * Run body over [start, end) on the worker pool with the given schedule
+ * (chunk 0 picks a default). Threads are started on first use;
+ * LP_NUM_THREADS overrides the count
+ */
+void __lp_parallel_for(int64_t start, int64_t end, LpBodyFn body, void *ctx,
+                       int32_t schedule, int64_t chunk);
+
+/*
+ * Parallel reduction: every worker slot starts at identity, chunks fold
+ * their partial into __lp_reduce_slot(), and the slots are combined
+ * pairwise into *result when the loop finishes
+ */
+void __lp_parallel_reduce(int64_t start, int64_t end, LpBodyFn body, void *ctx,
+                          int32_t schedule, int64_t chunk,
+                          void *result, const void *identity, int64_t size,
+                          LpCombineFn combine);
+
+/* Partial accumulator of the calling worker in the running reduction */
+void *__lp_reduce_slot(void);
+
+/*
+ * Arenas
+ * Each thread bump-allocates from two arenas of its own, so allocating
+ * in a @parallel body never contends with other workers. The permanent
+ * arena hands out zeroed, 64-byte aligned memory that lives until exit.
+ * The region arena is a stack: generated code takes a mark on entering a
+ * function or loop iteration that allocates scratch data and releases
+ * back to it on leaving, which frees everything allocated since in one
+ * pointer reset. Region memory is not zeroed
+ */
+void *__lp_alloc(int64_t bytes);
+void *__lp_region_alloc(int64_t bytes);
+void *__lp_region_mark(void);
+void __lp_region_release(void *mark);
+
+/*
+ * Arrays
+ * Element storage of arrays that escape their frame or are too large
+ * for it: 64-byte aligned and zero-filled, from the permanent arena.
+ * Allocations of LP_HUGE_ARRAY bytes or more are mapped directly,
+ * aligned to and advised for huge pages. Arrays live until exit
+ */
+#define LP_HUGE_ARRAY (2 << 20)
+
+void *__lp_alloc_array(int64_t count, int64_t elem_size);
+
+/* Storage of an array that dies with the current region, not zeroed */
+void *__lp_region_array(int64_t count, int64_t elem_size);
+
+/* Failed bounds check on a[index]: reports and exits */
+_Noreturn void __lp_bounds_fail(int64_t index, int64_t len);
+
+/* Failed bounds check on @load / @store of lanes starting at a[index] */
+_Noreturn void __lp_lanes_fail(int64_t index, int64_t lanes, int64_t len);
+
+/*
+ * File input
+ * @mmap(path) maps the whole file as [u8] without copying, advised for a
+ * sequential scan. The mapping is private, so the file never changes and
+ * only pages that are stored to get copied. It lives until exit
+ */
+void *__lp_mmap(const char *path, int64_t *len);
+
+/*
+ * @lines(a): offsets of the start of every line of a, then a.len, so line
+ * k is a[starts[k] .. starts[k + 1]], newline included. *count receives
+ * the number of offsets
+ */
+int64_t *__lp_lines(const uint8_t *data, int64_t len, int64_t *count);
+
+/* Failed bounds check on @slice(a, lo, hi): reports and exits */
+_Noreturn void __lp_slice_fail(int64_t lo, int64_t hi, int64_t len);
+
+/*
+ * Output
+ * @print appends a line to a per-thread 64 KiB buffer that is written
+ * with write(2) when full, at exit, and at the end of every parallel
+ * loop. Floats print as the shortest decimal that reads back to the same
+ * value. On a terminal every line is written at once
+ */
+void __lp_print_i64(int64_t v);
+void __lp_print_u64(uint64_t v);
+void __lp_print_f64(double v);
+void __lp_print_f32(float v);
+void __lp_print_str(const char *s);
+
+/* Writes out the calling thread's buffered output */
+void __lp_flush(void);
+
+/*
+ * CPU dispatch
+ * x86-64 micro-architecture level of the running CPU (1 = baseline, 2..4
+ * for x86-64-v2..v4), read with CPUID before main. @multiversion loops
+ * branch on it to pick their clone; 1 on other architectures
+ */
+extern int32_t __lp_cpu_level;
+
+/*
+ * async/await executor
+ * `async e` compiles to a switched-resume LLVM coroutine that starts
+ * suspended; __lp_task_start queues it and threads blocked in
+ * __lp_task_wait drive the ready queue. Tasks stay alive until exit so
+ * a result can be awaited any number of times
+ */
+typedef struct LpTask LpTask;
+
+/* Largest value an async expression can produce */
+#define LP_TASK_RESULT 16
+
+LpTask *__lp_task_new(void);
+void __lp_task_start(LpTask *task, void *coro);
+void *__lp_task_result(LpTask *task);
+
+/* Called by the coroutine once its result is stored */
+void __lp_task_finish(LpTask *task);
+
+/* From a coroutine: 1 if self must suspend until task finishes, 0 if done */
+int32_t __lp_task_await(LpTask *task, LpTask *self);
+
+/* From ordinary code: run queued tasks until task finishes */
+void __lp_task_wait(LpTask *task);
+
+#endif
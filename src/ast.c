@@ -44,6 +44,7 @@ void ast_free(ASTNode *node) {
             free(node->data.apply.args);
             break;
         case NODE_TERNARY:
+        case NODE_IF:
             ast_free(node->data.ternary.cond);
             ast_free(node->data. ternary.then_branch);
             ast_free(node->data.ternary.else_branch);
@@ -55,6 +56,7 @@ void ast_free(ASTNode *node) {
             break;
         case NODE_FOR:
             free(node->data. for_loop.var);
+            free(node->data.for_loop.reduce_var);
             ast_free(node->data.for_loop. start);
             ast_free(node->data.for_loop.end);
             ast_free(node->data.for_loop.body);
@@ -73,10 +75,12 @@ void ast_free(ASTNode *node) {
             for (size_t i = 0; i < node->data. array.count; i++)
                 ast_free(node->data.array.elements[i]);
             free(node->data. array.elements);
+            ast_free(node->data.array.repeat);
             break;
         case NODE_INDEX:
             ast_free(node->data. index.array);
             ast_free(node->data.index.index);
+            ast_free(node->data.index.value);
             break;
         case NODE_BUILTIN:
             free(node->data.builtin.name);
@@ -131,4 +135,24 @@ Type *type_clone(Type *t) {
             c->params[i] = type_clone(t->params[i]);
     }
     return c;
-}
\ No newline at end of file
+}
+static const struct { const char *name; unsigned flag; } fast_math_flags[] = {
+    { "reassoc", FM_REASSOC }, { "contract", FM_CONTRACT }, { "nnan", FM_NNAN },
+    { "ninf", FM_NINF }, { "nsz", FM_NSZ }, { "arcp", FM_ARCP }, { "afn", FM_AFN },
+    { "fast", FM_FAST }
+};
+
+unsigned fast_math_flag(const char *name, size_t len) {
+    for (size_t i = 0; i < sizeof(fast_math_flags) / sizeof(fast_math_flags[0]); i++) {
+        if (strlen(fast_math_flags[i].name) == len &&
+            memcmp(fast_math_flags[i].name, name, len) == 0) return fast_math_flags[i].flag;
+    }
+    return 0;
+}
+
+const char *fast_math_name(unsigned flag) {
+    for (size_t i = 0; i < sizeof(fast_math_flags) / sizeof(fast_math_flags[0]); i++) {
+        if (fast_math_flags[i].flag == flag) return fast_math_flags[i].name;
+    }
+    return NULL;
+}
@@ -14,6 +14,7 @@ typedef enum {
     NODE_LAMBDA,
     NODE_APPLY,
     NODE_TERNARY,
+    NODE_IF,
     NODE_ARRAY,
     NODE_INDEX,
     NODE_BUILTIN,
@@ -31,9 +32,39 @@ typedef enum {
     OP_EQ, OP_NEQ, OP_LT, OP_GT, OP_LTE, OP_GTE,
     OP_AND, OP_OR,
     OP_BITAND, OP_BITOR, OP_BITXOR, OP_SHL, OP_SHR,
-    OP_NEG, OP_NOT
+    OP_NEG, OP_NOT,
+    OP_MIN, OP_MAX
 } Operator;
 
+/* @parallel loop schedules; values match LpSchedule in runtime/runtime.h */
+typedef enum {
+    SCHED_STEAL,    /* work stealing with lazy splitting (default) */
+    SCHED_STATIC,   /* one contiguous block per worker, edges on chunk multiples */
+    SCHED_CYCLIC,   /* fixed chunks dealt round-robin */
+    SCHED_DYNAMIC,  /* fixed chunks claimed from a shared counter */
+    SCHED_GUIDED    /* shrinking chunks claimed from a shared counter */
+} Schedule;
+
+/* @unroll settings other than a count */
+enum {
+    UNROLL_DEFAULT = 0,     /* no annotation */
+    UNROLL_ON      = -1,    /* @unroll: unroll, the factor left to the cost model */
+    UNROLL_OFF     = -2,    /* @nounroll */
+    UNROLL_FULL    = -3     /* @unroll(full) */
+};
+
+/* Fast-math flags of -ffast-math and @fastmath, mapped to LLVM's by codegen */
+typedef enum {
+    FM_REASSOC  = 1 << 0,   /* reassociate, so float sums can vectorize */
+    FM_CONTRACT = 1 << 1,   /* fuse a * b + c into an fma */
+    FM_NNAN     = 1 << 2,   /* no NaN operands or results */
+    FM_NINF     = 1 << 3,   /* no infinite operands or results */
+    FM_NSZ      = 1 << 4,   /* the sign of zero does not matter */
+    FM_ARCP     = 1 << 5,   /* x / y may become x * (1 / y) */
+    FM_AFN      = 1 << 6,   /* approximate @sin, @exp, ... */
+    FM_FAST     = (1 << 7) - 1
+} FastMath;
+
 typedef struct ASTNode ASTNode;
 typedef struct Type Type;
 
@@ -41,12 +72,14 @@ struct Type {
     enum {
         TYPE_UNKNOWN,
         TYPE_VOID,
+        TYPE_BOOL,      /* i1, the result of comparisons and ! */
         TYPE_I8, TYPE_I16, TYPE_I32, TYPE_I64,
         TYPE_U8, TYPE_U16, TYPE_U32, TYPE_U64,
         TYPE_F32, TYPE_F64,
         TYPE_STR,
         TYPE_PTR,
         TYPE_ARRAY,
+        TYPE_VECTOR,    /* array_len lanes of inner, e.g. f32x8 */
         TYPE_FUNC,
         TYPE_ASYNC
     } kind;
@@ -54,7 +87,7 @@ struct Type {
     Type **params;
     size_t param_count;
     Type *ret;
-    size_t array_len;
+    size_t array_len;      /* element count of [T; N] (0 when only known at run time) or lanes */
 };
 
 struct ASTNode {
@@ -74,6 +107,10 @@ struct ASTNode {
             Operator op;
             ASTNode *left;
             ASTNode *right;
+            /* Proven by range analysis (optimize.c) */
+            int no_wrap;          /* + - * stays within the result type */
+            int safe_divisor;     /* / % cannot trap, so may be speculated */
+            int narrow_bits;      /* / % fits in this narrower width, 0 if none */
         } binary;
         
         struct {
@@ -84,8 +121,10 @@ struct ASTNode {
         struct {
             char **params;
             size_t param_count;
-            Type **param_types;
+            Type **param_types;   /* NULL entries for unannotated parameters */
             ASTNode *body;
+            int escapes;          /* closure may outlive its creator (set by codegen) */
+            unsigned fast_math;   /* @fastmath flags of the body */
         } lambda;
         
         struct {
@@ -97,8 +136,8 @@ struct ASTNode {
         struct {
             ASTNode *cond;
             ASTNode *then_branch;
-            ASTNode *else_branch;
-        } ternary;
+            ASTNode *else_branch;  /* NULL for an if without else */
+        } ternary;  /* also NODE_IF, whose branches are blocks */
         
         struct {
             char *name;
@@ -112,6 +151,16 @@ struct ASTNode {
             ASTNode *end;
             ASTNode *body;
             int parallel;  /* 1 if @parallel annotation present */
+            Operator reduce_op;
+            char *reduce_var;  /* @parallel(reduce <op> <var>), NULL if none */
+            Schedule schedule;
+            int64_t chunk;     /* chunk / grain size, 0 = runtime default */
+            int multiversion;  /* @multiversion: clones per x86-64 ISA level */
+            unsigned fast_math; /* @fastmath flags of the body */
+            int vector_width;  /* @vectorize(width=N), 0 = cost model */
+            int interleave;    /* @vectorize(interleave=M), 0 = cost model */
+            int vectorize;     /* @vectorize present */
+            int unroll;        /* @unroll(N) count or an UNROLL_ setting */
         } for_loop;
         
         struct {
@@ -140,11 +189,15 @@ struct ASTNode {
         struct {
             ASTNode **elements;
             size_t count;
+            ASTNode *repeat;      /* [value; n]: the length n, NULL for a list */
+            int escapes;          /* may outlive its creating frame (set by codegen) */
         } array;
         
         struct {
             ASTNode *array;
             ASTNode *index;
+            ASTNode *value;       /* a[i] = value, NULL for a read */
+            int in_bounds;        /* index proven in range, no check needed */
         } index;
     } data;
 };
@@ -155,4 +208,9 @@ Type *type_new(int kind);
 void type_free(Type *t);
 Type *type_clone(Type *t);
 
+/* FastMath flag named name[0..len) ("reassoc", ..., or "fast" for all), 0 if unknown */
+unsigned fast_math_flag(const char *name, size_t len);
+/* Name of a single FastMath flag, NULL if flag is not one */
+const char *fast_math_name(unsigned flag);
+
 #endif
\ No newline at end of file
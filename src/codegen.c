@@ -2,12 +2,38 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <limits.h>
+#include <dlfcn.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <llvm-c/Core.h>
 #include <llvm-c/Target.h>
 #include <llvm-c/TargetMachine.h>
 #include <llvm-c/Analysis.h>
 #include <llvm-c/BitWriter.h>
+#include <llvm-c/Support.h>
+#include <llvm-c/IRReader.h>
+#include <llvm-c/BitReader.h>
+#include <llvm-c/Linker.h>
+#include <llvm-c/LLJIT.h>
+#include <llvm-c/DebugInfo.h>
 #include <llvm-c/Transforms/PassBuilder.h>
+#include <llvm/Config/llvm-config.h>
+
+/* Runtime archive linked into every program (set by the Makefile) */
+#ifndef LP_RUNTIME_LIB
+#define LP_RUNTIME_LIB "libphoton_rt.a"
+#endif
+
+/* The same runtime as one bitcode module, linked in before optimizing */
+#ifndef LP_RUNTIME_BC
+#define LP_RUNTIME_BC "photon_rt.bc"
+#endif
 
 /* ========== Scope Management ========== */
 
@@ -28,41 +54,67 @@ static void scope_free(Scope *s) {
     free(s);
 }
 
-static void scope_define(Scope *s, const char *name, LLVMValueRef value, LLVMTypeRef type) {
+static Symbol *scope_define(Scope *s, const char *name, LLVMValueRef value, LLVMTypeRef type) {
     Symbol *sym = malloc(sizeof(Symbol));
     sym->name = strdup(name);
     sym->value = value;
     sym->type = type;
+    sym->ast_type = NULL;
+    sym->func = NULL;
     sym->next = s->symbols;
     s->symbols = sym;
+    return sym;
 }
 
-static LLVMValueRef scope_lookup(Scope *s, const char *name) {
+static Symbol *scope_lookup_symbol(Scope *s, const char *name) {
     for (Scope *scope = s; scope; scope = scope->parent) {
         for (Symbol *sym = scope->symbols; sym; sym = sym->next) {
             if (strcmp(sym->name, name) == 0) {
-                return sym->value;
+                return sym;
             }
         }
     }
     return NULL;
 }
 
+static LLVMValueRef scope_lookup(Scope *s, const char *name) {
+    Symbol *sym = scope_lookup_symbol(s, name);
+    return sym ? sym->value : NULL;
+}
+
 static LLVMTypeRef scope_lookup_type(Scope *s, const char *name) {
-    for (Scope *scope = s; scope; scope = scope->parent) {
-        for (Symbol *sym = scope->symbols; sym; sym = sym->next) {
-            if (strcmp(sym->name, name) == 0) {
-                return sym->type;
-            }
-        }
-    }
-    return NULL;
+    Symbol *sym = scope_lookup_symbol(s, name);
+    return sym ? sym->type : NULL;
 }
 
 /* ========== Forward Declarations ========== */
 
 static LLVMValueRef codegen_expr(CodeGen *cg, ASTNode *node);
 static void codegen_stmt(CodeGen *cg, ASTNode *node);
+static LLVMValueRef codegen_async(CodeGen *cg, ASTNode *node);
+static LLVMValueRef codegen_await(CodeGen *cg, ASTNode *node);
+static LLVMValueRef codegen_launch(CodeGen *cg, ASTNode *node);
+static LLVMValueRef codegen_lambda(CodeGen *cg, ASTNode *node, const char *self_name,
+                                   LLVMValueRef *fn_out);
+static LLVMValueRef codegen_apply(CodeGen *cg, ASTNode *node, int tail);
+static LLVMValueRef codegen_array(CodeGen *cg, ASTNode *node);
+static LLVMValueRef codegen_index(CodeGen *cg, ASTNode *node);
+static LLVMValueRef codegen_mmap(CodeGen *cg, ASTNode *node);
+static LLVMValueRef codegen_lines(CodeGen *cg, ASTNode *node);
+static LLVMValueRef codegen_slice(CodeGen *cg, ASTNode *node);
+static LLVMValueRef codegen_vector_builtin(CodeGen *cg, ASTNode *node);
+struct MathIntrinsic;
+static const struct MathIntrinsic *math_intrinsic(const char *name);
+static LLVMValueRef codegen_math_builtin(CodeGen *cg, ASTNode *node, const struct MathIntrinsic *mi);
+static LLVMValueRef codegen_lane(CodeGen *cg, ASTNode *node);
+static int array_fits_frame(CodeGen *cg, ASTNode *node);
+static LLVMValueRef get_runtime_func(CodeGen *cg, const char *name, LLVMTypeRef ret,
+                                     LLVMTypeRef *params, unsigned count);
+static LLVMValueRef call_intrinsic(CodeGen *cg, const char *name, LLVMTypeRef *overloads,
+                                   size_t overload_count, LLVMValueRef *args, unsigned count,
+                                   const char *label);
+static void codegen_block(CodeGen *cg, ASTNode *node);
+static LLVMValueRef codegen_convert(CodeGen *cg, LLVMValueRef val, LLVMTypeRef type, int is_unsigned);
 
 /* ========== Type Mapping ========== */
 
@@ -71,6 +123,7 @@ static LLVMTypeRef get_llvm_type(CodeGen *cg, Type *t) {
     
     switch (t->kind) {
         case TYPE_VOID:  return LLVMVoidTypeInContext(cg->context);
+        case TYPE_BOOL:  return LLVMInt1TypeInContext(cg->context);
         case TYPE_I8:    return LLVMInt8TypeInContext(cg->context);
         case TYPE_I16:   return LLVMInt16TypeInContext(cg->context);
         case TYPE_I32:   return LLVMInt32TypeInContext(cg->context);
@@ -83,270 +136,696 @@ static LLVMTypeRef get_llvm_type(CodeGen *cg, Type *t) {
         case TYPE_F64:   return LLVMDoubleTypeInContext(cg->context);
         case TYPE_STR:   return LLVMPointerTypeInContext(cg->context, 0);
         case TYPE_PTR:   return LLVMPointerTypeInContext(cg->context, 0);
+        case TYPE_FUNC: {
+            /* Closure: { ptr fn, ptr env } */
+            LLVMTypeRef ptr = LLVMPointerTypeInContext(cg->context, 0);
+            LLVMTypeRef fields[] = { ptr, ptr };
+            return LLVMStructTypeInContext(cg->context, fields, 2, 0);
+        }
+        case TYPE_ARRAY: {
+            /* { ptr data, i64 len } */
+            LLVMTypeRef fields[] = { LLVMPointerTypeInContext(cg->context, 0),
+                                     LLVMInt64TypeInContext(cg->context) };
+            return LLVMStructTypeInContext(cg->context, fields, 2, 0);
+        }
+        case TYPE_VECTOR:
+            return LLVMVectorType(get_llvm_type(cg, t->inner), (unsigned)t->array_len);
         default:         return LLVMInt64TypeInContext(cg->context);
     }
 }
 
+static int is_vector_type(LLVMTypeRef type) {
+    return LLVMGetTypeKind(type) == LLVMVectorTypeKind;
+}
+
+/* Float, or a vector of float lanes */
+static int is_float_type(LLVMTypeRef type) {
+    if (is_vector_type(type)) type = LLVMGetElementType(type);
+    LLVMTypeKind kind = LLVMGetTypeKind(type);
+    return kind == LLVMFloatTypeKind || kind == LLVMDoubleTypeKind;
+}
+
+/* scalar in every lane of vector type */
+static LLVMValueRef build_splat(CodeGen *cg, LLVMValueRef scalar, LLVMTypeRef type) {
+    LLVMTypeRef i32 = LLVMInt32TypeInContext(cg->context);
+    LLVMValueRef poison = LLVMGetPoison(type);
+    LLVMValueRef first = LLVMBuildInsertElement(cg->builder, poison, scalar, LLVMConstInt(i32, 0, 0), "");
+    LLVMValueRef zeros = LLVMConstNull(LLVMVectorType(i32, LLVMGetVectorSize(type)));
+    return LLVMBuildShuffleVector(cg->builder, first, poison, zeros, "splat");
+}
+
+/* ========== Signedness ========== */
+
+/*
+ * LLVM integers carry no sign, so unsigned-ness rides on source types:
+ * the type checker leaves one in every expression's resolved_type, and
+ * symbols keep theirs in ast_type.
+ */
+static int is_unsigned_type(Type *t) {
+    if (t && t->kind == TYPE_VECTOR) t = t->inner;
+    return t && t->kind >= TYPE_U8 && t->kind <= TYPE_U64;
+}
+
+static int expr_unsigned(ASTNode *node) {
+    return node && is_unsigned_type(node->resolved_type);
+}
+
+/* ========== Fast Math ========== */
+
+#if LLVM_VERSION_MAJOR >= 18
+static LLVMFastMathFlags llvm_fast_math(unsigned flags) {
+    LLVMFastMathFlags fmf = LLVMFastMathNone;
+    if (flags & FM_REASSOC)  fmf |= LLVMFastMathAllowReassoc;
+    if (flags & FM_CONTRACT) fmf |= LLVMFastMathAllowContract;
+    if (flags & FM_NNAN)     fmf |= LLVMFastMathNoNaNs;
+    if (flags & FM_NINF)     fmf |= LLVMFastMathNoInfs;
+    if (flags & FM_NSZ)      fmf |= LLVMFastMathNoSignedZeros;
+    if (flags & FM_ARCP)     fmf |= LLVMFastMathAllowReciprocal;
+    if (flags & FM_AFN)      fmf |= LLVMFastMathApproxFunc;
+    return fmf;
+}
+#else
+/* Warns that flags of -ffast-math (node NULL) or an @fastmath on node are dropped */
+static void fast_math_ignored(ASTNode *node, unsigned flags, const char *what) {
+    if (!flags) return;
+    if (node) fprintf(stderr, "W: %u:%u: ", node->line, node->col);
+    else fputs("W: ", stderr);
+    fprintf(stderr, "%s needs LLVM 18, ignoring", what);
+    const char *sep = " ";
+    for (unsigned bit = 1; bit < FM_FAST; bit <<= 1) {
+        if (flags & bit) {
+            fprintf(stderr, "%s%s", sep, fast_math_name(bit));
+            sep = ",";
+        }
+    }
+    fputc('\n', stderr);
+}
+
+/* A float sum or product reduction: the loops reassoc lets the vectorizer reorder */
+static int reassoc_reduction(ASTNode *node) {
+    Operator op = node->data.for_loop.reduce_op;
+    ASTNode *body = node->data.for_loop.body;
+    if (!node->data.for_loop.reduce_var || (op != OP_ADD && op != OP_MUL)) return 0;
+    if (!body || body->data.block.count == 0) return 0;
+    Type *t = body->data.block.stmts[body->data.block.count - 1]->resolved_type;
+    if (t && t->kind == TYPE_VECTOR) t = t->inner;
+    return t && (t->kind == TYPE_F32 || t->kind == TYPE_F64);
+}
+#endif
+
+/*
+ * Float instructions carry the fast-math flags in effect where they are
+ * built: -ffast-math, widened by @fastmath on an enclosing loop or lambda.
+ * Before LLVM 18 the C API cannot set them, so -ffast-math falls back to
+ * function attributes (fast_math_attributes) and @fastmath loops allow
+ * the vectorizer to reorder; fast_math_ignored warns about the rest.
+ */
+static LLVMValueRef fast_math(CodeGen *cg, LLVMValueRef val) {
+#if LLVM_VERSION_MAJOR >= 18
+    if (cg->fast_math && val && LLVMIsAInstruction(val) && LLVMCanValueUseFastMathFlags(val)) {
+        LLVMSetFastMathFlags(val, llvm_fast_math(cg->fast_math));
+    }
+#else
+    (void)cg;
+#endif
+    return val;
+}
+
 /* ========== Builtin Functions ========== */
 
-static LLVMValueRef get_printf(CodeGen *cg) {
-    LLVMValueRef func = LLVMGetNamedFunction(cg->module, "printf");
-    if (! func) {
-        LLVMTypeRef param_types[] = { LLVMPointerTypeInContext(cg->context, 0) };
-        LLVMTypeRef printf_type = LLVMFunctionType(
-            LLVMInt32TypeInContext(cg->context),
-            param_types, 1, 1
-        );
-        func = LLVMAddFunction(cg->module, "printf", printf_type);
+/* @print lowers to the buffered writer in runtime/io.c, one entry point per type */
+static LLVMValueRef codegen_print(CodeGen *cg, ASTNode *node) {
+    if (node->data.builtin.count == 0) return NULL;
+    
+    ASTNode *arg = node->data.builtin.elements[0];
+    LLVMValueRef val = codegen_expr(cg, arg);
+    if (!val) return NULL;
+    
+    LLVMTypeRef type = LLVMTypeOf(val);
+    const char *name;
+    switch (LLVMGetTypeKind(type)) {
+        case LLVMFloatTypeKind:   name = "__lp_print_f32"; break;
+        case LLVMDoubleTypeKind:  name = "__lp_print_f64"; break;
+        case LLVMPointerTypeKind: name = "__lp_print_str"; break;
+        default: {
+            /* Narrower integers print through 64 bits */
+            int is_unsigned = expr_unsigned(arg);
+            type = LLVMInt64TypeInContext(cg->context);
+            val = codegen_convert(cg, val, type, is_unsigned);
+            name = is_unsigned ? "__lp_print_u64" : "__lp_print_i64";
+            break;
+        }
     }
-    return func;
+    
+    LLVMTypeRef void_type = LLVMVoidTypeInContext(cg->context);
+    LLVMValueRef print_fn = get_runtime_func(cg, name, void_type, &type, 1);
+    LLVMBuildCall2(cg->builder, LLVMFunctionType(void_type, &type, 1, 0), print_fn, &val, 1, "");
+    return NULL;
 }
 
 static LLVMValueRef codegen_builtin(CodeGen *cg, ASTNode *node) {
     if (strcmp(node->data.builtin.name, "print") == 0) {
-        LLVMValueRef printf_fn = get_printf(cg);
-        
-        if (node->data.builtin.count == 0) return NULL;
-        
-        LLVMValueRef val = codegen_expr(cg, node->data.builtin.elements[0]);
-        if (!val) return NULL;
-        
-        LLVMTypeRef val_type = LLVMTypeOf(val);
-        LLVMTypeKind kind = LLVMGetTypeKind(val_type);
-        
-        LLVMValueRef format_str;
-        LLVMValueRef args[2];
-        
-        if (kind == LLVMFloatTypeKind) {
-            /* Promote float to double for printf */
-            val = LLVMBuildFPExt(cg->builder, val, LLVMDoubleTypeInContext(cg->context), "ftod");
-            format_str = LLVMBuildGlobalStringPtr(cg->builder, "%f\n", "fmt_float");
-            args[0] = format_str;
-            args[1] = val;
-        } else if (kind == LLVMDoubleTypeKind) {
-            format_str = LLVMBuildGlobalStringPtr(cg->builder, "%f\n", "fmt_float");
-            args[0] = format_str;
-            args[1] = val;
-        } else if (kind == LLVMPointerTypeKind) {
-            format_str = LLVMBuildGlobalStringPtr(cg->builder, "%s\n", "fmt_str");
-            args[0] = format_str;
-            args[1] = val;
-        } else if (kind == LLVMIntegerTypeKind) {
-            /* Extend smaller integers to 64-bit for printf */
-            unsigned bits = LLVMGetIntTypeWidth(val_type);
-            if (bits < 64) {
-                val = LLVMBuildSExt(cg->builder, val, LLVMInt64TypeInContext(cg->context), "ext");
-            }
-            format_str = LLVMBuildGlobalStringPtr(cg->builder, "%lld\n", "fmt_int");
-            args[0] = format_str;
-            args[1] = val;
-        } else {
-            format_str = LLVMBuildGlobalStringPtr(cg->builder, "%lld\n", "fmt_int");
-            args[0] = format_str;
-            args[1] = val;
+        return codegen_print(cg, node);
+    }
+    
+    /* Outside a condition, hints are just their operand */
+    if ((strcmp(node->data.builtin.name, "likely") == 0 ||
+         strcmp(node->data.builtin.name, "unlikely") == 0) && node->data.builtin.count == 1) {
+        return codegen_expr(cg, node->data.builtin.elements[0]);
+    }
+    
+    if (strcmp(node->data.builtin.name, "launch") == 0) {
+        return codegen_launch(cg, node);
+    }
+    
+    if (strcmp(node->data.builtin.name, "len") == 0 && node->data.builtin.count == 1) {
+        LLVMValueRef arr = codegen_expr(cg, node->data.builtin.elements[0]);
+        return arr ? LLVMBuildExtractValue(cg->builder, arr, 1, "len") : NULL;
+    }
+    
+    if (strcmp(node->data.builtin.name, "mmap") == 0 && node->data.builtin.count == 1) {
+        return codegen_mmap(cg, node);
+    }
+    if (strcmp(node->data.builtin.name, "lines") == 0 && node->data.builtin.count == 1) {
+        return codegen_lines(cg, node);
+    }
+    if (strcmp(node->data.builtin.name, "slice") == 0 && node->data.builtin.count == 3) {
+        return codegen_slice(cg, node);
+    }
+    
+    /* Lane index and launch size inside a gpu kernel */
+    if (strcmp(node->data.builtin.name, "index") == 0 ||
+        strcmp(node->data.builtin.name, "count") == 0) {
+        char key[8];
+        snprintf(key, sizeof(key), "@%s", node->data.builtin.name);
+        LLVMValueRef val = scope_lookup(cg->current_scope, key);
+        if (!val) {
+            fprintf(stderr, "E: %u:%u: %s is only defined inside a gpu kernel\n",
+                    node->line, node->col, key);
         }
-        
-        LLVMTypeRef printf_type = LLVMFunctionType(
-            LLVMInt32TypeInContext(cg->context),
-            (LLVMTypeRef[]){ LLVMPointerTypeInContext(cg->context, 0) }, 1, 1
-        );
-        
-        return LLVMBuildCall2(cg->builder, printf_type, printf_fn, args, 2, "");
+        return val;
+    }
+    
+    const struct MathIntrinsic *math = math_intrinsic(node->data.builtin.name);
+    if (math) return codegen_math_builtin(cg, node, math);
+    
+    return codegen_vector_builtin(cg, node);
+}
+
+/* ========== Branching ========== */
+
+/* Truth value of val as i1 (a mask for a vector): nonzero, non-null */
+static LLVMValueRef codegen_truth(CodeGen *cg, LLVMValueRef val) {
+    LLVMTypeRef type = LLVMTypeOf(val);
+    LLVMTypeRef scalar = is_vector_type(type) ? LLVMGetElementType(type) : type;
+    switch (LLVMGetTypeKind(scalar)) {
+        case LLVMIntegerTypeKind:
+            if (LLVMGetIntTypeWidth(scalar) == 1) return val;
+            return LLVMBuildICmp(cg->builder, LLVMIntNE, val, LLVMConstNull(type), "tobool");
+        case LLVMFloatTypeKind:
+        case LLVMDoubleTypeKind:
+            return LLVMBuildFCmp(cg->builder, LLVMRealUNE, val, LLVMConstNull(type), "tobool");
+        default:
+            return LLVMBuildIsNotNull(cg->builder, val, "tobool");
+    }
+}
+
+/*
+ * Cost of evaluating node unconditionally, or -1 if it has side effects or
+ * may trap (integer division range analysis could not clear, indexing). Arms up to SELECT_MAX_COST each are computed
+ * eagerly and joined with select; anything else gets real control flow.
+ */
+#define SELECT_MAX_COST 4
+
+static int speculation_cost(ASTNode *node) {
+    if (!node) return -1;
+    
+    switch (node->type) {
+        case NODE_INT_LIT:
+        case NODE_FLOAT_LIT:
+        case NODE_STRING_LIT:
+        case NODE_IDENT:
+            return 0;
+        case NODE_UNARY: {
+            int c = speculation_cost(node->data.unary.operand);
+            return c < 0 ? -1 : c + 1;
+        }
+        case NODE_BINARY: {
+            if ((node->data.binary.op == OP_DIV || node->data.binary.op == OP_MOD) &&
+                !node->data.binary.safe_divisor) return -1;
+            int l = speculation_cost(node->data.binary.left);
+            int r = speculation_cost(node->data.binary.right);
+            return (l < 0 || r < 0) ? -1 : l + r + 1;
+        }
+        case NODE_TERNARY: {
+            int c = speculation_cost(node->data.ternary.cond);
+            int t = speculation_cost(node->data.ternary.then_branch);
+            int e = speculation_cost(node->data.ternary.else_branch);
+            return (c < 0 || t < 0 || e < 0) ? -1 : c + t + e + 1;
+        }
+        default:
+            return -1;
     }
+}
+
+static int is_cheap(ASTNode *node) {
+    int cost = speculation_cost(node);
+    return cost >= 0 && cost <= SELECT_MAX_COST;
+}
+
+/* Type both arms of a join convert to, NULL if they cannot meet */
+static LLVMTypeRef common_type(LLVMTypeRef a, LLVMTypeRef b) {
+    if (a == b) return a;
+    LLVMTypeKind ak = LLVMGetTypeKind(a);
+    LLVMTypeKind bk = LLVMGetTypeKind(b);
+    int a_float = (ak == LLVMFloatTypeKind || ak == LLVMDoubleTypeKind);
+    int b_float = (bk == LLVMFloatTypeKind || bk == LLVMDoubleTypeKind);
     
+    if (a_float && b_float) return ak == LLVMDoubleTypeKind ? a : b;
+    if (a_float && bk == LLVMIntegerTypeKind) return a;
+    if (b_float && ak == LLVMIntegerTypeKind) return b;
+    if (ak == LLVMIntegerTypeKind && bk == LLVMIntegerTypeKind)
+        return LLVMGetIntTypeWidth(a) >= LLVMGetIntTypeWidth(b) ? a : b;
     return NULL;
 }
 
-/* ========== Expression Codegen ========== */
+/* @likely / @unlikely on a condition become branch_weights metadata */
+static void set_branch_weights(CodeGen *cg, LLVMValueRef br, int likely) {
+    LLVMTypeRef i32 = LLVMInt32TypeInContext(cg->context);
+    LLVMMetadataRef ops[] = {
+        LLVMMDStringInContext2(cg->context, "branch_weights", 14),
+        LLVMValueAsMetadata(LLVMConstInt(i32, likely ? 2000 : 1, 0)),
+        LLVMValueAsMetadata(LLVMConstInt(i32, likely ? 1 : 2000, 0))
+    };
+    LLVMSetMetadata(br, LLVMGetMDKindIDInContext(cg->context, "prof", 4),
+                    LLVMMetadataAsValue(cg->context, LLVMMDNodeInContext2(cg->context, ops, 3)));
+}
 
-static LLVMValueRef codegen_binary(CodeGen *cg, ASTNode *node) {
+/* 1 for @likely(c), -1 for @unlikely(c), 0 otherwise; *cond is set to c */
+static int branch_hint(ASTNode **cond) {
+    ASTNode *c = *cond;
+    if (c->type != NODE_BUILTIN || c->data.builtin.count != 1) return 0;
+    int hint = strcmp(c->data.builtin.name, "likely") == 0 ? 1 :
+               strcmp(c->data.builtin.name, "unlikely") == 0 ? -1 : 0;
+    if (hint) *cond = c->data.builtin.elements[0];
+    return hint;
+}
+
+/* Run a block and yield its last statement's value, if that is an expression */
+static LLVMValueRef codegen_block_value(CodeGen *cg, ASTNode *node) {
+    if (node->type != NODE_BLOCK) return codegen_expr(cg, node);
+    
+    Scope *block_scope = scope_new(cg->current_scope);
+    Scope *prev = cg->current_scope;
+    cg->current_scope = block_scope;
+    
+    LLVMValueRef val = NULL;
+    for (size_t i = 0; i < node->data.block.count; i++) {
+        ASTNode *stmt = node->data.block.stmts[i];
+        if (i + 1 < node->data.block.count || !stmt) {
+            codegen_stmt(cg, stmt);
+        } else if (stmt->type == NODE_BLOCK) {
+            val = codegen_block_value(cg, stmt);
+        } else if (stmt->type == NODE_LET || stmt->type == NODE_FOR ||
+                   stmt->type == NODE_GPU_KERNEL) {
+            codegen_stmt(cg, stmt);
+        } else {
+            val = codegen_expr(cg, stmt);
+        }
+    }
+    
+    cg->current_scope = prev;
+    scope_free(block_scope);
+    return val;
+}
+
+/*
+ * Ternary and if. Cheap, side-effect-free arms are evaluated eagerly and
+ * joined with select; otherwise only the taken arm runs. The result is the
+ * arms' value when both produce one.
+ */
+static LLVMValueRef codegen_if(CodeGen *cg, ASTNode *node) {
+    ASTNode *cond_node = node->data.ternary.cond;
+    ASTNode *then_node = node->data.ternary.then_branch;
+    ASTNode *else_node = node->data.ternary.else_branch;
+    int hint = branch_hint(&cond_node);
+    
+    LLVMValueRef cond = codegen_expr(cg, cond_node);
+    if (!cond) return NULL;
+    cond = codegen_truth(cg, cond);
+    
+    if (!hint && node->type == NODE_TERNARY && is_cheap(then_node) && is_cheap(else_node)) {
+        LLVMValueRef then_val = codegen_expr(cg, then_node);
+        LLVMValueRef else_val = codegen_expr(cg, else_node);
+        if (!then_val || !else_val) return NULL;
+        LLVMTypeRef type = common_type(LLVMTypeOf(then_val), LLVMTypeOf(else_val));
+        if (!type) return NULL;
+        then_val = codegen_convert(cg, then_val, type, expr_unsigned(then_node));
+        else_val = codegen_convert(cg, else_val, type, expr_unsigned(else_node));
+        return LLVMBuildSelect(cg->builder, cond, then_val, else_val, "select");
+    }
+    
+    LLVMValueRef func = LLVMGetBasicBlockParent(LLVMGetInsertBlock(cg->builder));
+    LLVMBasicBlockRef then_bb = LLVMAppendBasicBlockInContext(cg->context, func, "then");
+    LLVMBasicBlockRef else_bb = else_node ? LLVMAppendBasicBlockInContext(cg->context, func, "else")
+                                          : NULL;
+    LLVMBasicBlockRef merge_bb = LLVMAppendBasicBlockInContext(cg->context, func, "endif");
+    
+    LLVMValueRef br = LLVMBuildCondBr(cg->builder, cond, then_bb, else_bb ? else_bb : merge_bb);
+    if (hint) set_branch_weights(cg, br, hint > 0);
+    
+    /* Arms stay open until the join type is known */
+    LLVMPositionBuilderAtEnd(cg->builder, then_bb);
+    LLVMValueRef then_val = codegen_block_value(cg, then_node);
+    LLVMBasicBlockRef then_end = LLVMGetInsertBlock(cg->builder);
+    int then_unsigned = then_val && expr_unsigned(then_node);
+    
+    LLVMValueRef else_val = NULL;
+    LLVMBasicBlockRef else_end = NULL;
+    int else_unsigned = 0;
+    if (else_bb) {
+        LLVMPositionBuilderAtEnd(cg->builder, else_bb);
+        else_val = codegen_block_value(cg, else_node);
+        else_end = LLVMGetInsertBlock(cg->builder);
+        else_unsigned = else_val && expr_unsigned(else_node);
+    }
+    
+    LLVMTypeRef type = (then_val && else_val)
+        ? common_type(LLVMTypeOf(then_val), LLVMTypeOf(else_val)) : NULL;
+    
+    LLVMPositionBuilderAtEnd(cg->builder, then_end);
+    if (type) then_val = codegen_convert(cg, then_val, type, then_unsigned);
+    LLVMBuildBr(cg->builder, merge_bb);
+    if (else_end) {
+        LLVMPositionBuilderAtEnd(cg->builder, else_end);
+        if (type) else_val = codegen_convert(cg, else_val, type, else_unsigned);
+        LLVMBuildBr(cg->builder, merge_bb);
+    }
+    
+    LLVMPositionBuilderAtEnd(cg->builder, merge_bb);
+    if (!type) return NULL;
+    
+    LLVMValueRef phi = LLVMBuildPhi(cg->builder, type, "if");
+    LLVMValueRef vals[] = { then_val, else_val };
+    LLVMBasicBlockRef bbs[] = { then_end, else_end };
+    LLVMAddIncoming(phi, vals, bbs, 2);
+    return phi;
+}
+
+/* && and || evaluate the right side only when it decides the result */
+static LLVMValueRef codegen_logical(CodeGen *cg, ASTNode *node) {
+    int is_and = node->data.binary.op == OP_AND;
+    
     LLVMValueRef left = codegen_expr(cg, node->data.binary.left);
+    if (!left) return NULL;
+    left = codegen_truth(cg, left);
+    
+    if (is_cheap(node->data.binary.right)) {
+        LLVMValueRef right = codegen_expr(cg, node->data.binary.right);
+        if (!right) return NULL;
+        right = codegen_truth(cg, right);
+        return is_and ? LLVMBuildAnd(cg->builder, left, right, "and")
+                      : LLVMBuildOr(cg->builder, left, right, "or");
+    }
+    
+    LLVMBasicBlockRef entry_bb = LLVMGetInsertBlock(cg->builder);
+    LLVMValueRef func = LLVMGetBasicBlockParent(entry_bb);
+    LLVMBasicBlockRef rhs_bb = LLVMAppendBasicBlockInContext(cg->context, func, is_and ? "and.rhs" : "or.rhs");
+    LLVMBasicBlockRef merge_bb = LLVMAppendBasicBlockInContext(cg->context, func, is_and ? "and.end" : "or.end");
+    
+    if (is_and) LLVMBuildCondBr(cg->builder, left, rhs_bb, merge_bb);
+    else LLVMBuildCondBr(cg->builder, left, merge_bb, rhs_bb);
+    
+    LLVMPositionBuilderAtEnd(cg->builder, rhs_bb);
     LLVMValueRef right = codegen_expr(cg, node->data.binary.right);
+    if (!right) right = LLVMConstInt(LLVMInt1TypeInContext(cg->context), 0, 0);
+    right = codegen_truth(cg, right);
+    LLVMBasicBlockRef rhs_end = LLVMGetInsertBlock(cg->builder);
+    LLVMBuildBr(cg->builder, merge_bb);
     
-    if (!left || !right) return NULL;
+    LLVMPositionBuilderAtEnd(cg->builder, merge_bb);
+    LLVMValueRef phi = LLVMBuildPhi(cg->builder, LLVMInt1TypeInContext(cg->context),
+                                    is_and ? "and" : "or");
+    LLVMValueRef vals[] = { LLVMConstInt(LLVMInt1TypeInContext(cg->context), !is_and, 0), right };
+    LLVMBasicBlockRef bbs[] = { entry_bb, rhs_end };
+    LLVMAddIncoming(phi, vals, bbs, 2);
+    return phi;
+}
+
+
+/* ========== Expression Codegen ========== */
+
+/*
+ * Bring both operands of a binary operator to one type. A constant adopts
+ * the other operand's type so literals do not widen narrow values; otherwise
+ * the wider type wins, with floats ranked above integers.
+ */
+static LLVMTypeRef unify_operands(CodeGen *cg, LLVMValueRef *left, int left_unsigned,
+                                  LLVMValueRef *right, int right_unsigned) {
+    LLVMTypeRef lt = LLVMTypeOf(*left);
+    LLVMTypeRef rt = LLVMTypeOf(*right);
+    if (lt == rt) return lt;
+    
+    /* A scalar meeting a vector takes the lanes' type in every lane */
+    if (is_vector_type(lt) || is_vector_type(rt)) {
+        if (is_vector_type(lt) && is_vector_type(rt)) return NULL;
+        if (is_vector_type(lt)) {
+            *right = build_splat(cg, codegen_convert(cg, *right, LLVMGetElementType(lt), right_unsigned), lt);
+            return lt;
+        }
+        *left = build_splat(cg, codegen_convert(cg, *left, LLVMGetElementType(rt), left_unsigned), rt);
+        return rt;
+    }
     
-    LLVMTypeRef left_type = LLVMTypeOf(left);
-    LLVMTypeRef right_type = LLVMTypeOf(right);
-    LLVMTypeKind left_kind = LLVMGetTypeKind(left_type);
-    LLVMTypeKind right_kind = LLVMGetTypeKind(right_type);
+    int lf = is_float_type(lt), rf = is_float_type(rt);
+    int lc = LLVMIsConstant(*left), rc = LLVMIsConstant(*right);
+    int l_bool = !lf && LLVMGetIntTypeWidth(lt) == 1;
+    int r_bool = !rf && LLVMGetIntTypeWidth(rt) == 1;
+    LLVMTypeRef type;
     
-    int left_is_float = (left_kind == LLVMFloatTypeKind || left_kind == LLVMDoubleTypeKind);
-    int right_is_float = (right_kind == LLVMFloatTypeKind || right_kind == LLVMDoubleTypeKind);
-    int is_float = left_is_float || right_is_float;
+    if (lf == rf && lc && !rc && !l_bool) {
+        type = rt;
+    } else if (lf == rf && rc && !lc && !r_bool) {
+        type = lt;
+    } else if (lf || rf) {
+        type = (lf && rf) ? common_type(lt, rt) : (lf ? lt : rt);
+    } else {
+        type = common_type(lt, rt);
+    }
     
-    /* Type coercion: promote int to float if needed */
+    *left = codegen_convert(cg, *left, type, left_unsigned);
+    *right = codegen_convert(cg, *right, type, right_unsigned);
+    return type;
+}
+
+static LLVMValueRef codegen_compare(CodeGen *cg, Operator op, LLVMValueRef left,
+                                    LLVMValueRef right, int is_float, int is_unsigned) {
     if (is_float) {
-        LLVMTypeRef double_type = LLVMDoubleTypeInContext(cg->context);
-        if (! left_is_float) {
-            left = LLVMBuildSIToFP(cg->builder, left, double_type, "int_to_float");
-        }
-        if (!right_is_float) {
-            right = LLVMBuildSIToFP(cg->builder, right, double_type, "int_to_float");
+        LLVMRealPredicate pred;
+        switch (op) {
+            case OP_EQ:  pred = LLVMRealOEQ; break;
+            case OP_NEQ: pred = LLVMRealONE; break;
+            case OP_LT:  pred = LLVMRealOLT; break;
+            case OP_GT:  pred = LLVMRealOGT; break;
+            case OP_LTE: pred = LLVMRealOLE; break;
+            default:     pred = LLVMRealOGE; break;
         }
+        return fast_math(cg, LLVMBuildFCmp(cg->builder, pred, left, right, "fcmp"));
+    }
+    
+    LLVMIntPredicate pred;
+    switch (op) {
+        case OP_EQ:  pred = LLVMIntEQ; break;
+        case OP_NEQ: pred = LLVMIntNE; break;
+        case OP_LT:  pred = is_unsigned ? LLVMIntULT : LLVMIntSLT; break;
+        case OP_GT:  pred = is_unsigned ? LLVMIntUGT : LLVMIntSGT; break;
+        case OP_LTE: pred = is_unsigned ? LLVMIntULE : LLVMIntSLE; break;
+        default:     pred = is_unsigned ? LLVMIntUGE : LLVMIntSGE; break;
+    }
+    return LLVMBuildICmp(cg->builder, pred, left, right, "icmp");
+}
+
+/*
+ * Integer + - *, flagged nsw/nuw where range analysis proved the result
+ * cannot wrap
+ */
+static LLVMValueRef build_int_arith(CodeGen *cg, ASTNode *node, LLVMValueRef left, LLVMValueRef right,
+                                    int is_unsigned) {
+    Operator op = node->data.binary.op;
+    /* Facts are stated in the node's own signedness */
+    if (!node->data.binary.no_wrap || is_unsigned != expr_unsigned(node)) {
+        return op == OP_ADD ? LLVMBuildAdd(cg->builder, left, right, "add")
+             : op == OP_SUB ? LLVMBuildSub(cg->builder, left, right, "sub")
+                            : LLVMBuildMul(cg->builder, left, right, "mul");
+    }
+    if (is_unsigned) {
+        return op == OP_ADD ? LLVMBuildNUWAdd(cg->builder, left, right, "add")
+             : op == OP_SUB ? LLVMBuildNUWSub(cg->builder, left, right, "sub")
+                            : LLVMBuildNUWMul(cg->builder, left, right, "mul");
+    }
+    return op == OP_ADD ? LLVMBuildNSWAdd(cg->builder, left, right, "add")
+         : op == OP_SUB ? LLVMBuildNSWSub(cg->builder, left, right, "sub")
+                        : LLVMBuildNSWMul(cg->builder, left, right, "mul");
+}
+
+/*
+ * Integer / %. A 64-bit divide is several times slower than a 32-bit one,
+ * so when range analysis proved operands and result fit the narrower type
+ * the division is done there and extended back.
+ */
+static LLVMValueRef build_int_div(CodeGen *cg, ASTNode *node, LLVMValueRef left, LLVMValueRef right,
+                                  int is_unsigned) {
+    int div = node->data.binary.op == OP_DIV;
+    LLVMTypeRef type = LLVMTypeOf(left);
+    int bits = is_unsigned == expr_unsigned(node) ? node->data.binary.narrow_bits : 0;
+    
+    if (bits) {
+        LLVMTypeRef narrow = LLVMIntTypeInContext(cg->context, bits);
+        left = LLVMBuildTrunc(cg->builder, left, narrow, "narrow");
+        right = LLVMBuildTrunc(cg->builder, right, narrow, "narrow");
+    }
+    LLVMValueRef result = is_unsigned ? (div ? LLVMBuildUDiv(cg->builder, left, right, "udiv")
+                                             : LLVMBuildURem(cg->builder, left, right, "umod"))
+                                      : (div ? LLVMBuildSDiv(cg->builder, left, right, "sdiv")
+                                             : LLVMBuildSRem(cg->builder, left, right, "mod"));
+    if (bits) {
+        result = is_unsigned ? LLVMBuildZExt(cg->builder, result, type, "widen")
+                             : LLVMBuildSExt(cg->builder, result, type, "widen");
+    }
+    return result;
+}
+
+static LLVMValueRef codegen_binary(CodeGen *cg, ASTNode *node) {
+    if (node->data.binary.op == OP_AND || node->data.binary.op == OP_OR) {
+        return codegen_logical(cg, node);
+    }
+    
+    LLVMValueRef left = codegen_expr(cg, node->data.binary.left);
+    LLVMValueRef right = codegen_expr(cg, node->data.binary.right);
+    
+    if (!left || !right) return NULL;
+    
+    int left_unsigned = expr_unsigned(node->data.binary.left);
+    int right_unsigned = expr_unsigned(node->data.binary.right);
+    
+    /* Arithmetic on comparison results counts in i64, as in C */
+    Operator op = node->data.binary.op;
+    int arith = op == OP_ADD || op == OP_SUB || op == OP_MUL || op == OP_DIV || op == OP_MOD;
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    if (arith && LLVMTypeOf(left) == LLVMInt1TypeInContext(cg->context) &&
+        LLVMTypeOf(right) == LLVMInt1TypeInContext(cg->context)) {
+        left = LLVMBuildZExt(cg->builder, left, i64, "");
+        right = LLVMBuildZExt(cg->builder, right, i64, "");
     }
     
-    switch (node->data.binary.op) {
+    LLVMTypeRef type = unify_operands(cg, &left, left_unsigned, &right, right_unsigned);
+    if (!type) return NULL;
+    int is_float = is_float_type(type);
+    int is_unsigned = !is_float && (left_unsigned || right_unsigned);
+    
+    LLVMValueRef result;
+    switch (op) {
         case OP_ADD:
-            return is_float ? LLVMBuildFAdd(cg->builder, left, right, "fadd")
-                           : LLVMBuildAdd(cg->builder, left, right, "add");
+            result = is_float ? fast_math(cg, LLVMBuildFAdd(cg->builder, left, right, "fadd"))
+                              : build_int_arith(cg, node, left, right, is_unsigned);
+            break;
         case OP_SUB:
-            return is_float ? LLVMBuildFSub(cg->builder, left, right, "fsub")
-                           : LLVMBuildSub(cg->builder, left, right, "sub");
+            result = is_float ? fast_math(cg, LLVMBuildFSub(cg->builder, left, right, "fsub"))
+                              : build_int_arith(cg, node, left, right, is_unsigned);
+            break;
         case OP_MUL:
-            return is_float ? LLVMBuildFMul(cg->builder, left, right, "fmul")
-                           : LLVMBuildMul(cg->builder, left, right, "mul");
+            result = is_float ? fast_math(cg, LLVMBuildFMul(cg->builder, left, right, "fmul"))
+                              : build_int_arith(cg, node, left, right, is_unsigned);
+            break;
         case OP_DIV:
-            return is_float ? LLVMBuildFDiv(cg->builder, left, right, "fdiv")
-                           : LLVMBuildSDiv(cg->builder, left, right, "sdiv");
+            result = is_float ? fast_math(cg, LLVMBuildFDiv(cg->builder, left, right, "fdiv"))
+                              : build_int_div(cg, node, left, right, is_unsigned);
+            break;
         case OP_MOD:
-            return is_float ? LLVMBuildFRem(cg->builder, left, right, "fmod")
-                           : LLVMBuildSRem(cg->builder, left, right, "mod");
+            result = is_float ? fast_math(cg, LLVMBuildFRem(cg->builder, left, right, "fmod"))
+                              : build_int_div(cg, node, left, right, is_unsigned);
+            break;
         
-        /* Comparisons - native CPU ops, NOT Church encoding (faster) */
+        /* Comparisons - native CPU ops yielding i1, NOT Church encoding (faster) */
         case OP_EQ:
-            if (is_float) {
-                LLVMValueRef cmp = LLVMBuildFCmp(cg->builder, LLVMRealOEQ, left, right, "fcmp");
-                return LLVMBuildZExt(cg->builder, cmp, LLVMInt64TypeInContext(cg->context), "eq");
-            } else {
-                LLVMValueRef cmp = LLVMBuildICmp(cg->builder, LLVMIntEQ, left, right, "icmp");
-                return LLVMBuildZExt(cg->builder, cmp, LLVMInt64TypeInContext(cg->context), "eq");
-            }
         case OP_NEQ:
-            if (is_float) {
-                LLVMValueRef cmp = LLVMBuildFCmp(cg->builder, LLVMRealONE, left, right, "fcmp");
-                return LLVMBuildZExt(cg->builder, cmp, LLVMInt64TypeInContext(cg->context), "neq");
-            } else {
-                LLVMValueRef cmp = LLVMBuildICmp(cg->builder, LLVMIntNE, left, right, "icmp");
-                return LLVMBuildZExt(cg->builder, cmp, LLVMInt64TypeInContext(cg->context), "neq");
-            }
         case OP_LT:
-            if (is_float) {
-                LLVMValueRef cmp = LLVMBuildFCmp(cg->builder, LLVMRealOLT, left, right, "fcmp");
-                return LLVMBuildZExt(cg->builder, cmp, LLVMInt64TypeInContext(cg->context), "lt");
-            } else {
-                LLVMValueRef cmp = LLVMBuildICmp(cg->builder, LLVMIntSLT, left, right, "icmp");
-                return LLVMBuildZExt(cg->builder, cmp, LLVMInt64TypeInContext(cg->context), "lt");
-            }
         case OP_GT:
-            if (is_float) {
-                LLVMValueRef cmp = LLVMBuildFCmp(cg->builder, LLVMRealOGT, left, right, "fcmp");
-                return LLVMBuildZExt(cg->builder, cmp, LLVMInt64TypeInContext(cg->context), "gt");
-            } else {
-                LLVMValueRef cmp = LLVMBuildICmp(cg->builder, LLVMIntSGT, left, right, "icmp");
-                return LLVMBuildZExt(cg->builder, cmp, LLVMInt64TypeInContext(cg->context), "gt");
-            }
         case OP_LTE:
-            if (is_float) {
-                LLVMValueRef cmp = LLVMBuildFCmp(cg->builder, LLVMRealOLE, left, right, "fcmp");
-                return LLVMBuildZExt(cg->builder, cmp, LLVMInt64TypeInContext(cg->context), "lte");
-            } else {
-                LLVMValueRef cmp = LLVMBuildICmp(cg->builder, LLVMIntSLE, left, right, "icmp");
-                return LLVMBuildZExt(cg->builder, cmp, LLVMInt64TypeInContext(cg->context), "lte");
-            }
         case OP_GTE:
-            if (is_float) {
-                LLVMValueRef cmp = LLVMBuildFCmp(cg->builder, LLVMRealOGE, left, right, "fcmp");
-                return LLVMBuildZExt(cg->builder, cmp, LLVMInt64TypeInContext(cg->context), "gte");
-            } else {
-                LLVMValueRef cmp = LLVMBuildICmp(cg->builder, LLVMIntSGE, left, right, "icmp");
-                return LLVMBuildZExt(cg->builder, cmp, LLVMInt64TypeInContext(cg->context), "gte");
-            }
+            return codegen_compare(cg, op, left, right, is_float, is_unsigned);
         
         /* Bitwise - direct hardware instructions */
         case OP_BITAND:
-            return LLVMBuildAnd(cg->builder, left, right, "bitand");
+            result = LLVMBuildAnd(cg->builder, left, right, "bitand");
+            break;
         case OP_BITOR:
-            return LLVMBuildOr(cg->builder, left, right, "bitor");
+            result = LLVMBuildOr(cg->builder, left, right, "bitor");
+            break;
         case OP_BITXOR:
-            return LLVMBuildXor(cg->builder, left, right, "bitxor");
+            result = LLVMBuildXor(cg->builder, left, right, "bitxor");
+            break;
         case OP_SHL:
-            return LLVMBuildShl(cg->builder, left, right, "shl");
+            result = LLVMBuildShl(cg->builder, left, right, "shl");
+            break;
         case OP_SHR:
-            return LLVMBuildAShr(cg->builder, left, right, "shr");
-        
-        /* Logical */
-        case OP_AND: {
-            LLVMValueRef zero = LLVMConstInt(LLVMInt64TypeInContext(cg->context), 0, 0);
-            LLVMValueRef lb = LLVMBuildICmp(cg->builder, LLVMIntNE, left, zero, "");
-            LLVMValueRef rb = LLVMBuildICmp(cg->builder, LLVMIntNE, right, zero, "");
-            LLVMValueRef res = LLVMBuildAnd(cg->builder, lb, rb, "");
-            return LLVMBuildZExt(cg->builder, res, LLVMInt64TypeInContext(cg->context), "and");
-        }
-        case OP_OR: {
-            LLVMValueRef zero = LLVMConstInt(LLVMInt64TypeInContext(cg->context), 0, 0);
-            LLVMValueRef lb = LLVMBuildICmp(cg->builder, LLVMIntNE, left, zero, "");
-            LLVMValueRef rb = LLVMBuildICmp(cg->builder, LLVMIntNE, right, zero, "");
-            LLVMValueRef res = LLVMBuildOr(cg->builder, lb, rb, "");
-            return LLVMBuildZExt(cg->builder, res, LLVMInt64TypeInContext(cg->context), "or");
-        }
+            result = is_unsigned ? LLVMBuildLShr(cg->builder, left, right, "shr")
+                                 : LLVMBuildAShr(cg->builder, left, right, "shr");
+            break;
         
         default:
             return NULL;
     }
+    
+    return result;
 }
 
 static LLVMValueRef codegen_unary(CodeGen *cg, ASTNode *node) {
     LLVMValueRef operand = codegen_expr(cg, node->data.unary.operand);
     if (!operand) return NULL;
     
-    LLVMTypeKind kind = LLVMGetTypeKind(LLVMTypeOf(operand));
-    int is_float = (kind == LLVMFloatTypeKind || kind == LLVMDoubleTypeKind);
+    int is_float = is_float_type(LLVMTypeOf(operand));
     
     switch (node->data.unary.op) {
         case OP_NEG:
-            return is_float ? LLVMBuildFNeg(cg->builder, operand, "fneg")
+            return is_float ? fast_math(cg, LLVMBuildFNeg(cg->builder, operand, "fneg"))
                            : LLVMBuildNeg(cg->builder, operand, "neg");
-        case OP_NOT: {
-            LLVMValueRef zero = LLVMConstInt(LLVMInt64TypeInContext(cg->context), 0, 0);
-            LLVMValueRef cmp = LLVMBuildICmp(cg->builder, LLVMIntEQ, operand, zero, "");
-            return LLVMBuildZExt(cg->builder, cmp, LLVMInt64TypeInContext(cg->context), "not");
-        }
+        case OP_NOT:
+            return LLVMBuildNot(cg->builder, codegen_truth(cg, operand), "not");
         default:
             return NULL;
     }
 }
 
-static LLVMValueRef codegen_ternary(CodeGen *cg, ASTNode *node) {
-    LLVMValueRef cond = codegen_expr(cg, node->data.ternary.cond);
-    if (!cond) return NULL;
-    
-    LLVMValueRef zero = LLVMConstInt(LLVMInt64TypeInContext(cg->context), 0, 0);
-    LLVMValueRef cond_bool = LLVMBuildICmp(cg->builder, LLVMIntNE, cond, zero, "cond");
-    
-    LLVMValueRef then_val = codegen_expr(cg, node->data.ternary.then_branch);
-    LLVMValueRef else_val = codegen_expr(cg, node->data.ternary.else_branch);
-    
-    if (!then_val || !else_val) return NULL;
-    
-    /* Use select - faster than branch for simple ternary */
-    return LLVMBuildSelect(cg->builder, cond_bool, then_val, else_val, "ternary");
+static LLVMValueRef codegen_ident(CodeGen *cg, const char *name) {
+    LLVMValueRef val = scope_lookup(cg->current_scope, name);
+    LLVMTypeRef type = scope_lookup_type(cg->current_scope, name);
+    if (!val) return NULL;
+    if (LLVMGetTypeKind(LLVMTypeOf(val)) == LLVMPointerTypeKind && type) {
+        return LLVMBuildLoad2(cg->builder, type, val, name);
+    }
+    return val;
 }
 
 static LLVMValueRef codegen_expr(CodeGen *cg, ASTNode *node) {
     if (! node) return NULL;
     
     switch (node->type) {
+        /* Literals are emitted in the type the checker gave them */
         case NODE_INT_LIT:
-            return LLVMConstInt(LLVMInt64TypeInContext(cg->context), 
+            return LLVMConstInt(get_llvm_type(cg, node->resolved_type),
                                node->data.int_val, 1);
         
         case NODE_FLOAT_LIT:
-            return LLVMConstReal(LLVMDoubleTypeInContext(cg->context),
+            return LLVMConstReal(get_llvm_type(cg, node->resolved_type),
                                 node->data.float_val);
         
         case NODE_STRING_LIT:
             return LLVMBuildGlobalStringPtr(cg->builder, 
                                             node->data.string.value, "str");
         
-        case NODE_IDENT: {
-            LLVMValueRef val = scope_lookup(cg->current_scope, node->data.ident.name);
-            LLVMTypeRef type = scope_lookup_type(cg->current_scope, node->data.ident.name);
-            if (!val) return NULL;
-            if (LLVMGetTypeKind(LLVMTypeOf(val)) == LLVMPointerTypeKind && type) {
-                return LLVMBuildLoad2(cg->builder, type, val, node->data.ident.name);
-            }
-            return val;
-        }
+        case NODE_IDENT:
+            return codegen_ident(cg, node->data.ident.name);
         
         case NODE_BINARY:
             return codegen_binary(cg, node);
@@ -355,64 +834,110 @@ static LLVMValueRef codegen_expr(CodeGen *cg, ASTNode *node) {
             return codegen_unary(cg, node);
         
         case NODE_TERNARY:
-            return codegen_ternary(cg, node);
+        case NODE_IF:
+            return codegen_if(cg, node);
         
         case NODE_BUILTIN:
             return codegen_builtin(cg, node);
         
+        case NODE_ASYNC:
+            return codegen_async(cg, node);
+        
+        case NODE_AWAIT:
+            return codegen_await(cg, node);
+        
+        case NODE_LAMBDA:
+            return codegen_lambda(cg, node, NULL, NULL);
+        
+        case NODE_APPLY:
+            return codegen_apply(cg, node, 0);
+        
+        case NODE_ARRAY:
+            return codegen_array(cg, node);
+        
+        case NODE_INDEX:
+            return codegen_index(cg, node);
+        
         default:
             return NULL;
     }
 }
 
+/*
+ * Numeric conversion of val to type (int <-> float, width changes).
+ * is_unsigned says the integer side (the source, or the target of a float
+ * to int conversion) is unsigned; i1 always zero-extends.
+ */
+static LLVMValueRef codegen_convert(CodeGen *cg, LLVMValueRef val, LLVMTypeRef type, int is_unsigned) {
+    LLVMTypeRef val_type = LLVMTypeOf(val);
+    LLVMTypeKind val_kind = LLVMGetTypeKind(val_type);
+    LLVMTypeKind target_kind = LLVMGetTypeKind(type);
+    
+    int val_is_float = (val_kind == LLVMFloatTypeKind || val_kind == LLVMDoubleTypeKind);
+    int target_is_float = (target_kind == LLVMFloatTypeKind || target_kind == LLVMDoubleTypeKind);
+    if (val_kind == LLVMIntegerTypeKind && LLVMGetIntTypeWidth(val_type) == 1) is_unsigned = 1;
+    
+    if (val_is_float && !target_is_float) {
+        /* Float to int conversion */
+        return is_unsigned ? LLVMBuildFPToUI(cg->builder, val, type, "ftou")
+                           : LLVMBuildFPToSI(cg->builder, val, type, "ftoi");
+    } else if (!val_is_float && target_is_float) {
+        /* Int to float conversion */
+        return is_unsigned ? LLVMBuildUIToFP(cg->builder, val, type, "utof")
+                           : LLVMBuildSIToFP(cg->builder, val, type, "itof");
+    } else if (val_is_float && target_is_float && val_type != type) {
+        /* Float to float conversion (f32 <-> f64) */
+        return LLVMBuildFPCast(cg->builder, val, type, "fcast");
+    } else if (val_kind == LLVMIntegerTypeKind && target_kind == LLVMIntegerTypeKind) {
+        /* Int to int conversion (truncate or extend) */
+        unsigned val_bits = LLVMGetIntTypeWidth(val_type);
+        unsigned target_bits = LLVMGetIntTypeWidth(type);
+        if (val_bits > target_bits) {
+            return LLVMBuildTrunc(cg->builder, val, type, "trunc");
+        } else if (val_bits < target_bits) {
+            return is_unsigned ? LLVMBuildZExt(cg->builder, val, type, "zext")
+                               : LLVMBuildSExt(cg->builder, val, type, "sext");
+        }
+    }
+    return val;
+}
+
 /* ========== Statement Codegen ========== */
 
 static void codegen_let(CodeGen *cg, ASTNode *node) {
-    LLVMValueRef init = codegen_expr(cg, node->data.let.value);
+    ASTNode *value = node->data.let.value;
+    LLVMValueRef fn = NULL;
+    LLVMValueRef init;
+    if (value->type == NODE_LAMBDA) {
+        init = codegen_lambda(cg, value, node->data.let.name, &fn);
+    } else {
+        init = codegen_expr(cg, value);
+        if (value->type == NODE_IDENT) {
+            /* An alias of a known lambda still calls it directly */
+            Symbol *alias = scope_lookup_symbol(cg->current_scope, value->data.ident.name);
+            if (alias) fn = alias->func;
+        }
+    }
     if (!init) return;
     
     LLVMTypeRef type;
     
     /* Use explicit type annotation if provided */
-    if (node->data.let.type_annotation) {
-        type = get_llvm_type(cg, node->data.let.type_annotation);
-        
-        /* Convert init value to target type if needed */
-        LLVMTypeRef init_type = LLVMTypeOf(init);
-        LLVMTypeKind init_kind = LLVMGetTypeKind(init_type);
-        LLVMTypeKind target_kind = LLVMGetTypeKind(type);
-        
-        int init_is_float = (init_kind == LLVMFloatTypeKind || init_kind == LLVMDoubleTypeKind);
-        int target_is_float = (target_kind == LLVMFloatTypeKind || target_kind == LLVMDoubleTypeKind);
-        
-        if (init_is_float && !target_is_float) {
-            /* Float to int conversion */
-            init = LLVMBuildFPToSI(cg->builder, init, type, "ftoi");
-        } else if (!init_is_float && target_is_float) {
-            /* Int to float conversion */
-            init = LLVMBuildSIToFP(cg->builder, init, type, "itof");
-        } else if (init_is_float && target_is_float && init_type != type) {
-            /* Float to float conversion (f32 <-> f64) */
-            init = LLVMBuildFPCast(cg->builder, init, type, "fcast");
-        } else if (init_kind == LLVMIntegerTypeKind && target_kind == LLVMIntegerTypeKind) {
-            /* Int to int conversion (truncate or extend) */
-            unsigned init_bits = LLVMGetIntTypeWidth(init_type);
-            unsigned target_bits = LLVMGetIntTypeWidth(type);
-            if (init_bits > target_bits) {
-                init = LLVMBuildTrunc(cg->builder, init, type, "trunc");
-            } else if (init_bits < target_bits) {
-                init = LLVMBuildSExt(cg->builder, init, type, "sext");
-            }
-        }
+    Type *annotation = node->data.let.type_annotation;
+    if (annotation) {
+        type = get_llvm_type(cg, annotation);
+        int is_unsigned = is_float_type(LLVMTypeOf(init)) ? is_unsigned_type(annotation)
+                                               : expr_unsigned(node->data.let.value);
+        init = codegen_convert(cg, init, type, is_unsigned);
     } else {
         /* Infer type from init value */
         type = LLVMTypeOf(init);
     }
     
-    LLVMValueRef alloca = LLVMBuildAlloca(cg->builder, type, node->data.let.name);
-    LLVMBuildStore(cg->builder, init, alloca);
-    
-    scope_define(cg->current_scope, node->data.let.name, alloca, type);
+    /* Bindings are immutable, so the name refers to the value itself */
+    Symbol *sym = scope_define(cg->current_scope, node->data.let.name, init, NULL);
+    sym->ast_type = annotation ? annotation : value->resolved_type;
+    sym->func = fn;
 }
 
 /* Helper to get or create the parallel runtime functions */
@@ -420,99 +945,2513 @@ static LLVMValueRef get_parallel_for_func(CodeGen *cg) {
     LLVMValueRef func = LLVMGetNamedFunction(cg->module, "__lp_parallel_for");
     if (func) return func;
     
-    /* void __lp_parallel_for(i64 start, i64 end, void (*body)(i64, void*), void* ctx) */
+    /* void __lp_parallel_for(i64 start, i64 end, void (*body)(i64, i64, void*), void* ctx,
+     *                        i32 schedule, i64 chunk) */
+    LLVMTypeRef i32 = LLVMInt32TypeInContext(cg->context);
     LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
     LLVMTypeRef ptr = LLVMPointerTypeInContext(cg->context, 0);
     LLVMTypeRef void_type = LLVMVoidTypeInContext(cg->context);
     
-    LLVMTypeRef params[] = { i64, i64, ptr, ptr };
-    LLVMTypeRef func_type = LLVMFunctionType(void_type, params, 4, 0);
+    LLVMTypeRef params[] = { i64, i64, ptr, ptr, i32, i64 };
+    LLVMTypeRef func_type = LLVMFunctionType(void_type, params, 6, 0);
     
     return LLVMAddFunction(cg->module, "__lp_parallel_for", func_type);
 }
 
-static void codegen_for(CodeGen *cg, ASTNode *node) {
-    LLVMValueRef func = LLVMGetBasicBlockParent(LLVMGetInsertBlock(cg->builder));
-    
-    LLVMValueRef start = codegen_expr(cg, node->data.for_loop.start);
-    LLVMValueRef end = codegen_expr(cg, node->data.for_loop.end);
-    if (!start || !end) return;
+/* ========== Closure Capture ========== */
+
+typedef struct {
+    const char **names;
+    size_t count;
+    size_t cap;
+} CaptureList;
+
+static void capture_add(CaptureList *caps, const char *name) {
+    for (size_t i = 0; i < caps->count; i++) {
+        if (strcmp(caps->names[i], name) == 0) return;
+    }
+    if (caps->count >= caps->cap) {
+        caps->cap = caps->cap ? caps->cap * 2 : 8;
+        caps->names = realloc(caps->names, sizeof(char*) * caps->cap);
+    }
+    caps->names[caps->count++] = name;
+}
+
+/* Names bound inside the captured code itself; they shadow outer bindings */
+typedef struct Bound {
+    const char *name;
+    struct Bound *next;
+} Bound;
+
+static int is_bound(Bound *b, const char *name) {
+    for (; b; b = b->next) {
+        if (strcmp(b->name, name) == 0) return 1;
+    }
+    return 0;
+}
+
+static void collect_free(CodeGen *cg, ASTNode *node, Bound *bound, CaptureList *caps);
+
+/* Statements in order: a let or reduction binds its name for the ones after it */
+static void collect_stmts(CodeGen *cg, ASTNode *block, Bound *bound, CaptureList *caps) {
+    size_t count = block->data.block.count;
+    Bound *local = malloc(sizeof(Bound) * (count ? count : 1));
     
-    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
-    LLVMValueRef loop_var = LLVMBuildAlloca(cg->builder, i64, node->data.for_loop.var);
-    LLVMBuildStore(cg->builder, start, loop_var);
+    for (size_t i = 0; i < count; i++) {
+        ASTNode *stmt = block->data.block.stmts[i];
+        collect_free(cg, stmt, bound, caps);
+        const char *name = !stmt ? NULL
+                         : stmt->type == NODE_LET ? stmt->data.let.name
+                         : stmt->type == NODE_FOR ? stmt->data.for_loop.reduce_var : NULL;
+        if (name) {
+            local[i] = (Bound){ name, bound };
+            bound = &local[i];
+        }
+    }
+    free(local);
+}
+
+/* Collect free identifiers of node that resolve in the enclosing scope */
+static void collect_free(CodeGen *cg, ASTNode *node, Bound *bound, CaptureList *caps) {
+    if (!node) return;
     
-    LLVMBasicBlockRef loop_bb = LLVMAppendBasicBlockInContext(cg->context, func, "loop");
-    LLVMBasicBlockRef body_bb = LLVMAppendBasicBlockInContext(cg->context, func, "body");
-    LLVMBasicBlockRef after_bb = LLVMAppendBasicBlockInContext(cg->context, func, "after");
+    switch (node->type) {
+        case NODE_IDENT:
+            if (!is_bound(bound, node->data.ident.name) &&
+                scope_lookup(cg->current_scope, node->data.ident.name))
+                capture_add(caps, node->data.ident.name);
+            break;
+        case NODE_BINARY:
+            collect_free(cg, node->data.binary.left, bound, caps);
+            collect_free(cg, node->data.binary.right, bound, caps);
+            break;
+        case NODE_UNARY:
+            collect_free(cg, node->data.unary.operand, bound, caps);
+            break;
+        case NODE_TERNARY:
+        case NODE_IF:
+            collect_free(cg, node->data.ternary.cond, bound, caps);
+            collect_free(cg, node->data.ternary.then_branch, bound, caps);
+            collect_free(cg, node->data.ternary.else_branch, bound, caps);
+            break;
+        case NODE_LAMBDA: {
+            size_t n = node->data.lambda.param_count;
+            Bound *params = malloc(sizeof(Bound) * (n ? n : 1));
+            for (size_t i = 0; i < n; i++) {
+                params[i] = (Bound){ node->data.lambda.params[i], bound };
+                bound = &params[i];
+            }
+            collect_free(cg, node->data.lambda.body, bound, caps);
+            free(params);
+            break;
+        }
+        case NODE_APPLY:
+            collect_free(cg, node->data.apply.func, bound, caps);
+            for (size_t i = 0; i < node->data.apply.arg_count; i++)
+                collect_free(cg, node->data.apply.args[i], bound, caps);
+            break;
+        case NODE_ARRAY:
+            for (size_t i = 0; i < node->data.array.count; i++)
+                collect_free(cg, node->data.array.elements[i], bound, caps);
+            collect_free(cg, node->data.array.repeat, bound, caps);
+            break;
+        case NODE_INDEX:
+            collect_free(cg, node->data.index.array, bound, caps);
+            collect_free(cg, node->data.index.index, bound, caps);
+            collect_free(cg, node->data.index.value, bound, caps);
+            break;
+        case NODE_BUILTIN:
+            for (size_t i = 0; i < node->data.builtin.count; i++)
+                collect_free(cg, node->data.builtin.elements[i], bound, caps);
+            break;
+        case NODE_LET: {
+            /* A lambda may refer to the name it is being bound to */
+            Bound self = { node->data.let.name, bound };
+            int is_lambda = node->data.let.value && node->data.let.value->type == NODE_LAMBDA;
+            collect_free(cg, node->data.let.value, is_lambda ? &self : bound, caps);
+            break;
+        }
+        case NODE_FOR: {
+            collect_free(cg, node->data.for_loop.start, bound, caps);
+            collect_free(cg, node->data.for_loop.end, bound, caps);
+            Bound var = { node->data.for_loop.var, bound };
+            collect_stmts(cg, node->data.for_loop.body, &var, caps);
+            break;
+        }
+        case NODE_BLOCK:
+            collect_stmts(cg, node, bound, caps);
+            break;
+        case NODE_ASYNC:
+        case NODE_AWAIT:
+            collect_free(cg, node->data.async_expr.expr, bound, caps);
+            break;
+        default:
+            break;
+    }
+}
+
+static void collect_captures(CodeGen *cg, ASTNode *node, CaptureList *caps) {
+    collect_free(cg, node, NULL, caps);
+}
+
+/* Alloca in the entry block, so a slot inside a loop is allocated once per call */
+static LLVMValueRef build_entry_alloca(CodeGen *cg, LLVMTypeRef type, const char *name) {
+    LLVMValueRef func = LLVMGetBasicBlockParent(LLVMGetInsertBlock(cg->builder));
+    LLVMBasicBlockRef entry = LLVMGetEntryBasicBlock(func);
+    LLVMValueRef first = LLVMGetFirstInstruction(entry);
     
-    LLVMBuildBr(cg->builder, loop_bb);
+    LLVMBuilderRef b = LLVMCreateBuilderInContext(cg->context);
+    if (first) LLVMPositionBuilderBefore(b, first);
+    else LLVMPositionBuilderAtEnd(b, entry);
+    LLVMValueRef slot = LLVMBuildAlloca(b, type, name);
+    LLVMDisposeBuilder(b);
+    return slot;
+}
+
+/* Lambda being emitted, for calls in tail position */
+typedef struct TailState {
+    LLVMValueRef fn;
+    LLVMValueRef *param_slots;      /* parameters as slots if the lambda calls itself */
+    LLVMBasicBlockRef loop;         /* where a self tail call jumps back to */
+    int stack_envs;                 /* closure environments in this frame */
+} TailState;
+
+/*
+ * Pack captured values into an environment struct, in the current frame or,
+ * for closures that outlive it, in the thread's permanent arena.
+ * Bindings are immutable, so captures are copied by value.
+ */
+static LLVMValueRef build_capture_env(CodeGen *cg, CaptureList *caps, LLVMTypeRef *env_type,
+                                      int on_heap) {
+    *env_type = NULL;
+    if (caps->count == 0) {
+        return LLVMConstNull(LLVMPointerTypeInContext(cg->context, 0));
+    }
     
-    /* Loop condition */
-    LLVMPositionBuilderAtEnd(cg->builder, loop_bb);
-    LLVMValueRef cur = LLVMBuildLoad2(cg->builder, i64, loop_var, "i");
-    LLVMValueRef cond = LLVMBuildICmp(cg->builder, LLVMIntSLT, cur, end, "loopcond");
-    LLVMValueRef br = LLVMBuildCondBr(cg->builder, cond, body_bb, after_bb);
+    LLVMValueRef *vals = malloc(sizeof(LLVMValueRef) * caps->count);
+    LLVMTypeRef *types = malloc(sizeof(LLVMTypeRef) * caps->count);
+    for (size_t i = 0; i < caps->count; i++) {
+        vals[i] = codegen_ident(cg, caps->names[i]);
+        types[i] = LLVMTypeOf(vals[i]);
+    }
     
-    /* Add parallel loop metadata for vectorization hints */
-    if (node->data.for_loop.parallel) {
-        LLVMContextRef ctx = cg->context;
+    *env_type = LLVMStructTypeInContext(cg->context, types, caps->count, 0);
+    LLVMValueRef env;
+    if (on_heap) {
+        LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+        LLVMValueRef alloc_fn = get_runtime_func(cg, "__lp_alloc",
+                                                 LLVMPointerTypeInContext(cg->context, 0), &i64, 1);
+        LLVMValueRef size = LLVMSizeOf(*env_type);
+        env = LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(alloc_fn), alloc_fn,
+                             &size, 1, "env");
+    } else {
+        env = build_entry_alloca(cg, *env_type, "env");
+        if (cg->tail) cg->tail->stack_envs++;
+    }
+    for (size_t i = 0; i < caps->count; i++) {
+        LLVMValueRef field = LLVMBuildStructGEP2(cg->builder, *env_type, env, i, caps->names[i]);
+        LLVMBuildStore(cg->builder, vals[i], field);
+    }
+    
+    free(vals);
+    free(types);
+    return env;
+}
+
+/*
+ * Unpack the environment into a fresh root scope inside the outlined function.
+ * Called while cg->current_scope is still the capturing scope.
+ */
+static Scope *bind_capture_env(CodeGen *cg, CaptureList *caps, LLVMTypeRef env_type, LLVMValueRef env) {
+    Scope *scope = scope_new(NULL);
+    for (size_t i = 0; i < caps->count; i++) {
+        LLVMValueRef field = LLVMBuildStructGEP2(cg->builder, env_type, env, i, "");
+        LLVMTypeRef field_type = LLVMStructGetTypeAtIndex(env_type, i);
+        LLVMValueRef val = LLVMBuildLoad2(cg->builder, field_type, field, caps->names[i]);
+        Symbol *outer = scope_lookup_symbol(cg->current_scope, caps->names[i]);
+        Symbol *sym = scope_define(scope, caps->names[i], val, NULL);
+        sym->ast_type = outer->ast_type;
+        sym->func = outer->func;
+    }
+    return scope;
+}
+
+/* ========== Regions ========== */
+
+/*
+ * Arrays that do not escape but cannot live in the frame come from the
+ * thread's region arena. A lambda body or loop iteration that may create
+ * one takes a mark on entry and releases back to it on every way out:
+ * returns, tail calls and the loop latch. Coroutine bodies open no
+ * regions, since they may resume on another thread.
+ */
+
+/* Whether node may create a region array, outside nested functions and loop bodies */
+static int needs_region(CodeGen *cg, ASTNode *node) {
+    if (!node) return 0;
+    
+    switch (node->type) {
+        case NODE_ARRAY:
+            if (!node->data.array.escapes && !array_fits_frame(cg, node)) return 1;
+            for (size_t i = 0; i < node->data.array.count; i++)
+                if (needs_region(cg, node->data.array.elements[i])) return 1;
+            return needs_region(cg, node->data.array.repeat);
+        case NODE_BINARY:
+            return needs_region(cg, node->data.binary.left) || needs_region(cg, node->data.binary.right);
+        case NODE_UNARY:
+            return needs_region(cg, node->data.unary.operand);
+        case NODE_TERNARY:
+        case NODE_IF:
+            return needs_region(cg, node->data.ternary.cond) ||
+                   needs_region(cg, node->data.ternary.then_branch) ||
+                   needs_region(cg, node->data.ternary.else_branch);
+        case NODE_BLOCK:
+            for (size_t i = 0; i < node->data.block.count; i++)
+                if (needs_region(cg, node->data.block.stmts[i])) return 1;
+            return 0;
+        case NODE_LET:
+            return needs_region(cg, node->data.let.value);
+        case NODE_FOR:
+            return needs_region(cg, node->data.for_loop.start) || needs_region(cg, node->data.for_loop.end);
+        case NODE_APPLY:
+            if (needs_region(cg, node->data.apply.func)) return 1;
+            for (size_t i = 0; i < node->data.apply.arg_count; i++)
+                if (needs_region(cg, node->data.apply.args[i])) return 1;
+            return 0;
+        case NODE_INDEX:
+            return needs_region(cg, node->data.index.array) || needs_region(cg, node->data.index.index) ||
+                   needs_region(cg, node->data.index.value);
+        case NODE_BUILTIN:
+            for (size_t i = 0; i < node->data.builtin.count; i++)
+                if (needs_region(cg, node->data.builtin.elements[i])) return 1;
+            return 0;
+        case NODE_AWAIT:
+            return needs_region(cg, node->data.async_expr.expr);
+        default:
+            return 0;
+    }
+}
+
+/* Open a region for body if it needs one; returns the enclosing region to restore */
+static LLVMValueRef region_begin(CodeGen *cg, ASTNode *body) {
+    LLVMValueRef outer = cg->region;
+    if (cg->coro || !needs_region(cg, body)) return outer;
+    
+    LLVMValueRef mark_fn = get_runtime_func(cg, "__lp_region_mark",
+                                            LLVMPointerTypeInContext(cg->context, 0), NULL, 0);
+    cg->region = LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(mark_fn), mark_fn, NULL, 0, "region");
+    return outer;
+}
+
+/* Free everything allocated since the innermost region opened, if it is not outer */
+static void region_release(CodeGen *cg, LLVMValueRef outer) {
+    if (!cg->region || cg->region == outer) return;
+    LLVMTypeRef ptr = LLVMPointerTypeInContext(cg->context, 0);
+    LLVMValueRef release_fn = get_runtime_func(cg, "__lp_region_release",
+                                               LLVMVoidTypeInContext(cg->context), &ptr, 1);
+    LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(release_fn), release_fn, &cg->region, 1, "");
+}
+
+/* ========== Lambdas ========== */
+
+/*
+ * Every lambda is lifted to an internal fastcc function
+ *   R lambda.<name>(ptr env, params...)
+ * and its value is the flat closure { fn, env }. A closed lambda has a null
+ * env, and calls through a name bound to a known lambda are direct.
+ */
+
+/*
+ * Escape analysis: an environment may live in its creator's frame unless
+ * the closure can outlive it - returned from a lambda, passed as an
+ * argument, stored in an array, captured by another closure or a task, or
+ * bound through anything but a plain let. Array literals are tracked the
+ * same way, for their element storage, and a slice counts as its array.
+ */
+typedef struct EscBinding {
+    const char *name;
+    ASTNode *value;             /* lambda or array literal the name is bound to, or NULL */
+    int depth;                  /* closure nesting depth of the binding */
+    struct EscBinding *next;
+} EscBinding;
+
+typedef struct {
+    EscBinding *bindings;
+    int depth;
+} EscState;
+
+static void esc_bind(EscState *st, const char *name, ASTNode *value) {
+    EscBinding *b = malloc(sizeof(EscBinding));
+    b->name = name;
+    b->value = value;
+    b->depth = st->depth;
+    b->next = st->bindings;
+    st->bindings = b;
+}
+
+/* Drop the bindings made since mark */
+static void esc_unwind(EscState *st, EscBinding *mark) {
+    while (st->bindings != mark) {
+        EscBinding *next = st->bindings->next;
+        free(st->bindings);
+        st->bindings = next;
+    }
+}
+
+static EscBinding *esc_lookup(EscState *st, const char *name) {
+    for (EscBinding *b = st->bindings; b; b = b->next) {
+        if (strcmp(b->name, name) == 0) return b;
+    }
+    return NULL;
+}
+
+static void esc_walk(EscState *st, ASTNode *node, int escaping);
+
+static void esc_mark(ASTNode *value) {
+    if (value->type == NODE_LAMBDA) value->data.lambda.escapes = 1;
+    else value->data.array.escapes = 1;
+}
+
+static void esc_lambda(EscState *st, ASTNode *node, const char *self_name, int escaping) {
+    if (escaping) node->data.lambda.escapes = 1;
+    
+    EscBinding *mark = st->bindings;
+    st->depth++;
+    /* Self calls go through the env parameter, not a capture */
+    if (self_name) esc_bind(st, self_name, node);
+    for (size_t i = 0; i < node->data.lambda.param_count; i++)
+        esc_bind(st, node->data.lambda.params[i], NULL);
+    esc_walk(st, node->data.lambda.body, 1);
+    st->depth--;
+    esc_unwind(st, mark);
+}
+
+static void esc_stmts(EscState *st, ASTNode *block, int escaping) {
+    EscBinding *mark = st->bindings;
+    for (size_t i = 0; i < block->data.block.count; i++) {
+        esc_walk(st, block->data.block.stmts[i], escaping && i + 1 == block->data.block.count);
+    }
+    esc_unwind(st, mark);
+}
+
+/* The array a view shares storage with: @slice(a, ..) is a */
+static ASTNode *view_base(ASTNode *node) {
+    while (node->type == NODE_BUILTIN && node->data.builtin.count == 3 &&
+           strcmp(node->data.builtin.name, "slice") == 0)
+        node = node->data.builtin.elements[0];
+    return node;
+}
+
+static void esc_walk(EscState *st, ASTNode *node, int escaping) {
+    if (!node) return;
+    
+    switch (node->type) {
+        case NODE_IDENT: {
+            EscBinding *b = esc_lookup(st, node->data.ident.name);
+            if (b && b->value && (escaping || b->depth < st->depth))
+                esc_mark(b->value);
+            break;
+        }
+        case NODE_LAMBDA:
+            esc_lambda(st, node, NULL, escaping);
+            break;
+        case NODE_APPLY:
+            esc_walk(st, node->data.apply.func, 0);
+            for (size_t i = 0; i < node->data.apply.arg_count; i++)
+                esc_walk(st, node->data.apply.args[i], 1);
+            break;
+        case NODE_LET: {
+            ASTNode *value = node->data.let.value;
+            ASTNode *base = view_base(value);
+            ASTNode *tracked = NULL;
+            if (value->type == NODE_LAMBDA) {
+                esc_lambda(st, value, node->data.let.name, 0);
+                tracked = value;
+            } else if (base->type == NODE_ARRAY) {
+                esc_walk(st, value, 0);
+                tracked = base;
+            } else if (base->type == NODE_IDENT) {
+                esc_walk(st, value, 0);
+                EscBinding *b = esc_lookup(st, base->data.ident.name);
+                tracked = b ? b->value : NULL;
+            } else {
+                esc_walk(st, value, 1);
+            }
+            esc_bind(st, node->data.let.name, tracked);
+            break;
+        }
+        case NODE_BINARY:
+            esc_walk(st, node->data.binary.left, 0);
+            esc_walk(st, node->data.binary.right, 0);
+            break;
+        case NODE_UNARY:
+            esc_walk(st, node->data.unary.operand, 0);
+            break;
+        case NODE_TERNARY:
+        case NODE_IF:
+            esc_walk(st, node->data.ternary.cond, 0);
+            esc_walk(st, node->data.ternary.then_branch, escaping);
+            esc_walk(st, node->data.ternary.else_branch, escaping);
+            break;
+        case NODE_BLOCK:
+            esc_stmts(st, node, escaping);
+            break;
+        case NODE_FOR: {
+            esc_walk(st, node->data.for_loop.start, 0);
+            esc_walk(st, node->data.for_loop.end, 0);
+            EscBinding *mark = st->bindings;
+            esc_bind(st, node->data.for_loop.var, NULL);
+            esc_stmts(st, node->data.for_loop.body, 0);
+            esc_unwind(st, mark);
+            if (node->data.for_loop.reduce_var) esc_bind(st, node->data.for_loop.reduce_var, NULL);
+            break;
+        }
+        case NODE_BUILTIN:
+            /* A slice escapes with its array */
+            for (size_t i = 0; i < node->data.builtin.count; i++)
+                esc_walk(st, node->data.builtin.elements[i], i == 0 && view_base(node) != node && escaping);
+            break;
+        case NODE_ASYNC:
+            st->depth++;
+            esc_walk(st, node->data.async_expr.expr, 1);
+            st->depth--;
+            break;
+        case NODE_AWAIT:
+            esc_walk(st, node->data.async_expr.expr, 0);
+            break;
+        case NODE_GPU_KERNEL: {
+            EscBinding *outer = st->bindings;
+            st->bindings = NULL;
+            esc_walk(st, node->data.gpu_kernel.body, 0);
+            esc_unwind(st, NULL);
+            st->bindings = outer;
+            break;
+        }
+        case NODE_ARRAY:
+            if (escaping) node->data.array.escapes = 1;
+            for (size_t i = 0; i < node->data.array.count; i++)
+                esc_walk(st, node->data.array.elements[i], 1);
+            esc_walk(st, node->data.array.repeat, 0);
+            break;
+        case NODE_INDEX:
+            esc_walk(st, node->data.index.array, 0);
+            esc_walk(st, node->data.index.index, 0);
+            esc_walk(st, node->data.index.value, 1);
+            break;
+        case NODE_PROGRAM:
+            esc_stmts(st, node, 0);
+            break;
+        default:
+            break;
+    }
+}
+
+static void analyze_escapes(ASTNode *program) {
+    EscState st = { NULL, 0 };
+    esc_walk(&st, program, 0);
+    esc_unwind(&st, NULL);
+}
+
+/* R (ptr env, params...) for a function type */
+static LLVMTypeRef lambda_fn_type(CodeGen *cg, Type *ft) {
+    LLVMTypeRef *params = malloc(sizeof(LLVMTypeRef) * (ft->param_count + 1));
+    params[0] = LLVMPointerTypeInContext(cg->context, 0);
+    for (size_t i = 0; i < ft->param_count; i++)
+        params[i + 1] = get_llvm_type(cg, ft->params[i]);
+    
+    LLVMTypeRef type = LLVMFunctionType(get_llvm_type(cg, ft->ret), params,
+                                        ft->param_count + 1, 0);
+    free(params);
+    return type;
+}
+
+/* Whether node, in tail position, ends in a call */
+static int has_tail_call(ASTNode *node) {
+    if (!node) return 0;
+    switch (node->type) {
+        case NODE_APPLY:
+            return 1;
+        case NODE_BLOCK:
+            return node->data.block.count > 0 &&
+                   has_tail_call(node->data.block.stmts[node->data.block.count - 1]);
+        case NODE_TERNARY:
+        case NODE_IF:
+            /* A missing else is a void return */
+            return has_tail_call(node->data.ternary.then_branch) ||
+                   has_tail_call(node->data.ternary.else_branch);
+        default:
+            return 0;
+    }
+}
+
+/* Whether a lambda bound to self_name calls itself in tail position */
+static int has_self_tail_call(ASTNode *node, const char *self_name) {
+    if (!node) return 0;
+    switch (node->type) {
+        case NODE_APPLY: {
+            ASTNode *callee = node->data.apply.func;
+            return callee->type == NODE_IDENT && strcmp(callee->data.ident.name, self_name) == 0;
+        }
+        case NODE_BLOCK:
+            return node->data.block.count > 0 &&
+                   has_self_tail_call(node->data.block.stmts[node->data.block.count - 1], self_name);
+        case NODE_TERNARY:
+        case NODE_IF:
+            return has_self_tail_call(node->data.ternary.then_branch, self_name) ||
+                   has_self_tail_call(node->data.ternary.else_branch, self_name);
+        default:
+            return 0;
+    }
+}
+
+static void build_return(CodeGen *cg, LLVMValueRef val, ASTNode *node) {
+    LLVMValueRef fn = LLVMGetBasicBlockParent(LLVMGetInsertBlock(cg->builder));
+    LLVMTypeRef ret_type = LLVMGetReturnType(LLVMGlobalGetValueType(fn));
+    region_release(cg, NULL);
+    if (LLVMGetTypeKind(ret_type) == LLVMVoidTypeKind) {
+        LLVMBuildRetVoid(cg->builder);
+    } else if (!val) {
+        LLVMBuildRet(cg->builder, LLVMGetUndef(ret_type));
+    } else {
+        LLVMBuildRet(cg->builder, codegen_convert(cg, val, ret_type, expr_unsigned(node)));
+    }
+}
+
+/*
+ * Emit node as the lambda's result. Blocks and ifs pass tail position on
+ * to their last statement and arms, which return on their own (a missing
+ * else returns void); a self call there rebinds the parameters and jumps
+ * back to the top, and any other call is a tail call.
+ */
+static void codegen_tail(CodeGen *cg, ASTNode *node) {
+    TailState *ts = cg->tail;
+    
+    if (node && node->type == NODE_BLOCK) {
+        Scope *block_scope = scope_new(cg->current_scope);
+        Scope *prev = cg->current_scope;
+        cg->current_scope = block_scope;
         
-        /* Create loop metadata */
-        LLVMMetadataRef loop_id = LLVMMDNodeInContext2(ctx, NULL, 0);
+        size_t count = node->data.block.count;
+        for (size_t i = 0; i + 1 < count; i++) {
+            codegen_stmt(cg, node->data.block.stmts[i]);
+        }
+        ASTNode *last = count ? node->data.block.stmts[count - 1] : NULL;
+        if (last && (last->type == NODE_LET || last->type == NODE_FOR ||
+                     last->type == NODE_GPU_KERNEL)) {
+            codegen_stmt(cg, last);
+            build_return(cg, NULL, NULL);
+        } else {
+            codegen_tail(cg, last);
+        }
         
-        /* llvm.loop.parallel_accesses - hint that memory accesses are independent */
-        LLVMMetadataRef parallel_str = LLVMMDStringInContext2(ctx, "llvm.loop.parallel_accesses", 27);
-        LLVMMetadataRef parallel_md = LLVMMDNodeInContext2(ctx, &parallel_str, 1);
+        cg->current_scope = prev;
+        scope_free(block_scope);
+        return;
+    }
+    
+    if (node && (node->type == NODE_IF || node->type == NODE_TERNARY) && has_tail_call(node)) {
+        ASTNode *cond_node = node->data.ternary.cond;
+        int hint = branch_hint(&cond_node);
+        LLVMValueRef cond = codegen_expr(cg, cond_node);
+        if (!cond) {
+            build_return(cg, NULL, NULL);
+            return;
+        }
+        
+        LLVMBasicBlockRef then_bb = LLVMAppendBasicBlockInContext(cg->context, ts->fn, "then");
+        LLVMBasicBlockRef else_bb = LLVMAppendBasicBlockInContext(cg->context, ts->fn, "else");
+        LLVMValueRef br = LLVMBuildCondBr(cg->builder, codegen_truth(cg, cond), then_bb, else_bb);
+        if (hint) set_branch_weights(cg, br, hint > 0);
         
-        /* llvm.loop.vectorize.enable = true */
-        LLVMMetadataRef vec_str = LLVMMDStringInContext2(ctx, "llvm.loop.vectorize.enable", 26);
-        LLVMMetadataRef true_val = LLVMValueAsMetadata(LLVMConstInt(LLVMInt1TypeInContext(ctx), 1, 0));
-        LLVMMetadataRef vec_ops[] = { vec_str, true_val };
-        LLVMMetadataRef vec_md = LLVMMDNodeInContext2(ctx, vec_ops, 2);
+        LLVMPositionBuilderAtEnd(cg->builder, then_bb);
+        codegen_tail(cg, node->data.ternary.then_branch);
+        LLVMPositionBuilderAtEnd(cg->builder, else_bb);
+        codegen_tail(cg, node->data.ternary.else_branch);
+        return;
+    }
+    
+    if (node && node->type == NODE_APPLY) {
+        ASTNode *callee = node->data.apply.func;
+        Symbol *self = callee->type == NODE_IDENT
+            ? scope_lookup_symbol(cg->current_scope, callee->data.ident.name) : NULL;
+        if (self && self->func == ts->fn && ts->param_slots &&
+            node->data.apply.arg_count == LLVMCountParams(ts->fn) - 1) {
+            /* Self tail call: all arguments first, then rebind and loop */
+            size_t argc = node->data.apply.arg_count;
+            LLVMValueRef *args = malloc(sizeof(LLVMValueRef) * (argc ? argc : 1));
+            for (size_t i = 0; i < argc; i++) {
+                ASTNode *arg = node->data.apply.args[i];
+                LLVMValueRef val = codegen_expr(cg, arg);
+                LLVMTypeRef type = LLVMTypeOf(LLVMGetParam(ts->fn, i + 1));
+                args[i] = val ? codegen_convert(cg, val, type, expr_unsigned(arg)) : LLVMGetUndef(type);
+            }
+            for (size_t i = 0; i < argc; i++) {
+                LLVMBuildStore(cg->builder, args[i], ts->param_slots[i]);
+            }
+            free(args);
+            region_release(cg, NULL);
+            LLVMBuildBr(cg->builder, ts->loop);
+            return;
+        }
         
-        /* llvm.loop.unroll.enable = true */
-        LLVMMetadataRef unroll_str = LLVMMDStringInContext2(ctx, "llvm.loop.unroll.enable", 23);
-        LLVMMetadataRef unroll_ops[] = { unroll_str, true_val };
-        LLVMMetadataRef unroll_md = LLVMMDNodeInContext2(ctx, unroll_ops, 2);
+        LLVMValueRef call = codegen_apply(cg, node, 1);
+        build_return(cg, call, node);
+        return;
+    }
+    
+    build_return(cg, codegen_expr(cg, node), node);
+}
+
+/* Lift node to a function and build its closure; fn_out receives the function */
+static LLVMValueRef codegen_lambda(CodeGen *cg, ASTNode *node, const char *self_name,
+                                   LLVMValueRef *fn_out) {
+    Type *ft = node->resolved_type;
+    
+    CaptureList caps = {0};
+    Bound self = { self_name, NULL };
+    collect_free(cg, node, self_name ? &self : NULL, &caps);
+    
+    LLVMTypeRef env_type;
+    LLVMValueRef env = build_capture_env(cg, &caps, &env_type, node->data.lambda.escapes);
+    
+    char name[128];
+    snprintf(name, sizeof(name), "lambda.%s", self_name ? self_name : "anon");
+    LLVMTypeRef fn_type = lambda_fn_type(cg, ft);
+    LLVMValueRef fn = LLVMAddFunction(cg->module, name, fn_type);
+    LLVMSetLinkage(fn, LLVMInternalLinkage);
+    LLVMSetFunctionCallConv(fn, LLVMFastCallConv);
+    LLVMSetValueName2(LLVMGetParam(fn, 0), "env", 3);
+    
+    LLVMBasicBlockRef saved_bb = LLVMGetInsertBlock(cg->builder);
+    Scope *saved_scope = cg->current_scope;
+    struct CoroState *saved_coro = cg->coro;
+    TailState *saved_tail = cg->tail;
+    LLVMValueRef saved_region = cg->region;
+    LLVMPositionBuilderAtEnd(cg->builder, LLVMAppendBasicBlockInContext(cg->context, fn, "entry"));
+    
+    size_t n = node->data.lambda.param_count;
+    TailState ts = { fn, NULL, NULL, 0 };
+    if (self_name && has_self_tail_call(node->data.lambda.body, self_name)) {
+        ts.param_slots = malloc(sizeof(LLVMValueRef) * n);
+    }
+    
+    Scope *scope = bind_capture_env(cg, &caps, env_type, LLVMGetParam(fn, 0));
+    LLVMTypeRef closure_type = get_llvm_type(cg, ft);
+    if (self_name) {
+        LLVMValueRef closure = LLVMBuildInsertValue(cg->builder, LLVMGetUndef(closure_type),
+                                                    fn, 0, "");
+        closure = LLVMBuildInsertValue(cg->builder, closure, LLVMGetParam(fn, 0), 1, self_name);
+        Symbol *sym = scope_define(scope, self_name, closure, NULL);
+        sym->ast_type = ft;
+        sym->func = fn;
+    }
+    for (size_t i = 0; i < n; i++) {
+        const char *pname = node->data.lambda.params[i];
+        LLVMValueRef param = LLVMGetParam(fn, i + 1);
+        LLVMSetValueName2(param, pname, strlen(pname));
+        if (ts.param_slots) {
+            /* Self tail calls reassign the parameters, so they live in slots */
+            LLVMTypeRef type = LLVMTypeOf(param);
+            ts.param_slots[i] = LLVMBuildAlloca(cg->builder, type, pname);
+            LLVMBuildStore(cg->builder, param, ts.param_slots[i]);
+            scope_define(scope, pname, ts.param_slots[i], type)->ast_type = ft->params[i];
+        } else {
+            scope_define(scope, pname, param, NULL)->ast_type = ft->params[i];
+        }
+    }
+    cg->coro = NULL;
+    cg->region = NULL;
+    region_begin(cg, node->data.lambda.body);
+    if (ts.param_slots) {
+        ts.loop = LLVMAppendBasicBlockInContext(cg->context, fn, "tailrecurse");
+        LLVMBuildBr(cg->builder, ts.loop);
+        LLVMPositionBuilderAtEnd(cg->builder, ts.loop);
+    }
+    cg->current_scope = scope;
+    cg->tail = &ts;
+    unsigned saved_fast_math = cg->fast_math;
+#if LLVM_VERSION_MAJOR < 18
+    fast_math_ignored(node, node->data.lambda.fast_math & ~cg->fast_math, "@fastmath on a function");
+#endif
+    cg->fast_math |= node->data.lambda.fast_math;
+    
+    codegen_tail(cg, node->data.lambda.body);
+    
+    cg->fast_math = saved_fast_math;
+    scope_free(scope);
+    free(ts.param_slots);
+    cg->current_scope = saved_scope;
+    cg->coro = saved_coro;
+    cg->tail = saved_tail;
+    cg->region = saved_region;
+    LLVMPositionBuilderAtEnd(cg->builder, saved_bb);
+    free(caps.names);
+    
+    if (fn_out) *fn_out = fn;
+    LLVMValueRef closure = LLVMBuildInsertValue(cg->builder, LLVMGetUndef(closure_type), fn, 0, "");
+    return LLVMBuildInsertValue(cg->builder, closure, env, 1, "closure");
+}
+
+/*
+ * Call a closure. In tail position (the caller returns the result) the call
+ * is musttail when the prototypes match, so chains of tail calls run in
+ * constant stack, and tail otherwise; neither applies while an environment
+ * in the caller's frame may be reachable from the callee. Before LLVM 18
+ * the C API has no musttail, so only the tail hint is set and the constant
+ * stack is not guaranteed. The caller's region is released first, as
+ * nothing in it is passed on.
+ */
+static LLVMValueRef codegen_apply(CodeGen *cg, ASTNode *node, int tail) {
+    ASTNode *callee = node->data.apply.func;
+    Type *ft = callee->resolved_type;
+    size_t argc = node->data.apply.arg_count;
+    if (!ft || ft->kind != TYPE_FUNC || ft->param_count != argc) return NULL;
+    
+    /* A lambda literal or a name bound to one is called directly */
+    LLVMValueRef fn = NULL;
+    LLVMValueRef closure;
+    if (callee->type == NODE_LAMBDA) {
+        closure = codegen_lambda(cg, callee, NULL, &fn);
+    } else {
+        if (callee->type == NODE_IDENT) {
+            Symbol *sym = scope_lookup_symbol(cg->current_scope, callee->data.ident.name);
+            if (sym) fn = sym->func;
+        }
+        closure = codegen_expr(cg, callee);
+    }
+    if (!closure) return NULL;
+    
+    LLVMTypeRef fn_type = lambda_fn_type(cg, ft);
+    LLVMTypeRef *param_types = malloc(sizeof(LLVMTypeRef) * (argc + 1));
+    LLVMGetParamTypes(fn_type, param_types);
+    LLVMValueRef *args = malloc(sizeof(LLVMValueRef) * (argc + 1));
+    args[0] = LLVMBuildExtractValue(cg->builder, closure, 1, "env");
+    
+    LLVMValueRef call = NULL;
+    for (size_t i = 0; i < argc; i++) {
+        ASTNode *arg = node->data.apply.args[i];
+        LLVMValueRef val = codegen_expr(cg, arg);
+        if (!val) goto done;
+        args[i + 1] = codegen_convert(cg, val, param_types[i + 1], expr_unsigned(arg));
+    }
+    
+    if (!fn) fn = LLVMBuildExtractValue(cg->builder, closure, 0, "fn");
+    if (tail) region_release(cg, NULL);
+    int is_void = LLVMGetTypeKind(LLVMGetReturnType(fn_type)) == LLVMVoidTypeKind;
+    call = LLVMBuildCall2(cg->builder, fn_type, fn, args, argc + 1, is_void ? "" : "call");
+    LLVMSetInstructionCallConv(call, LLVMFastCallConv);
+    if (tail && cg->tail && cg->tail->stack_envs == 0) {
+#if LLVM_VERSION_MAJOR >= 18
+        LLVMValueRef caller = LLVMGetBasicBlockParent(LLVMGetInsertBlock(cg->builder));
+        LLVMSetTailCallKind(call, LLVMGlobalGetValueType(caller) == fn_type
+                                  ? LLVMTailCallKindMustTail : LLVMTailCallKindTail);
+#else
+        LLVMSetTailCall(call, 1);
+#endif
+    }
+    if (is_void) call = NULL;
+    
+done:
+    free(param_types);
+    free(args);
+    return call;
+}
+
+/* ========== Arrays ========== */
+
+/*
+ * An array value is { ptr data, i64 len } over contiguous elements, the
+ * data 64-byte aligned. A literal of known length that fits in
+ * STACK_ARRAY_MAX bytes and does not escape lives in its creator's frame;
+ * one that does not escape but is larger or sized at run time comes from
+ * the enclosing region; other arrays come from __lp_alloc_array. Both
+ * allocators are declared to return fresh (noalias), aligned memory.
+ * Indexing is bounds-checked.
+ */
+#define ARRAY_ALIGN 64
+#define STACK_ARRAY_MAX 4096
+
+/* Whether the literal's length is evident from the tree and fits the frame */
+static int array_fits_frame(CodeGen *cg, ASTNode *node) {
+    ASTNode *repeat = node->data.array.repeat;
+    int64_t count;
+    if (!repeat) count = (int64_t)node->data.array.count;
+    else if (repeat->type == NODE_INT_LIT) count = repeat->data.int_val;
+    else return 0;
+    
+    LLVMTypeRef elem = get_llvm_type(cg, node->resolved_type->inner);
+    unsigned long long elem_size = LLVMABISizeOfType(LLVMGetModuleDataLayout(cg->module), elem);
+    return count >= 0 && count <= STACK_ARRAY_MAX && (unsigned long long)count * elem_size <= STACK_ARRAY_MAX;
+}
+
+/* __lp_alloc_array, or __lp_region_array for region storage */
+static LLVMValueRef get_alloc_array_func(CodeGen *cg, const char *name) {
+    LLVMValueRef func = LLVMGetNamedFunction(cg->module, name);
+    if (func) return func;
+    
+    /* noalias align 64 ptr name(i64 count, i64 elem_size) */
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    LLVMTypeRef params[] = { i64, i64 };
+    LLVMTypeRef func_type = LLVMFunctionType(LLVMPointerTypeInContext(cg->context, 0), params, 2, 0);
+    func = LLVMAddFunction(cg->module, name, func_type);
+    
+    unsigned noalias = LLVMGetEnumAttributeKindForName("noalias", 7);
+    unsigned align = LLVMGetEnumAttributeKindForName("align", 5);
+    LLVMAddAttributeAtIndex(func, LLVMAttributeReturnIndex,
+                            LLVMCreateEnumAttribute(cg->context, noalias, 0));
+    LLVMAddAttributeAtIndex(func, LLVMAttributeReturnIndex,
+                            LLVMCreateEnumAttribute(cg->context, align, ARRAY_ALIGN));
+    return func;
+}
+
+/* A runtime reporter of failed checks: noreturn cold void name(i64...) */
+static LLVMValueRef get_fail_func(CodeGen *cg, const char *name, unsigned count) {
+    LLVMValueRef func = LLVMGetNamedFunction(cg->module, name);
+    if (func) return func;
+    
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    LLVMTypeRef params[] = { i64, i64, i64 };
+    func = LLVMAddFunction(cg->module, name,
+                           LLVMFunctionType(LLVMVoidTypeInContext(cg->context), params, count, 0));
+    
+    const char *attrs[] = { "noreturn", "cold", "nounwind" };
+    for (size_t i = 0; i < 3; i++) {
+        unsigned kind = LLVMGetEnumAttributeKindForName(attrs[i], strlen(attrs[i]));
+        LLVMAddAttributeAtIndex(func, LLVMAttributeFunctionIndex,
+                                LLVMCreateEnumAttribute(cg->context, kind, 0));
+    }
+    return func;
+}
+
+/* Go on if ok holds; otherwise report through name(args), on a cold path that does not return */
+static void build_check(CodeGen *cg, LLVMValueRef ok, const char *label, const char *name,
+                        LLVMValueRef *args, unsigned count) {
+    char ok_name[32], fail_name[32];
+    snprintf(ok_name, sizeof(ok_name), "%s.ok", label);
+    snprintf(fail_name, sizeof(fail_name), "%s.fail", label);
+    LLVMValueRef func = LLVMGetBasicBlockParent(LLVMGetInsertBlock(cg->builder));
+    LLVMBasicBlockRef ok_bb = LLVMAppendBasicBlockInContext(cg->context, func, ok_name);
+    LLVMBasicBlockRef fail_bb = LLVMAppendBasicBlockInContext(cg->context, func, fail_name);
+    LLVMValueRef br = LLVMBuildCondBr(cg->builder, ok, ok_bb, fail_bb);
+    set_branch_weights(cg, br, 1);
+    
+    LLVMPositionBuilderAtEnd(cg->builder, fail_bb);
+    LLVMValueRef fail_fn = get_fail_func(cg, name, count);
+    LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(fail_fn), fail_fn, args, count, "");
+    LLVMBuildUnreachable(cg->builder);
+    
+    LLVMPositionBuilderAtEnd(cg->builder, ok_bb);
+}
+
+/* val as an element of type elem_type; src is the expression it came from */
+static LLVMValueRef convert_elem(CodeGen *cg, LLVMValueRef val, ASTNode *src, Type *elem_type) {
+    int is_unsigned = is_float_type(LLVMTypeOf(val)) ? is_unsigned_type(elem_type)
+                                                     : expr_unsigned(src);
+    return codegen_convert(cg, val, get_llvm_type(cg, elem_type), is_unsigned);
+}
+
+static void store_elem(CodeGen *cg, LLVMTypeRef elem, LLVMValueRef data, LLVMValueRef index,
+                       LLVMValueRef val) {
+    LLVMValueRef ptr = LLVMBuildInBoundsGEP2(cg->builder, elem, data, &index, 1, "elem.ptr");
+    LLVMValueRef store = LLVMBuildStore(cg->builder, val, ptr);
+    LLVMSetAlignment(store, LLVMABIAlignmentOfType(LLVMGetModuleDataLayout(cg->module), elem));
+}
+
+/* data[0..len) = val */
+static void build_fill(CodeGen *cg, LLVMTypeRef elem, LLVMValueRef data, LLVMValueRef len,
+                       LLVMValueRef val) {
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    LLVMValueRef func = LLVMGetBasicBlockParent(LLVMGetInsertBlock(cg->builder));
+    LLVMBasicBlockRef pre_bb = LLVMGetInsertBlock(cg->builder);
+    LLVMBasicBlockRef cond_bb = LLVMAppendBasicBlockInContext(cg->context, func, "fill.cond");
+    LLVMBasicBlockRef body_bb = LLVMAppendBasicBlockInContext(cg->context, func, "fill.body");
+    LLVMBasicBlockRef end_bb = LLVMAppendBasicBlockInContext(cg->context, func, "fill.end");
+    LLVMBuildBr(cg->builder, cond_bb);
+    
+    LLVMPositionBuilderAtEnd(cg->builder, cond_bb);
+    LLVMValueRef i = LLVMBuildPhi(cg->builder, i64, "i");
+    LLVMValueRef more = LLVMBuildICmp(cg->builder, LLVMIntULT, i, len, "more");
+    LLVMBuildCondBr(cg->builder, more, body_bb, end_bb);
+    
+    LLVMPositionBuilderAtEnd(cg->builder, body_bb);
+    store_elem(cg, elem, data, i, val);
+    LLVMValueRef next = LLVMBuildAdd(cg->builder, i, LLVMConstInt(i64, 1, 0), "i.next");
+    LLVMBuildBr(cg->builder, cond_bb);
+    
+    LLVMValueRef vals[] = { LLVMConstInt(i64, 0, 0), next };
+    LLVMBasicBlockRef bbs[] = { pre_bb, body_bb };
+    LLVMAddIncoming(i, vals, bbs, 2);
+    LLVMPositionBuilderAtEnd(cg->builder, end_bb);
+}
+
+/* { data, len } of array type t */
+static LLVMValueRef build_array_value(CodeGen *cg, Type *t, LLVMValueRef data, LLVMValueRef len) {
+    LLVMValueRef arr = LLVMGetUndef(get_llvm_type(cg, t));
+    arr = LLVMBuildInsertValue(cg->builder, arr, data, 0, "");
+    return LLVMBuildInsertValue(cg->builder, arr, len, 1, "arr");
+}
+
+/* [a, b, c] and [v; n] */
+static LLVMValueRef codegen_array(CodeGen *cg, ASTNode *node) {
+    Type *elem_type = node->resolved_type->inner;
+    LLVMTypeRef elem = get_llvm_type(cg, elem_type);
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    unsigned long long elem_size = LLVMABISizeOfType(LLVMGetModuleDataLayout(cg->module), elem);
+    ASTNode *repeat = node->data.array.repeat;
+    
+    /* Length, and the value [v; n] repeats */
+    LLVMValueRef len, fill = NULL;
+    if (repeat) {
+        ASTNode *value = node->data.array.elements[0];
+        fill = codegen_expr(cg, value);
+        len = codegen_expr(cg, repeat);
+        if (!fill || !len) return NULL;
+        fill = convert_elem(cg, fill, value, elem_type);
+        len = codegen_convert(cg, len, i64, expr_unsigned(repeat));
+    } else {
+        len = LLVMConstInt(i64, node->data.array.count, 0);
+    }
+    int known = LLVMIsAConstantInt(len) && LLVMConstIntGetSExtValue(len) >= 0;
+    unsigned long long count = known ? LLVMConstIntGetZExtValue(len) : 0;
+    
+    LLVMValueRef data;
+    int zeroed;
+    if (known && !node->data.array.escapes && count <= STACK_ARRAY_MAX &&
+        count * elem_size <= STACK_ARRAY_MAX) {
+        data = build_entry_alloca(cg, LLVMArrayType(elem, count ? count : 1), "array");
+        LLVMSetAlignment(data, ARRAY_ALIGN);
+        zeroed = 0;
+    } else {
+        /* Region memory is reused, so only fresh permanent storage is known zero */
+        zeroed = node->data.array.escapes || !cg->region;
+        LLVMValueRef alloc_fn = get_alloc_array_func(cg, zeroed ? "__lp_alloc_array" : "__lp_region_array");
+        LLVMValueRef args[] = { len, LLVMConstInt(i64, elem_size, 0) };
+        data = LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(alloc_fn), alloc_fn,
+                              args, 2, "array");
+    }
+    
+    if (!repeat) {
+        for (size_t i = 0; i < node->data.array.count; i++) {
+            ASTNode *e = node->data.array.elements[i];
+            LLVMValueRef val = codegen_expr(cg, e);
+            if (!val) return NULL;
+            store_elem(cg, elem, data, LLVMConstInt(i64, i, 0), convert_elem(cg, val, e, elem_type));
+        }
+    } else if (LLVMIsNull(fill)) {
+        if (!zeroed) {
+            LLVMValueRef bytes = LLVMBuildMul(cg->builder, len, LLVMConstInt(i64, elem_size, 0), "bytes");
+            LLVMBuildMemSet(cg->builder, data, LLVMConstInt(LLVMInt8TypeInContext(cg->context), 0, 0),
+                            bytes, ARRAY_ALIGN);
+        }
+    } else {
+        build_fill(cg, elem, data, len, fill);
+    }
+    
+    return build_array_value(cg, node->resolved_type, data, len);
+}
+
+/*
+ * Address of a[i]. One unsigned compare rejects negative and too-large
+ * indices alike; the failing side is cold and does not return. Indices
+ * range analysis proved in bounds go unchecked.
+ */
+static LLVMValueRef index_address(CodeGen *cg, ASTNode *node, LLVMTypeRef *elem) {
+    ASTNode *array = node->data.index.array;
+    ASTNode *index = node->data.index.index;
+    if (!array->resolved_type || array->resolved_type->kind != TYPE_ARRAY) return NULL;
+    
+    LLVMValueRef arr = codegen_expr(cg, array);
+    LLVMValueRef idx = codegen_expr(cg, index);
+    if (!arr || !idx) return NULL;
+    
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    idx = codegen_convert(cg, idx, i64, expr_unsigned(index));
+    LLVMValueRef data = LLVMBuildExtractValue(cg->builder, arr, 0, "data");
+    *elem = get_llvm_type(cg, array->resolved_type->inner);
+    if (node->data.index.in_bounds) {
+        return LLVMBuildInBoundsGEP2(cg->builder, *elem, data, &idx, 1, "elem.ptr");
+    }
+    LLVMValueRef len = LLVMBuildExtractValue(cg->builder, arr, 1, "len");
+    
+    LLVMValueRef in_bounds = LLVMBuildICmp(cg->builder, LLVMIntULT, idx, len, "inbounds");
+    LLVMValueRef args[] = { idx, len };
+    build_check(cg, in_bounds, "index", "__lp_bounds_fail", args, 2);
+    return LLVMBuildInBoundsGEP2(cg->builder, *elem, data, &idx, 1, "elem.ptr");
+}
+
+/* a[i], or the store a[i] = v */
+static LLVMValueRef codegen_index(CodeGen *cg, ASTNode *node) {
+    Type *at = node->data.index.array->resolved_type;
+    if (at && at->kind == TYPE_VECTOR) return codegen_lane(cg, node);
+    
+    LLVMTypeRef elem;
+    LLVMValueRef ptr = index_address(cg, node, &elem);
+    if (!ptr) return NULL;
+    unsigned align = LLVMABIAlignmentOfType(LLVMGetModuleDataLayout(cg->module), elem);
+    
+    ASTNode *value = node->data.index.value;
+    if (value) {
+        LLVMValueRef val = codegen_expr(cg, value);
+        if (!val) return NULL;
+        val = convert_elem(cg, val, value, node->data.index.array->resolved_type->inner);
+        LLVMSetAlignment(LLVMBuildStore(cg->builder, val, ptr), align);
+        return NULL;
+    }
+    LLVMValueRef load = LLVMBuildLoad2(cg->builder, elem, ptr, "elem");
+    LLVMSetAlignment(load, align);
+    return load;
+}
+
+/* @mmap(path): the file as [u8], mapped in place */
+static LLVMValueRef codegen_mmap(CodeGen *cg, ASTNode *node) {
+    LLVMValueRef path = codegen_expr(cg, node->data.builtin.elements[0]);
+    if (!path) return NULL;
+    
+    LLVMTypeRef ptr = LLVMPointerTypeInContext(cg->context, 0);
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    LLVMValueRef len_slot = build_entry_alloca(cg, i64, "file.len");
+    LLVMTypeRef params[] = { ptr, ptr };
+    LLVMValueRef mmap_fn = get_runtime_func(cg, "__lp_mmap", ptr, params, 2);
+    LLVMValueRef args[] = { path, len_slot };
+    LLVMValueRef data = LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(mmap_fn), mmap_fn,
+                                       args, 2, "file");
+    LLVMValueRef len = LLVMBuildLoad2(cg->builder, i64, len_slot, "len");
+    return build_array_value(cg, node->resolved_type, data, len);
+}
+
+/* @lines(a): line start offsets of a [u8], then its length */
+static LLVMValueRef codegen_lines(CodeGen *cg, ASTNode *node) {
+    LLVMValueRef arr = codegen_expr(cg, node->data.builtin.elements[0]);
+    if (!arr) return NULL;
+    
+    LLVMTypeRef ptr = LLVMPointerTypeInContext(cg->context, 0);
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    LLVMValueRef count_slot = build_entry_alloca(cg, i64, "lines.count");
+    LLVMTypeRef params[] = { ptr, i64, ptr };
+    LLVMValueRef lines_fn = get_runtime_func(cg, "__lp_lines", ptr, params, 3);
+    LLVMValueRef args[] = {
+        LLVMBuildExtractValue(cg->builder, arr, 0, "data"),
+        LLVMBuildExtractValue(cg->builder, arr, 1, "len"),
+        count_slot
+    };
+    LLVMValueRef data = LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(lines_fn), lines_fn,
+                                       args, 3, "starts");
+    LLVMValueRef count = LLVMBuildLoad2(cg->builder, i64, count_slot, "count");
+    return build_array_value(cg, node->resolved_type, data, count);
+}
+
+/* @slice(a, lo, hi): a[lo..hi] as an array sharing a's storage */
+static LLVMValueRef codegen_slice(CodeGen *cg, ASTNode *node) {
+    ASTNode **elems = node->data.builtin.elements;
+    LLVMValueRef arr = codegen_expr(cg, elems[0]);
+    LLVMValueRef lo = codegen_expr(cg, elems[1]);
+    LLVMValueRef hi = codegen_expr(cg, elems[2]);
+    if (!arr || !lo || !hi) return NULL;
+    
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    lo = codegen_convert(cg, lo, i64, expr_unsigned(elems[1]));
+    hi = codegen_convert(cg, hi, i64, expr_unsigned(elems[2]));
+    LLVMValueRef data = LLVMBuildExtractValue(cg->builder, arr, 0, "data");
+    LLVMValueRef len = LLVMBuildExtractValue(cg->builder, arr, 1, "len");
+    
+    /* Unsigned compares also reject negative bounds */
+    LLVMValueRef ok = LLVMBuildAnd(cg->builder,
+                                   LLVMBuildICmp(cg->builder, LLVMIntULE, lo, hi, ""),
+                                   LLVMBuildICmp(cg->builder, LLVMIntULE, hi, len, ""), "inbounds");
+    LLVMValueRef args[] = { lo, hi, len };
+    build_check(cg, ok, "slice", "__lp_slice_fail", args, 3);
+    
+    LLVMTypeRef elem = get_llvm_type(cg, node->resolved_type->inner);
+    LLVMValueRef start = LLVMBuildInBoundsGEP2(cg->builder, elem, data, &lo, 1, "slice");
+    return build_array_value(cg, node->resolved_type, start, LLVMBuildSub(cg->builder, hi, lo, "slice.len"));
+}
+
+/* ========== Vectors ========== */
+
+/*
+ * Vector types (f32x8, i32x16, boolx8, ...) are LLVM fixed vectors, so
+ * operators work on every lane and the backend picks the SIMD
+ * instructions, splitting vectors wider than the target's registers.
+ * Comparisons give masks (<N x i1>), the @select and masked @load/@store
+ * operand. Array accesses are checked against the whole span of lanes.
+ */
+
+/* val as a value of vector type vt: itself, or a scalar converted and broadcast */
+static LLVMValueRef lanes_value(CodeGen *cg, LLVMValueRef val, ASTNode *src, Type *vt) {
+    if (is_vector_type(LLVMTypeOf(val))) return val;
+    LLVMTypeRef type = get_llvm_type(cg, vt);
+    return build_splat(cg, convert_elem(cg, val, src, vt->inner), type);
+}
+
+/* <0, 1, ..., n - 1> + base */
+static LLVMValueRef lane_indices(CodeGen *cg, LLVMValueRef base, unsigned n) {
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    LLVMValueRef *steps = malloc(sizeof(LLVMValueRef) * n);
+    for (unsigned i = 0; i < n; i++) steps[i] = LLVMConstInt(i64, i, 0);
+    LLVMValueRef iota = LLVMConstVector(steps, n);
+    free(steps);
+    return LLVMBuildAdd(cg->builder, build_splat(cg, base, LLVMTypeOf(iota)), iota, "lanes");
+}
+
+/* v[i]: one lane, checked unless the index is a constant the checker saw */
+static LLVMValueRef codegen_lane(CodeGen *cg, ASTNode *node) {
+    ASTNode *index = node->data.index.index;
+    LLVMValueRef vec = codegen_expr(cg, node->data.index.array);
+    LLVMValueRef idx = codegen_expr(cg, index);
+    if (!vec || !idx) return NULL;
+    
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    idx = codegen_convert(cg, idx, i64, expr_unsigned(index));
+    if (!node->data.index.in_bounds && index->type != NODE_INT_LIT) {
+        LLVMValueRef lanes = LLVMConstInt(i64, LLVMGetVectorSize(LLVMTypeOf(vec)), 0);
+        LLVMValueRef ok = LLVMBuildICmp(cg->builder, LLVMIntULT, idx, lanes, "inbounds");
+        LLVMValueRef args[] = { idx, lanes };
+        build_check(cg, ok, "lane", "__lp_bounds_fail", args, 2);
+    }
+    return LLVMBuildExtractElement(cg->builder, vec, idx, "lane");
+}
+
+/*
+ * Address of the lanes of vector type at a[i], for @load(a, i[, mask]) and
+ * @store(a, i, v[, mask]). Without a mask all of a[i .. i + lanes) must be
+ * in bounds; with one, only the lanes it selects.
+ */
+static LLVMValueRef lanes_address(CodeGen *cg, ASTNode *node, LLVMTypeRef type, LLVMValueRef mask,
+                                  unsigned *align) {
+    ASTNode *index = node->data.builtin.elements[1];
+    LLVMValueRef arr = codegen_expr(cg, node->data.builtin.elements[0]);
+    LLVMValueRef idx = codegen_expr(cg, index);
+    if (!arr || !idx) return NULL;
+    
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    LLVMTypeRef elem = LLVMGetElementType(type);
+    unsigned n = LLVMGetVectorSize(type);
+    idx = codegen_convert(cg, idx, i64, expr_unsigned(index));
+    LLVMValueRef data = LLVMBuildExtractValue(cg->builder, arr, 0, "data");
+    LLVMValueRef len = LLVMBuildExtractValue(cg->builder, arr, 1, "len");
+    
+    LLVMValueRef ok;
+    if (!mask) {
+        LLVMValueRef last = LLVMBuildSub(cg->builder, len, LLVMConstInt(i64, n, 0), "last");
+        ok = LLVMBuildAnd(cg->builder,
+                          LLVMBuildICmp(cg->builder, LLVMIntSGE, idx, LLVMConstInt(i64, 0, 0), ""),
+                          LLVMBuildICmp(cg->builder, LLVMIntSLE, idx, last, ""), "inbounds");
+    } else {
+        /* Selected lanes outside [0, len) as bits of an integer, which must be zero */
+        LLVMValueRef lanes = lane_indices(cg, idx, n);
+        LLVMValueRef inside = LLVMBuildICmp(cg->builder, LLVMIntULT, lanes,
+                                            build_splat(cg, len, LLVMTypeOf(lanes)), "");
+        LLVMValueRef outside = LLVMBuildAnd(cg->builder, mask, LLVMBuildNot(cg->builder, inside, ""), "");
+        LLVMValueRef bits = LLVMBuildBitCast(cg->builder, outside,
+                                             LLVMIntTypeInContext(cg->context, n), "");
+        ok = LLVMBuildICmp(cg->builder, LLVMIntEQ, bits, LLVMConstNull(LLVMTypeOf(bits)), "inbounds");
+    }
+    LLVMValueRef args[] = { idx, LLVMConstInt(i64, n, 0), len };
+    build_check(cg, ok, "lanes", "__lp_lanes_fail", args, 3);
+    
+    *align = LLVMABIAlignmentOfType(LLVMGetModuleDataLayout(cg->module), elem);
+    /* Masked lanes may lie outside the array, so the address is not inbounds */
+    return mask ? LLVMBuildGEP2(cg->builder, elem, data, &idx, 1, "lanes.ptr")
+                : LLVMBuildInBoundsGEP2(cg->builder, elem, data, &idx, 1, "lanes.ptr");
+}
+
+static LLVMValueRef codegen_load(CodeGen *cg, ASTNode *node) {
+    LLVMTypeRef type = get_llvm_type(cg, node->resolved_type);
+    LLVMValueRef mask = NULL;
+    if (node->data.builtin.count == 3) {
+        mask = codegen_expr(cg, node->data.builtin.elements[2]);
+        if (!mask) return NULL;
+    }
+    unsigned align;
+    LLVMValueRef ptr = lanes_address(cg, node, type, mask, &align);
+    if (!ptr) return NULL;
+    
+    if (!mask) {
+        LLVMValueRef load = LLVMBuildLoad2(cg->builder, type, ptr, "load");
+        LLVMSetAlignment(load, align);
+        return load;
+    }
+    /* Unselected lanes are zero and never read */
+    LLVMTypeRef overloads[] = { type, LLVMTypeOf(ptr) };
+    LLVMValueRef args[] = {
+        ptr, LLVMConstInt(LLVMInt32TypeInContext(cg->context), align, 0), mask, LLVMConstNull(type)
+    };
+    return call_intrinsic(cg, "llvm.masked.load", overloads, 2, args, 4, "load");
+}
+
+static LLVMValueRef codegen_store(CodeGen *cg, ASTNode *node) {
+    LLVMValueRef val = codegen_expr(cg, node->data.builtin.elements[2]);
+    if (!val) return NULL;
+    LLVMValueRef mask = NULL;
+    if (node->data.builtin.count == 4) {
+        mask = codegen_expr(cg, node->data.builtin.elements[3]);
+        if (!mask) return NULL;
+    }
+    unsigned align;
+    LLVMValueRef ptr = lanes_address(cg, node, LLVMTypeOf(val), mask, &align);
+    if (!ptr) return NULL;
+    
+    if (!mask) {
+        LLVMSetAlignment(LLVMBuildStore(cg->builder, val, ptr), align);
+        return NULL;
+    }
+    LLVMTypeRef overloads[] = { LLVMTypeOf(val), LLVMTypeOf(ptr) };
+    LLVMValueRef args[] = { val, ptr, LLVMConstInt(LLVMInt32TypeInContext(cg->context), align, 0), mask };
+    call_intrinsic(cg, "llvm.masked.store", overloads, 2, args, 4, "");
+    return NULL;
+}
+
+/* @shuffle(v[, w], lanes...): the checker made sure the lanes are constants in range */
+static LLVMValueRef codegen_shuffle(CodeGen *cg, ASTNode *node) {
+    ASTNode **args = node->data.builtin.elements;
+    size_t count = node->data.builtin.count;
+    size_t first = args[1]->type == NODE_INT_LIT ? 1 : 2;
+    
+    LLVMValueRef v = codegen_expr(cg, args[0]);
+    LLVMValueRef w = first == 2 ? codegen_expr(cg, args[1]) : LLVMGetPoison(LLVMTypeOf(v));
+    if (!v || !w) return NULL;
+    
+    LLVMTypeRef i32 = LLVMInt32TypeInContext(cg->context);
+    LLVMValueRef *lanes = malloc(sizeof(LLVMValueRef) * (count - first));
+    for (size_t i = first; i < count; i++) {
+        lanes[i - first] = LLVMConstInt(i32, (unsigned long long)args[i]->data.int_val, 0);
+    }
+    LLVMValueRef mask = LLVMConstVector(lanes, (unsigned)(count - first));
+    free(lanes);
+    return LLVMBuildShuffleVector(cg->builder, v, w, mask, "shuffle");
+}
+
+/* Float lanes add pairwise, the same tree whatever the fast-math settings */
+static LLVMValueRef build_fadd_lanes(CodeGen *cg, LLVMValueRef v) {
+    LLVMTypeRef i32 = LLVMInt32TypeInContext(cg->context);
+    unsigned n = LLVMGetVectorSize(LLVMTypeOf(v));
+    while (n > 2 && n % 2 == 0) {
+        LLVMValueRef lo[32], hi[32];
+        for (unsigned i = 0; i < n / 2; i++) {
+            lo[i] = LLVMConstInt(i32, i, 0);
+            hi[i] = LLVMConstInt(i32, i + n / 2, 0);
+        }
+        LLVMValueRef poison = LLVMGetPoison(LLVMTypeOf(v));
+        LLVMValueRef a = LLVMBuildShuffleVector(cg->builder, v, poison, LLVMConstVector(lo, n / 2), "");
+        LLVMValueRef b = LLVMBuildShuffleVector(cg->builder, v, poison, LLVMConstVector(hi, n / 2), "");
+        v = fast_math(cg, LLVMBuildFAdd(cg->builder, a, b, "sum"));
+        n /= 2;
+    }
+    LLVMValueRef sum = LLVMBuildExtractElement(cg->builder, v, LLVMConstInt(i32, 0, 0), "");
+    for (unsigned i = 1; i < n; i++) {
+        LLVMValueRef lane = LLVMBuildExtractElement(cg->builder, v, LLVMConstInt(i32, i, 0), "");
+        sum = fast_math(cg, LLVMBuildFAdd(cg->builder, sum, lane, "sum"));
+    }
+    return sum;
+}
+
+/* @reduce_add / @reduce_max / @reduce_min of every lane */
+static LLVMValueRef codegen_reduce_lanes(CodeGen *cg, ASTNode *node) {
+    ASTNode *arg = node->data.builtin.elements[0];
+    LLVMValueRef v = codegen_expr(cg, arg);
+    if (!v) return NULL;
+    
+    const char *op = node->data.builtin.name + strlen("reduce_");
+    LLVMTypeRef type = LLVMTypeOf(v);
+    LLVMTypeRef elem = LLVMGetElementType(type);
+    int is_mask = LLVMGetTypeKind(elem) == LLVMIntegerTypeKind && LLVMGetIntTypeWidth(elem) == 1;
+    int is_unsigned = is_unsigned_type(arg->resolved_type);
+    const char *name;
+    
+    if (strcmp(op, "add") == 0) {
+        if (is_float_type(type)) return build_fadd_lanes(cg, v);
+        if (is_mask) {
+            /* Number of set lanes */
+            type = LLVMVectorType(LLVMInt64TypeInContext(cg->context), LLVMGetVectorSize(type));
+            v = LLVMBuildZExt(cg->builder, v, type, "");
+        }
+        name = "llvm.vector.reduce.add";
+    } else if (strcmp(op, "max") == 0) {
+        name = is_float_type(type) ? "llvm.vector.reduce.fmax"
+             : is_mask ? "llvm.vector.reduce.or"
+             : is_unsigned ? "llvm.vector.reduce.umax" : "llvm.vector.reduce.smax";
+    } else {
+        name = is_float_type(type) ? "llvm.vector.reduce.fmin"
+             : is_mask ? "llvm.vector.reduce.and"
+             : is_unsigned ? "llvm.vector.reduce.umin" : "llvm.vector.reduce.smin";
+    }
+    return call_intrinsic(cg, name, &type, 1, &v, 1, "reduce");
+}
+
+static LLVMValueRef codegen_vector_builtin(CodeGen *cg, ASTNode *node) {
+    const char *name = node->data.builtin.name;
+    ASTNode **args = node->data.builtin.elements;
+    
+    if (strcmp(name, "splat") == 0) {
+        LLVMValueRef val = codegen_expr(cg, args[0]);
+        return val ? lanes_value(cg, val, args[0], node->resolved_type) : NULL;
+    }
+    if (strcmp(name, "load") == 0) return codegen_load(cg, node);
+    if (strcmp(name, "store") == 0) return codegen_store(cg, node);
+    if (strcmp(name, "shuffle") == 0) return codegen_shuffle(cg, node);
+    if (strcmp(name, "select") == 0) {
+        LLVMValueRef mask = codegen_expr(cg, args[0]);
+        LLVMValueRef a = codegen_expr(cg, args[1]);
+        LLVMValueRef b = codegen_expr(cg, args[2]);
+        if (!mask || !a || !b) return NULL;
+        Type *vt = node->resolved_type;
+        return LLVMBuildSelect(cg->builder, mask, lanes_value(cg, a, args[1], vt),
+                               lanes_value(cg, b, args[2], vt), "select");
+    }
+    if (strncmp(name, "reduce_", 7) == 0) return codegen_reduce_lanes(cg, node);
+    return NULL;
+}
+
+/* ========== Math Builtins ========== */
+
+/* Intrinsic behind each math and bit builtin, by the operands' lane type */
+typedef struct MathIntrinsic {
+    const char *name;
+    const char *float_fn;
+    const char *int_fn;       /* signed integers */
+    const char *uint_fn;      /* unsigned integers, NULL for the operand itself */
+} MathIntrinsic;
+
+static const MathIntrinsic math_intrinsics[] = {
+    { "sqrt",     "llvm.sqrt",   NULL,         NULL },
+    { "floor",    "llvm.floor",  NULL,         NULL },
+    { "ceil",     "llvm.ceil",   NULL,         NULL },
+    { "exp",      "llvm.exp",    NULL,         NULL },
+    { "log",      "llvm.log",    NULL,         NULL },
+    { "sin",      "llvm.sin",    NULL,         NULL },
+    { "cos",      "llvm.cos",    NULL,         NULL },
+    { "pow",      "llvm.pow",    NULL,         NULL },
+    { "fma",      "llvm.fma",    NULL,         NULL },
+    { "abs",      "llvm.fabs",   "llvm.abs",   NULL },
+    { "min",      "llvm.minnum", "llvm.smin",  "llvm.umin" },
+    { "max",      "llvm.maxnum", "llvm.smax",  "llvm.umax" },
+    { "popcount", NULL,          "llvm.ctpop", "llvm.ctpop" },
+    { "clz",      NULL,          "llvm.ctlz",  "llvm.ctlz" },
+    { "ctz",      NULL,          "llvm.cttz",  "llvm.cttz" },
+    { "bswap",    NULL,          "llvm.bswap", "llvm.bswap" },
+    { "rotl",     NULL,          "llvm.fshl",  "llvm.fshl" },
+    { "rotr",     NULL,          "llvm.fshr",  "llvm.fshr" },
+};
+
+static const MathIntrinsic *math_intrinsic(const char *name) {
+    for (size_t i = 0; i < sizeof(math_intrinsics) / sizeof(math_intrinsics[0]); i++)
+        if (strcmp(math_intrinsics[i].name, name) == 0) return &math_intrinsics[i];
+    return NULL;
+}
+
+/* arg converted to the builtin's type t, broadcast if t is a vector */
+static LLVMValueRef math_operand(CodeGen *cg, ASTNode *arg, Type *t) {
+    LLVMValueRef val = codegen_expr(cg, arg);
+    if (!val) return NULL;
+    if (t->kind == TYPE_VECTOR) return lanes_value(cg, val, arg, t);
+    return convert_elem(cg, val, arg, t);
+}
+
+/*
+ * Math and bit builtins are plain LLVM intrinsics, so the vectorizer sees
+ * through them; transcendentals in a vectorized loop become calls into the
+ * vector math library set up in codegen_init.
+ */
+static LLVMValueRef codegen_math_builtin(CodeGen *cg, ASTNode *node, const MathIntrinsic *mi) {
+    ASTNode **args = node->data.builtin.elements;
+    size_t count = node->data.builtin.count;
+    Type *t = node->resolved_type;
+    LLVMTypeRef type = get_llvm_type(cg, t);
+    
+    LLVMValueRef ops[3];
+    for (size_t i = 0; i < count && i < 3; i++) {
+        ops[i] = math_operand(cg, args[i], t);
+        if (!ops[i]) return NULL;
+    }
+    
+    const char *fn = is_float_type(type) ? mi->float_fn
+                   : is_unsigned_type(t) ? mi->uint_fn : mi->int_fn;
+    if (!fn) return ops[0];
+    
+    LLVMValueRef no_poison = LLVMConstInt(LLVMInt1TypeInContext(cg->context), 0, 0);
+    if (strcmp(fn, "llvm.abs") == 0 || strcmp(fn, "llvm.ctlz") == 0 || strcmp(fn, "llvm.cttz") == 0) {
+        /* Defined for INT_MIN and zero */
+        ops[1] = no_poison;
+        count = 2;
+    } else if (strcmp(fn, "llvm.fshl") == 0 || strcmp(fn, "llvm.fshr") == 0) {
+        /* A rotate is a funnel shift of the value with itself */
+        ops[2] = ops[1];
+        ops[1] = ops[0];
+        count = 3;
+    }
+    return fast_math(cg, call_intrinsic(cg, fn, &type, 1, ops, count, node->data.builtin.name));
+}
+
+/* ========== Async / Await ========== */
+
+/*
+ * An async expression becomes a switched-resume coroutine
+ *   ptr __lp_async(ptr env, ptr task)
+ * that starts suspended and is queued on the runtime executor.
+ * Its value is stored in the task, so the frame is freed on completion.
+ */
+typedef struct CoroState {
+    LLVMValueRef id;
+    LLVMValueRef hdl;
+    LLVMValueRef task;              /* the task this coroutine completes */
+    LLVMBasicBlockRef cleanup;      /* frees the frame */
+    LLVMBasicBlockRef suspend;      /* returns to the resumer */
+} CoroState;
+
+static LLVMValueRef get_runtime_func(CodeGen *cg, const char *name, LLVMTypeRef ret,
+                                     LLVMTypeRef *params, unsigned count) {
+    LLVMValueRef func = LLVMGetNamedFunction(cg->module, name);
+    if (func) return func;
+    return LLVMAddFunction(cg->module, name, LLVMFunctionType(ret, params, count, 0));
+}
+
+static LLVMValueRef call_intrinsic(CodeGen *cg, const char *name, LLVMTypeRef *overloads,
+                                   size_t overload_count, LLVMValueRef *args, unsigned count,
+                                   const char *label) {
+    unsigned id = LLVMLookupIntrinsicID(name, strlen(name));
+    LLVMValueRef fn = LLVMGetIntrinsicDeclaration(cg->module, id, overloads, overload_count);
+    LLVMTypeRef fn_type = LLVMIntrinsicGetType(cg->context, id, overloads, overload_count);
+    return LLVMBuildCall2(cg->builder, fn_type, fn, args, count, label);
+}
+
+/* Suspend point: branches to resume, or to cleanup if the frame is destroyed */
+static void coro_suspend(CodeGen *cg, LLVMValueRef save, LLVMBasicBlockRef resume) {
+    CoroState *co = cg->coro;
+    LLVMValueRef args[] = { save, LLVMConstInt(LLVMInt1TypeInContext(cg->context), 0, 0) };
+    LLVMValueRef state = call_intrinsic(cg, "llvm.coro.suspend", NULL, 0, args, 2, "state");
+    
+    LLVMTypeRef i8 = LLVMInt8TypeInContext(cg->context);
+    LLVMValueRef sw = LLVMBuildSwitch(cg->builder, state, co->suspend, 2);
+    LLVMAddCase(sw, LLVMConstInt(i8, 0, 0), resume);
+    LLVMAddCase(sw, LLVMConstInt(i8, 1, 0), co->cleanup);
+}
+
+static LLVMValueRef codegen_async(CodeGen *cg, ASTNode *node) {
+    LLVMTypeRef ptr = LLVMPointerTypeInContext(cg->context, 0);
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    LLVMValueRef null = LLVMConstNull(ptr);
+    
+    CaptureList caps = {0};
+    collect_captures(cg, node->data.async_expr.expr, &caps);
+    
+    LLVMTypeRef env_type;
+    LLVMValueRef env = build_capture_env(cg, &caps, &env_type, 0);
+    
+    LLVMValueRef new_fn = get_runtime_func(cg, "__lp_task_new", ptr, NULL, 0);
+    LLVMValueRef task = LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(new_fn),
+                                       new_fn, NULL, 0, "task");
+    
+    LLVMTypeRef params[] = { ptr, ptr };
+    LLVMValueRef fn = LLVMAddFunction(cg->module, "__lp_async", LLVMFunctionType(ptr, params, 2, 0));
+    LLVMSetLinkage(fn, LLVMInternalLinkage);
+    unsigned presplit = LLVMGetEnumAttributeKindForName("presplitcoroutine", 17);
+    if (presplit) {
+        LLVMAddAttributeAtIndex(fn, LLVMAttributeFunctionIndex,
+                                LLVMCreateEnumAttribute(cg->context, presplit, 0));
+    }
+    
+    LLVMBasicBlockRef saved_bb = LLVMGetInsertBlock(cg->builder);
+    Scope *saved_scope = cg->current_scope;
+    CoroState *saved_coro = cg->coro;
+    LLVMValueRef saved_region = cg->region;
+    cg->region = NULL;
+    
+    LLVMBasicBlockRef entry = LLVMAppendBasicBlockInContext(cg->context, fn, "entry");
+    LLVMBasicBlockRef start = LLVMAppendBasicBlockInContext(cg->context, fn, "start");
+    CoroState co = {
+        .task = LLVMGetParam(fn, 1),
+        .cleanup = LLVMAppendBasicBlockInContext(cg->context, fn, "cleanup"),
+        .suspend = LLVMAppendBasicBlockInContext(cg->context, fn, "suspend"),
+    };
+    LLVMPositionBuilderAtEnd(cg->builder, entry);
+    
+    /* Frame allocation */
+    LLVMValueRef id_args[] = { LLVMConstInt(LLVMInt32TypeInContext(cg->context), 0, 0),
+                               null, null, null };
+    co.id = call_intrinsic(cg, "llvm.coro.id", NULL, 0, id_args, 4, "id");
+    LLVMValueRef size = call_intrinsic(cg, "llvm.coro.size", &i64, 1, NULL, 0, "size");
+    LLVMValueRef malloc_fn = get_runtime_func(cg, "malloc", ptr, &i64, 1);
+    LLVMValueRef mem = LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(malloc_fn),
+                                      malloc_fn, &size, 1, "mem");
+    LLVMValueRef begin_args[] = { co.id, mem };
+    co.hdl = call_intrinsic(cg, "llvm.coro.begin", NULL, 0, begin_args, 2, "hdl");
+    
+    /* Captures are copied into the frame before the caller's env goes away */
+    cg->current_scope = bind_capture_env(cg, &caps, env_type, LLVMGetParam(fn, 0));
+    cg->coro = &co;
+    
+    /* Start suspended; the executor performs the first resume */
+    coro_suspend(cg, LLVMConstNull(LLVMTokenTypeInContext(cg->context)), start);
+    
+    LLVMPositionBuilderAtEnd(cg->builder, start);
+    LLVMValueRef val = codegen_expr(cg, node->data.async_expr.expr);
+    LLVMValueRef result_fn = get_runtime_func(cg, "__lp_task_result", ptr, &ptr, 1);
+    if (val) {
+        LLVMValueRef slot = LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(result_fn),
+                                           result_fn, &co.task, 1, "result");
+        LLVMBuildStore(cg->builder, val, slot);
+    }
+    LLVMValueRef finish_fn = get_runtime_func(cg, "__lp_task_finish",
+                                              LLVMVoidTypeInContext(cg->context), &ptr, 1);
+    LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(finish_fn), finish_fn, &co.task, 1, "");
+    LLVMBuildBr(cg->builder, co.cleanup);
+    
+    LLVMPositionBuilderAtEnd(cg->builder, co.cleanup);
+    LLVMValueRef free_args[] = { co.id, co.hdl };
+    LLVMValueRef frame = call_intrinsic(cg, "llvm.coro.free", NULL, 0, free_args, 2, "frame");
+    LLVMValueRef free_fn = get_runtime_func(cg, "free", LLVMVoidTypeInContext(cg->context), &ptr, 1);
+    LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(free_fn), free_fn, &frame, 1, "");
+    LLVMBuildBr(cg->builder, co.suspend);
+    
+    /* coro.end gained a token operand in newer LLVM */
+    LLVMPositionBuilderAtEnd(cg->builder, co.suspend);
+    unsigned end_id = LLVMLookupIntrinsicID("llvm.coro.end", 13);
+    LLVMValueRef end_args[] = { co.hdl, LLVMConstInt(LLVMInt1TypeInContext(cg->context), 0, 0),
+                                LLVMConstNull(LLVMTokenTypeInContext(cg->context)) };
+    unsigned end_argc = LLVMCountParamTypes(LLVMIntrinsicGetType(cg->context, end_id, NULL, 0));
+    call_intrinsic(cg, "llvm.coro.end", NULL, 0, end_args, end_argc, "");
+    LLVMBuildRet(cg->builder, co.hdl);
+    
+    scope_free(cg->current_scope);
+    cg->current_scope = saved_scope;
+    cg->coro = saved_coro;
+    cg->region = saved_region;
+    LLVMPositionBuilderAtEnd(cg->builder, saved_bb);
+    free(caps.names);
+    
+    /* Run the ramp (allocates the frame and copies captures), then queue it */
+    LLVMValueRef ramp_args[] = { env, task };
+    LLVMValueRef hdl = LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(fn), fn,
+                                      ramp_args, 2, "coro");
+    LLVMValueRef start_params[] = { task, hdl };
+    LLVMValueRef start_fn = get_runtime_func(cg, "__lp_task_start",
+                                             LLVMVoidTypeInContext(cg->context), params, 2);
+    LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(start_fn), start_fn, start_params, 2, "");
+    
+    cg->has_coroutines = 1;
+    return task;
+}
+
+/* Result type of the task an await operand evaluates to */
+static Type *await_result_type(ASTNode *operand) {
+    Type *t = operand->resolved_type;
+    return (t && t->kind == TYPE_ASYNC) ? t->inner : NULL;
+}
+
+static LLVMValueRef codegen_await(CodeGen *cg, ASTNode *node) {
+    LLVMTypeRef ptr = LLVMPointerTypeInContext(cg->context, 0);
+    ASTNode *operand = node->data.async_expr.expr;
+    
+    LLVMValueRef task = codegen_expr(cg, operand);
+    if (!task) return NULL;
+    Type *result_type = await_result_type(operand);
+    if (!result_type) {
+        fprintf(stderr, "E: %u:%u: await on a value that is not a task\n", node->line, node->col);
+        return NULL;
+    }
+    
+    if (cg->coro) {
+        /* Register as a waiter, then suspend unless the task already finished */
+        LLVMValueRef save = call_intrinsic(cg, "llvm.coro.save", NULL, 0, &cg->coro->hdl, 1, "save");
+        LLVMTypeRef params[] = { ptr, ptr };
+        LLVMValueRef await_fn = get_runtime_func(cg, "__lp_task_await",
+                                                 LLVMInt32TypeInContext(cg->context), params, 2);
+        LLVMValueRef args[] = { task, cg->coro->task };
+        LLVMValueRef pending = LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(await_fn),
+                                              await_fn, args, 2, "pending");
         
-        /* Combine into loop metadata */
-        LLVMMetadataRef loop_ops[] = { loop_id, parallel_md, vec_md, unroll_md };
-        LLVMMetadataRef loop_md = LLVMMDNodeInContext2(ctx, loop_ops, 4);
+        LLVMValueRef func = LLVMGetBasicBlockParent(LLVMGetInsertBlock(cg->builder));
+        LLVMBasicBlockRef wait_bb = LLVMAppendBasicBlockInContext(cg->context, func, "await.wait");
+        LLVMBasicBlockRef ready_bb = LLVMAppendBasicBlockInContext(cg->context, func, "await.ready");
+        LLVMValueRef zero = LLVMConstInt(LLVMInt32TypeInContext(cg->context), 0, 0);
+        LLVMBuildCondBr(cg->builder, LLVMBuildICmp(cg->builder, LLVMIntNE, pending, zero, ""),
+                        wait_bb, ready_bb);
         
-        /* Attach to branch instruction */
-        LLVMSetMetadata(br, LLVMGetMDKindIDInContext(ctx, "llvm.loop", 9), 
-                        LLVMMetadataAsValue(ctx, loop_md));
+        LLVMPositionBuilderAtEnd(cg->builder, wait_bb);
+        coro_suspend(cg, save, ready_bb);
+        LLVMPositionBuilderAtEnd(cg->builder, ready_bb);
+    } else {
+        /* Plain code drives the executor until the task is done */
+        LLVMValueRef wait_fn = get_runtime_func(cg, "__lp_task_wait",
+                                                LLVMVoidTypeInContext(cg->context), &ptr, 1);
+        LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(wait_fn), wait_fn, &task, 1, "");
+    }
+    
+    if (result_type->kind == TYPE_VOID) return NULL;
+    LLVMValueRef result_fn = get_runtime_func(cg, "__lp_task_result", ptr, &ptr, 1);
+    LLVMValueRef slot = LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(result_fn),
+                                       result_fn, &task, 1, "result");
+    return LLVMBuildLoad2(cg->builder, get_llvm_type(cg, result_type), slot, "awaited");
+}
+
+/* ========== Reductions ========== */
+
+/* Per-chunk accumulator of a @parallel(reduce ...) loop */
+typedef struct {
+    Operator op;
+    LLVMTypeRef type;          /* fixed by the first contribution */
+    LLVMValueRef acc;          /* alloca in the chunk entry block */
+    LLVMBasicBlockRef entry;
+    int is_unsigned;           /* unsigned min/max */
+} Reduction;
+
+static LLVMValueRef reduce_identity(Operator op, LLVMTypeRef type, int is_unsigned) {
+    if (is_float_type(type)) {
+        switch (op) {
+            case OP_MUL: return LLVMConstReal(type, 1.0);
+            case OP_MIN: return LLVMConstReal(type, HUGE_VAL);
+            case OP_MAX: return LLVMConstReal(type, -HUGE_VAL);
+            default:     return LLVMConstReal(type, 0.0);
+        }
+    }
+    
+    unsigned bits = LLVMGetIntTypeWidth(type);
+    switch (op) {
+        case OP_MUL:    return LLVMConstInt(type, 1, 0);
+        case OP_BITAND: return LLVMConstAllOnes(type);
+        case OP_MIN:    return is_unsigned ? LLVMConstAllOnes(type)
+                                       : LLVMConstInt(type, (1ULL << (bits - 1)) - 1, 0);
+        case OP_MAX:    return is_unsigned ? LLVMConstInt(type, 0, 0)
+                                       : LLVMConstInt(type, 1ULL << (bits - 1), 0);
+        default:        return LLVMConstInt(type, 0, 0);
+    }
+}
+
+static LLVMValueRef reduce_combine(CodeGen *cg, Reduction *red, LLVMValueRef a, LLVMValueRef b) {
+    Operator op = red->op;
+    int is_float = is_float_type(LLVMTypeOf(a));
+    LLVMIntPredicate lt = red->is_unsigned ? LLVMIntULT : LLVMIntSLT;
+    LLVMIntPredicate gt = red->is_unsigned ? LLVMIntUGT : LLVMIntSGT;
+    
+    switch (op) {
+        case OP_ADD:
+            return is_float ? fast_math(cg, LLVMBuildFAdd(cg->builder, a, b, "red"))
+                           : LLVMBuildAdd(cg->builder, a, b, "red");
+        case OP_MUL:
+            return is_float ? fast_math(cg, LLVMBuildFMul(cg->builder, a, b, "red"))
+                           : LLVMBuildMul(cg->builder, a, b, "red");
+        case OP_MIN:
+        case OP_MAX: {
+            LLVMValueRef cmp = is_float
+                ? fast_math(cg, LLVMBuildFCmp(cg->builder, op == OP_MIN ? LLVMRealOLT : LLVMRealOGT, a, b, ""))
+                : LLVMBuildICmp(cg->builder, op == OP_MIN ? lt : gt, a, b, "");
+            LLVMValueRef sel = LLVMBuildSelect(cg->builder, cmp, a, b, "red");
+            return is_float ? fast_math(cg, sel) : sel;
+        }
+        case OP_BITAND: return LLVMBuildAnd(cg->builder, a, b, "red");
+        case OP_BITOR:  return LLVMBuildOr(cg->builder, a, b, "red");
+        case OP_BITXOR: return LLVMBuildXor(cg->builder, a, b, "red");
+        default:        return a;
+    }
+}
+
+/* Create the chunk accumulator, initialised to the identity before the loop */
+static int reduce_begin(CodeGen *cg, Reduction *red, LLVMTypeRef type) {
+    if (is_float_type(type) &&
+        (red->op == OP_BITAND || red->op == OP_BITOR || red->op == OP_BITXOR)) {
+        fprintf(stderr, "E: bitwise reduction over a float value\n");
+        return 0;
+    }
+    
+    LLVMBuilderRef b = LLVMCreateBuilderInContext(cg->context);
+    LLVMValueRef term = LLVMGetBasicBlockTerminator(red->entry);
+    if (term) LLVMPositionBuilderBefore(b, term);
+    else LLVMPositionBuilderAtEnd(b, red->entry);
+    
+    red->type = type;
+    red->acc = LLVMBuildAlloca(b, type, "acc");
+    LLVMBuildStore(b, reduce_identity(red->op, type, red->is_unsigned), red->acc);
+    LLVMDisposeBuilder(b);
+    return 1;
+}
+
+/* Fold one iteration's value into the chunk accumulator */
+static void reduce_accumulate(CodeGen *cg, Reduction *red, LLVMValueRef val, int is_unsigned) {
+    if (!red->type) {
+        /* Predicates are counted, not xor-ed */
+        LLVMTypeRef type = LLVMTypeOf(val);
+        if (type == LLVMInt1TypeInContext(cg->context)) type = LLVMInt64TypeInContext(cg->context);
+        red->is_unsigned = is_unsigned;
+        if (!reduce_begin(cg, red, type)) return;
+    }
+    
+    val = codegen_convert(cg, val, red->type, is_unsigned);
+    LLVMValueRef cur = LLVMBuildLoad2(cg->builder, red->type, red->acc, "acc");
+    LLVMBuildStore(cg->builder, reduce_combine(cg, red, cur, val), red->acc);
+}
+
+/* void combine(ptr dst, ptr src) for the runtime's tree combine */
+static LLVMValueRef build_reduce_combiner(CodeGen *cg, Reduction *red) {
+    LLVMTypeRef ptr = LLVMPointerTypeInContext(cg->context, 0);
+    LLVMTypeRef params[] = { ptr, ptr };
+    LLVMTypeRef fn_type = LLVMFunctionType(LLVMVoidTypeInContext(cg->context), params, 2, 0);
+    LLVMValueRef fn = LLVMAddFunction(cg->module, "__lp_reduce_combine", fn_type);
+    LLVMSetLinkage(fn, LLVMInternalLinkage);
+    
+    LLVMBasicBlockRef saved_bb = LLVMGetInsertBlock(cg->builder);
+    LLVMPositionBuilderAtEnd(cg->builder, LLVMAppendBasicBlockInContext(cg->context, fn, "entry"));
+    
+    LLVMValueRef dst = LLVMGetParam(fn, 0);
+    LLVMValueRef a = LLVMBuildLoad2(cg->builder, red->type, dst, "");
+    LLVMValueRef b = LLVMBuildLoad2(cg->builder, red->type, LLVMGetParam(fn, 1), "");
+    LLVMBuildStore(cg->builder, reduce_combine(cg, red, a, b), dst);
+    LLVMBuildRetVoid(cg->builder);
+    
+    LLVMPositionBuilderAtEnd(cg->builder, saved_bb);
+    return fn;
+}
+
+static LLVMValueRef get_reduce_slot_func(CodeGen *cg) {
+    LLVMValueRef func = LLVMGetNamedFunction(cg->module, "__lp_reduce_slot");
+    if (func) return func;
+    
+    /* void* __lp_reduce_slot(void) */
+    LLVMTypeRef ptr = LLVMPointerTypeInContext(cg->context, 0);
+    return LLVMAddFunction(cg->module, "__lp_reduce_slot", LLVMFunctionType(ptr, NULL, 0, 0));
+}
+
+static LLVMValueRef get_parallel_reduce_func(CodeGen *cg) {
+    LLVMValueRef func = LLVMGetNamedFunction(cg->module, "__lp_parallel_reduce");
+    if (func) return func;
+    
+    /* void __lp_parallel_reduce(i64 start, i64 end, body, void* ctx, i32 schedule, i64 chunk,
+     *                           void* result, void* identity, i64 size, combine) */
+    LLVMTypeRef i32 = LLVMInt32TypeInContext(cg->context);
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    LLVMTypeRef ptr = LLVMPointerTypeInContext(cg->context, 0);
+    LLVMTypeRef void_type = LLVMVoidTypeInContext(cg->context);
+    
+    LLVMTypeRef params[] = { i64, i64, ptr, ptr, i32, i64, ptr, ptr, i64, ptr };
+    LLVMTypeRef func_type = LLVMFunctionType(void_type, params, 10, 0);
+    
+    return LLVMAddFunction(cg->module, "__lp_parallel_reduce", func_type);
+}
+
+/* ========== Loops ========== */
+
+/* Loop ID whose first operand is itself, as LLVM requires */
+static LLVMMetadataRef loop_metadata(CodeGen *cg, LLVMMetadataRef *props, unsigned count) {
+    LLVMMetadataRef *ops = malloc(sizeof(LLVMMetadataRef) * (count + 1));
+    LLVMMetadataRef self = LLVMTemporaryMDNode(cg->context, NULL, 0);
+    ops[0] = self;
+    for (unsigned i = 0; i < count; i++) ops[i + 1] = props[i];
+    LLVMMetadataRef id = LLVMMDNodeInContext2(cg->context, ops, count + 1);
+    LLVMMetadataReplaceAllUsesWith(self, id);
+    free(ops);
+    return id;
+}
+
+static LLVMMetadataRef loop_hint(CodeGen *cg, const char *name, LLVMValueRef value) {
+    LLVMMetadataRef ops[] = {
+        LLVMMDStringInContext2(cg->context, name, strlen(name)),
+        LLVMValueAsMetadata(value)
+    };
+    return LLVMMDNodeInContext2(cg->context, ops, 2);
+}
+
+static void set_loop_metadata(CodeGen *cg, LLVMValueRef latch, LLVMMetadataRef id) {
+    LLVMSetMetadata(latch, LLVMGetMDKindIDInContext(cg->context, "llvm.loop", 9),
+                    LLVMMetadataAsValue(cg->context, id));
+}
+
+/*
+ * A fresh access group: a distinct node without operands. The C API only
+ * builds uniqued nodes, so it is parsed from IR; the node belongs to the
+ * context and outlives the scratch module.
+ */
+static LLVMMetadataRef access_group(CodeGen *cg) {
+    static const char ir[] = "!lp.group = !{!0}\n!0 = distinct !{}\n";
+    LLVMMemoryBufferRef buf = LLVMCreateMemoryBufferWithMemoryRangeCopy(ir, sizeof(ir) - 1, "group");
+    LLVMModuleRef scratch;
+    char *error = NULL;
+    if (LLVMParseIRInContext(cg->context, buf, &scratch, &error)) {
+        fprintf(stderr, "E: access group: %s\n", error);
+        LLVMDisposeMessage(error);
+        return NULL;
     }
+    LLVMValueRef group;
+    LLVMGetNamedMetadataOperands(scratch, "lp.group", &group);
+    LLVMMetadataRef md = LLVMValueAsMetadata(group);
+    LLVMDisposeModule(scratch);
+    return md;
+}
+
+/* The object a pointer addresses, through element offsets, casts and array values */
+static LLVMValueRef underlying_object(LLVMValueRef ptr) {
+    for (;;) {
+        if (LLVMIsAGetElementPtrInst(ptr) || LLVMIsACastInst(ptr) ||
+            (LLVMIsAConstantExpr(ptr) && (LLVMGetConstOpcode(ptr) == LLVMGetElementPtr ||
+                                          LLVMGetConstOpcode(ptr) == LLVMBitCast))) {
+            ptr = LLVMGetOperand(ptr, 0);
+        } else if (LLVMIsAExtractValueInst(ptr) && LLVMGetNumIndices(ptr) == 1) {
+            /* The data field of an array value built in this function */
+            unsigned field = LLVMGetIndices(ptr)[0];
+            LLVMValueRef agg = LLVMGetOperand(ptr, 0);
+            while (LLVMIsAInsertValueInst(agg) && LLVMGetNumIndices(agg) == 1 &&
+                   LLVMGetIndices(agg)[0] != field) {
+                agg = LLVMGetOperand(agg, 0);
+            }
+            if (!LLVMIsAInsertValueInst(agg) || LLVMGetNumIndices(agg) != 1) return ptr;
+            ptr = LLVMGetOperand(agg, 1);
+        } else {
+            return ptr;
+        }
+    }
+}
+
+/*
+ * Put the loads and stores of a loop body (body and the blocks appended
+ * after after while it was built) in group. Anything on the stack stays
+ * out: allocas are hoisted to the entry block, so every iteration shares
+ * them, the reduction accumulator and stack arrays alike.
+ */
+static void tag_accesses(CodeGen *cg, LLVMBasicBlockRef body, LLVMBasicBlockRef after,
+                         LLVMMetadataRef group) {
+    unsigned kind = LLVMGetMDKindIDInContext(cg->context, "llvm.access.group", 17);
+    LLVMValueRef md = LLVMMetadataAsValue(cg->context, group);
+    
+    for (LLVMBasicBlockRef bb = body; bb; bb = LLVMGetNextBasicBlock(bb == body ? after : bb)) {
+        for (LLVMValueRef inst = LLVMGetFirstInstruction(bb); inst; inst = LLVMGetNextInstruction(inst)) {
+            int is_load = LLVMIsALoadInst(inst) != NULL;
+            if (!is_load && !LLVMIsAStoreInst(inst)) continue;
+            if (LLVMIsAAllocaInst(underlying_object(LLVMGetOperand(inst, is_load ? 0 : 1)))) continue;
+            LLVMSetMetadata(inst, kind, md);
+        }
+    }
+}
+
+/*
+ * llvm.loop properties of a loop: independent iterations for @parallel
+ * (group tags their accesses), then the @vectorize and @unroll hints.
+ */
+static unsigned loop_properties(CodeGen *cg, ASTNode *node, LLVMMetadataRef group,
+                                LLVMMetadataRef *props) {
+    LLVMTypeRef i1 = LLVMInt1TypeInContext(cg->context);
+    LLVMTypeRef i32 = LLVMInt32TypeInContext(cg->context);
+    int unroll = node->data.for_loop.unroll;
+    unsigned count = 0;
+    
+    if (group) {
+        LLVMMetadataRef ops[] = {
+            LLVMMDStringInContext2(cg->context, "llvm.loop.parallel_accesses", 27), group
+        };
+        props[count++] = LLVMMDNodeInContext2(cg->context, ops, 2);
+    }
+    
+    int vectorize = node->data.for_loop.vectorize;
+#if LLVM_VERSION_MAJOR < 18
+    /* No per-instruction flags: let the vectorizer reorder the loop's float reduction */
+    if ((node->data.for_loop.fast_math & FM_REASSOC) && reassoc_reduction(node)) vectorize = 1;
+#endif
+    /* width=1 keeps the loop scalar, so it asks for nothing to be forced */
+    if (vectorize && node->data.for_loop.vector_width != 1) {
+        props[count++] = loop_hint(cg, "llvm.loop.vectorize.enable", LLVMConstInt(i1, 1, 0));
+    }
+    if (node->data.for_loop.vector_width > 0) {
+        props[count++] = loop_hint(cg, "llvm.loop.vectorize.width",
+                                   LLVMConstInt(i32, node->data.for_loop.vector_width, 0));
+    }
+    if (node->data.for_loop.interleave > 0) {
+        props[count++] = loop_hint(cg, "llvm.loop.interleave.count",
+                                   LLVMConstInt(i32, node->data.for_loop.interleave, 0));
+    }
+    
+    if (unroll > 0) {
+        props[count++] = loop_hint(cg, "llvm.loop.unroll.count", LLVMConstInt(i32, unroll, 0));
+    } else if (unroll == UNROLL_ON) {
+        props[count++] = loop_hint(cg, "llvm.loop.unroll.enable", LLVMConstInt(i1, 1, 0));
+    } else if (unroll != UNROLL_DEFAULT) {
+        const char *name = unroll == UNROLL_FULL ? "llvm.loop.unroll.full" : "llvm.loop.unroll.disable";
+        props[count++] = LLVMMDNodeInContext2(cg->context,
+            (LLVMMetadataRef[]){ LLVMMDStringInContext2(cg->context, name, strlen(name)) }, 1);
+    }
+    return count;
+}
+
+/*
+ * Serial counted loop over [start, end) in the current function.
+ * With a reduction, the body's final expression is folded into red.
+ */
+static void codegen_loop(CodeGen *cg, ASTNode *node, LLVMValueRef start, LLVMValueRef end,
+                         Reduction *red) {
+    LLVMValueRef func = LLVMGetBasicBlockParent(LLVMGetInsertBlock(cg->builder));
+    
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    LLVMBasicBlockRef preheader = LLVMGetInsertBlock(cg->builder);
+    LLVMBasicBlockRef loop_bb = LLVMAppendBasicBlockInContext(cg->context, func, "loop");
+    LLVMBasicBlockRef body_bb = LLVMAppendBasicBlockInContext(cg->context, func, "body");
+    LLVMBasicBlockRef after_bb = LLVMAppendBasicBlockInContext(cg->context, func, "after");
+    
+    LLVMBuildBr(cg->builder, loop_bb);
+    
+    /* Loop condition */
+    LLVMPositionBuilderAtEnd(cg->builder, loop_bb);
+    LLVMValueRef cur = LLVMBuildPhi(cg->builder, i64, node->data.for_loop.var);
+    LLVMValueRef cond = LLVMBuildICmp(cg->builder, LLVMIntSLT, cur, end, "loopcond");
+    LLVMBuildCondBr(cg->builder, cond, body_bb, after_bb);
     
     /* Loop body */
     LLVMPositionBuilderAtEnd(cg->builder, body_bb);
     
     Scope *loop_scope = scope_new(cg->current_scope);
-    scope_define(loop_scope, node->data.for_loop.var, loop_var, i64);
+    scope_define(loop_scope, node->data.for_loop.var, cur, NULL);
     Scope *prev_scope = cg->current_scope;
     cg->current_scope = loop_scope;
+    LLVMValueRef outer_region = region_begin(cg, node->data.for_loop.body);
+    unsigned saved_fast_math = cg->fast_math;
+    cg->fast_math |= node->data.for_loop.fast_math;
     
     /* Generate body statements */
     if (node->data.for_loop.body) {
-        for (size_t i = 0; i < node->data.for_loop.body->data.block.count; i++) {
-            codegen_stmt(cg, node->data.for_loop.body->data.block.stmts[i]);
+        size_t count = node->data.for_loop.body->data.block.count;
+        for (size_t i = 0; i < count; i++) {
+            ASTNode *stmt = node->data.for_loop.body->data.block.stmts[i];
+            if (red && i == count - 1) {
+                LLVMValueRef val = codegen_expr(cg, stmt);
+                if (val) reduce_accumulate(cg, red, val, expr_unsigned(stmt));
+                else fprintf(stderr, "E: reduce %s: loop body must end in an expression\n",
+                             node->data.for_loop.reduce_var);
+            } else {
+                codegen_stmt(cg, stmt);
+            }
         }
     }
     
+    cg->fast_math = saved_fast_math;
+    region_release(cg, outer_region);
+    cg->region = outer_region;
     cg->current_scope = prev_scope;
     scope_free(loop_scope);
     
-    /* Increment */
-    LLVMValueRef cur_val = LLVMBuildLoad2(cg->builder, i64, loop_var, "cur");
-    LLVMValueRef next = LLVMBuildAdd(cg->builder, cur_val, 
-        LLVMConstInt(i64, 1, 0), "next");
-    LLVMBuildStore(cg->builder, next, loop_var);
-    LLVMBuildBr(cg->builder, loop_bb);
+    /* Increment; cur < end, so it cannot overflow */
+    LLVMValueRef next = LLVMBuildNSWAdd(cg->builder, cur, LLVMConstInt(i64, 1, 0), "next");
+    LLVMBasicBlockRef latch = LLVMGetInsertBlock(cg->builder);
+    LLVMValueRef back = LLVMBuildBr(cg->builder, loop_bb);
+    
+    LLVMMetadataRef group = node->data.for_loop.parallel ? access_group(cg) : NULL;
+    if (group) tag_accesses(cg, body_bb, after_bb, group);
+    LLVMMetadataRef props[6];
+    unsigned count = loop_properties(cg, node, group, props);
+    if (count) set_loop_metadata(cg, back, loop_metadata(cg, props, count));
+    
+    LLVMValueRef incoming[] = { start, next };
+    LLVMBasicBlockRef from[] = { preheader, latch };
+    LLVMAddIncoming(cur, incoming, from, 2);
     
     LLVMPositionBuilderAtEnd(cg->builder, after_bb);
 }
 
+static void add_string_attribute(CodeGen *cg, LLVMValueRef fn, const char *key, const char *value) {
+    LLVMAddAttributeAtIndex(fn, LLVMAttributeFunctionIndex,
+        LLVMCreateStringAttribute(cg->context, key, strlen(key), value, strlen(value)));
+}
+
+/*
+ * Outline the loop into void body(i64 lo, i64 hi, ptr env), compiled for
+ * cpu/features when given. The chunk keeps a serial inner loop so LLVM can
+ * still vectorize it. With a reduction the chunk folds its partial into the
+ * worker's slot; red and initial describe it for the caller.
+ */
+static LLVMValueRef outline_loop(CodeGen *cg, ASTNode *node, CaptureList *caps, LLVMTypeRef env_type,
+                                 const char *cpu, const char *features,
+                                 Reduction *red_out, LLVMValueRef *initial_out) {
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    LLVMTypeRef ptr = LLVMPointerTypeInContext(cg->context, 0);
+    
+    LLVMTypeRef params[] = { i64, i64, ptr };
+    LLVMTypeRef body_type = LLVMFunctionType(LLVMVoidTypeInContext(cg->context), params, 3, 0);
+    LLVMValueRef body_fn = LLVMAddFunction(cg->module, "__lp_parallel_body", body_type);
+    LLVMSetLinkage(body_fn, LLVMInternalLinkage);
+    
+    unsigned noalias = LLVMGetEnumAttributeKindForName("noalias", 7);
+    LLVMAddAttributeAtIndex(body_fn, 3, LLVMCreateEnumAttribute(cg->context, noalias, 0));
+    if (cpu) add_string_attribute(cg, body_fn, "target-cpu", cpu);
+    if (features && *features) add_string_attribute(cg, body_fn, "target-features", features);
+    
+    LLVMBasicBlockRef saved_bb = LLVMGetInsertBlock(cg->builder);
+    Scope *saved_scope = cg->current_scope;
+    CoroState *saved_coro = cg->coro;
+    LLVMValueRef saved_region = cg->region;
+    cg->coro = NULL;
+    cg->region = NULL;
+    
+    LLVMBasicBlockRef entry = LLVMAppendBasicBlockInContext(cg->context, body_fn, "entry");
+    LLVMPositionBuilderAtEnd(cg->builder, entry);
+    
+    LLVMValueRef lo = LLVMGetParam(body_fn, 0);
+    LLVMValueRef hi = LLVMGetParam(body_fn, 1);
+    LLVMSetValueName2(lo, "lo", 2);
+    LLVMSetValueName2(hi, "hi", 2);
+    
+    cg->current_scope = bind_capture_env(cg, caps, env_type, LLVMGetParam(body_fn, 2));
+    
+    Reduction red = { node->data.for_loop.reduce_op, NULL, NULL, entry, 0 };
+    Reduction *redp = node->data.for_loop.reduce_var ? &red : NULL;
+    
+    /* An existing binding of the reduction variable fixes its type */
+    LLVMValueRef initial = NULL;
+    if (redp) {
+        red.is_unsigned = is_unsigned_type(node->resolved_type);
+        Scope *inner = cg->current_scope;
+        cg->current_scope = saved_scope;
+        LLVMPositionBuilderAtEnd(cg->builder, saved_bb);
+        initial = codegen_ident(cg, node->data.for_loop.reduce_var);
+        cg->current_scope = inner;
+        LLVMPositionBuilderAtEnd(cg->builder, entry);
+        if (initial) reduce_begin(cg, &red, LLVMTypeOf(initial));
+    }
+    
+    codegen_loop(cg, node, lo, hi, redp);
+    
+    /* Fold the chunk's partial into this worker's slot */
+    if (redp && red.type) {
+        LLVMValueRef slot_fn = get_reduce_slot_func(cg);
+        LLVMValueRef slot = LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(slot_fn),
+                                           slot_fn, NULL, 0, "slot");
+        LLVMValueRef part = LLVMBuildLoad2(cg->builder, red.type, red.acc, "partial");
+        LLVMValueRef prev = LLVMBuildLoad2(cg->builder, red.type, slot, "");
+        LLVMBuildStore(cg->builder, reduce_combine(cg, &red, prev, part), slot);
+    }
+    LLVMBuildRetVoid(cg->builder);
+    
+    scope_free(cg->current_scope);
+    cg->current_scope = saved_scope;
+    cg->coro = saved_coro;
+    cg->region = saved_region;
+    LLVMPositionBuilderAtEnd(cg->builder, saved_bb);
+    
+    *red_out = red;
+    *initial_out = initial;
+    return body_fn;
+}
+
+/* ISA levels a @multiversion loop is compiled for, indexed by __lp_cpu_level */
+static const char *const isa_levels[] = { NULL, NULL, "x86-64-v2", "x86-64-v3", "x86-64-v4" };
+#define ISA_LEVELS (sizeof(isa_levels) / sizeof(isa_levels[0]))
+
+/* Widest vector registers of each level, in bits */
+static const unsigned isa_level_bits[] = { 0, 128, 128, 256, 512 };
+
+/*
+ * A function name with the signature of the clones that tail-calls the
+ * clone for the level the runtime read from CPUID at startup. The baseline
+ * clone, clones[1], covers older CPUs.
+ */
+static LLVMValueRef level_dispatch(CodeGen *cg, const char *name, LLVMValueRef *clones) {
+    LLVMTypeRef i32 = LLVMInt32TypeInContext(cg->context);
+    LLVMTypeRef body_type = LLVMGlobalGetValueType(clones[1]);
+    LLVMValueRef level = LLVMGetNamedGlobal(cg->module, "__lp_cpu_level");
+    if (!level) level = LLVMAddGlobal(cg->module, i32, "__lp_cpu_level");
+    
+    LLVMValueRef dispatch = LLVMAddFunction(cg->module, name, body_type);
+    LLVMSetLinkage(dispatch, LLVMInternalLinkage);
+    LLVMValueRef args[] = { LLVMGetParam(dispatch, 0), LLVMGetParam(dispatch, 1), LLVMGetParam(dispatch, 2) };
+    
+    LLVMBasicBlockRef saved_bb = LLVMGetInsertBlock(cg->builder);
+    LLVMBasicBlockRef entry = LLVMAppendBasicBlockInContext(cg->context, dispatch, "entry");
+    LLVMBasicBlockRef blocks[ISA_LEVELS];
+    for (size_t i = 1; i < ISA_LEVELS; i++) {
+        blocks[i] = LLVMAppendBasicBlockInContext(cg->context, dispatch,
+                                                  isa_levels[i] ? isa_levels[i] : "baseline");
+        LLVMPositionBuilderAtEnd(cg->builder, blocks[i]);
+        LLVMValueRef call = LLVMBuildCall2(cg->builder, body_type, clones[i], args, 3, "");
+        LLVMSetTailCall(call, 1);
+        LLVMBuildRetVoid(cg->builder);
+    }
+    
+    LLVMPositionBuilderAtEnd(cg->builder, entry);
+    LLVMValueRef cur = LLVMBuildLoad2(cg->builder, i32, level, "level");
+    LLVMValueRef sw = LLVMBuildSwitch(cg->builder, cur, blocks[1], ISA_LEVELS - 2);
+    for (size_t i = 2; i < ISA_LEVELS; i++) LLVMAddCase(sw, LLVMConstInt(i32, i, 0), blocks[i]);
+    
+    LLVMPositionBuilderAtEnd(cg->builder, saved_bb);
+    return dispatch;
+}
+
+/*
+ * Only x86-64 builds for the generic CPU get clones; with --target-cpu, or
+ * inside a clone already, the loop is compiled once.
+ */
+static int multiversion_loop(CodeGen *cg, ASTNode *node) {
+    if (!node->data.for_loop.multiversion || cg->cpu) return 0;
+    if (strncmp(LLVMGetTarget(cg->module), "x86_64", 6) != 0) return 0;
+    
+    LLVMValueRef func = LLVMGetBasicBlockParent(LLVMGetInsertBlock(cg->builder));
+    return !LLVMGetStringAttributeAtIndex(func, LLVMAttributeFunctionIndex, "target-cpu", 10);
+}
+
+/* @multiversion: one clone of the chunk per ISA level plus a dispatcher */
+static LLVMValueRef outline_loop_versions(CodeGen *cg, ASTNode *node, CaptureList *caps,
+                                          LLVMTypeRef env_type, Reduction *red,
+                                          LLVMValueRef *initial) {
+    if (!multiversion_loop(cg, node)) {
+        return outline_loop(cg, node, caps, env_type, NULL, NULL, red, initial);
+    }
+    
+    /* --target-features still apply on top of each level */
+    const char *features = cg->features ? cg->features : "";
+    LLVMValueRef clones[ISA_LEVELS];
+    for (size_t i = 1; i < ISA_LEVELS; i++) {
+        clones[i] = outline_loop(cg, node, caps, env_type, isa_levels[i], features, red, initial);
+    }
+    
+    return level_dispatch(cg, "__lp_multiversion", clones);
+}
+
+/* Serial @multiversion for: outlined like a parallel chunk, called over the whole range */
+static void codegen_multiversion_for(CodeGen *cg, ASTNode *node, LLVMValueRef start, LLVMValueRef end) {
+    CaptureList caps = {0};
+    collect_captures(cg, node->data.for_loop.body, &caps);
+    
+    LLVMTypeRef env_type;
+    LLVMValueRef env = build_capture_env(cg, &caps, &env_type, 0);
+    
+    Reduction red;
+    LLVMValueRef initial;
+    LLVMValueRef body_fn = outline_loop_versions(cg, node, &caps, env_type, &red, &initial);
+    free(caps.names);
+    
+    LLVMValueRef args[] = { start, end, env };
+    LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(body_fn), body_fn, args, 3, "");
+}
+
+/*
+ * @parallel for: outline the loop and hand the range to the runtime
+ * work-stealing pool, which calls the chunk function on subranges.
+ */
+static void codegen_parallel_for(CodeGen *cg, ASTNode *node, LLVMValueRef start, LLVMValueRef end) {
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    
+    CaptureList caps = {0};
+    collect_captures(cg, node->data.for_loop.body, &caps);
+    
+    LLVMTypeRef env_type;
+    LLVMValueRef env = build_capture_env(cg, &caps, &env_type, 0);
+    
+    Reduction red;
+    LLVMValueRef initial;
+    LLVMValueRef body_fn = outline_loop_versions(cg, node, &caps, env_type, &red, &initial);
+    int reduces = node->data.for_loop.reduce_var != NULL;
+    free(caps.names);
+    
+    /* Hand off to the runtime */
+    LLVMValueRef schedule = LLVMConstInt(LLVMInt32TypeInContext(cg->context),
+                                         node->data.for_loop.schedule, 0);
+    LLVMValueRef chunk = LLVMConstInt(i64, node->data.for_loop.chunk, 0);
+    
+    if (!reduces) {
+        LLVMValueRef args[] = { start, end, body_fn, env, schedule, chunk };
+        LLVMValueRef par_fn = get_parallel_for_func(cg);
+        LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(par_fn), par_fn, args, 6, "");
+        return;
+    }
+    if (!red.type) return;
+    
+    LLVMValueRef result = build_entry_alloca(cg, red.type, node->data.for_loop.reduce_var);
+    LLVMValueRef identity = build_entry_alloca(cg, red.type, "identity");
+    LLVMBuildStore(cg->builder, initial ? initial : reduce_identity(red.op, red.type, red.is_unsigned),
+                   result);
+    LLVMBuildStore(cg->builder, reduce_identity(red.op, red.type, red.is_unsigned), identity);
+    
+    LLVMValueRef args[] = {
+        start, end, body_fn, env, schedule, chunk, result, identity,
+        LLVMSizeOf(red.type), build_reduce_combiner(cg, &red)
+    };
+    LLVMValueRef red_fn = get_parallel_reduce_func(cg);
+    LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(red_fn), red_fn, args, 10, "");
+    
+    /* The reduced value shadows any earlier binding; the loop carries its type */
+    LLVMValueRef reduced = LLVMBuildLoad2(cg->builder, red.type, result, node->data.for_loop.reduce_var);
+    Symbol *sym = scope_define(cg->current_scope, node->data.for_loop.reduce_var, reduced, NULL);
+    sym->ast_type = node->resolved_type;
+}
+
+static void codegen_for(CodeGen *cg, ASTNode *node) {
+    LLVMValueRef start = codegen_expr(cg, node->data.for_loop.start);
+    LLVMValueRef end = codegen_expr(cg, node->data.for_loop.end);
+    if (!start || !end) return;
+    
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    start = codegen_convert(cg, start, i64, expr_unsigned(node->data.for_loop.start));
+    end = codegen_convert(cg, end, i64, expr_unsigned(node->data.for_loop.end));
+#if LLVM_VERSION_MAJOR < 18
+    /* reassoc on a float reduction is honoured through the vectorize hint (loop_properties) */
+    unsigned honoured = reassoc_reduction(node) ? FM_REASSOC : 0;
+    fast_math_ignored(node, node->data.for_loop.fast_math & ~cg->fast_math & ~honoured,
+                      "@fastmath on a loop");
+#endif
+    
+    if (node->data.for_loop.parallel) {
+        codegen_parallel_for(cg, node, start, end);
+    } else if (multiversion_loop(cg, node)) {
+        codegen_multiversion_for(cg, node, start, end);
+    } else {
+        codegen_loop(cg, node, start, end, NULL);
+    }
+}
+
+/* ========== GPU Kernels (CPU SPMD) ========== */
+
+/*
+ * gpu kernel k(params) { body } compiles ISPC-style:
+ *   void k(i64 index, i64 count, params...)        one program instance (lane)
+ *   void __lp_gang.k(i64 lo, i64 hi, ptr env)      a gang of lanes
+ * The gang loop is vectorized to the host SIMD width so lanes map onto
+ * vector registers, and @launch(k, n, args...) spreads gangs over the
+ * worker pool. Inside the body, @index and @count give the lane's global
+ * index and the launch size.
+ */
+
+static unsigned feature_vector_bits(const char *features) {
+    if (strstr(features, "+avx512f")) return 512;
+    if (strstr(features, "+avx")) return 256;
+    return 128;
+}
+
+/*
+ * Widest SIMD register of the CPU kernels run on: the --target-cpu when one
+ * was given (0 if only its name is known), else the baseline 128 bits.
+ */
+static unsigned kernel_vector_bits(CodeGen *cg) {
+    if (cg->cpu) return cg->features ? feature_vector_bits(cg->features) : 0;
+    return 128;
+}
+
+/* Generic x86-64 builds get one gang per ISA level, like @multiversion */
+static int kernel_levels(CodeGen *cg) {
+    return !cg->cpu && strncmp(LLVMGetTarget(cg->module), "x86_64", 6) == 0;
+}
+
+/* Whether fn calls anything but intrinsics, a bounds failure included */
+static int calls_out(LLVMValueRef fn) {
+    for (LLVMBasicBlockRef bb = LLVMGetFirstBasicBlock(fn); bb; bb = LLVMGetNextBasicBlock(bb)) {
+        for (LLVMValueRef inst = LLVMGetFirstInstruction(bb); inst; inst = LLVMGetNextInstruction(inst)) {
+            if (!LLVMIsACallInst(inst)) continue;
+            LLVMValueRef callee = LLVMGetCalledValue(inst);
+            if (!LLVMIsAFunction(callee)) return 1;
+            if (!LLVMGetIntrinsicID(callee)) return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Gang function name(lo, hi, env) running lanes lo..hi-1 of lane_fn, where
+ * env holds { count, args... } as laid out by @launch. Compiled for cpu
+ * when given, with the loop sized to bits-wide vectors when known.
+ */
+static LLVMValueRef build_gang(CodeGen *cg, const char *name, LLVMValueRef lane_fn,
+                               LLVMTypeRef *params, size_t nparams, const char *cpu, unsigned bits) {
+    LLVMContextRef ctx = cg->context;
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(ctx);
+    LLVMTypeRef ptr = LLVMPointerTypeInContext(ctx, 0);
+    LLVMTypeRef void_type = LLVMVoidTypeInContext(ctx);
+    LLVMTypeRef lane_type = LLVMGlobalGetValueType(lane_fn);
+    
+    LLVMTypeRef env_type = LLVMStructTypeInContext(ctx, params + 1, nparams + 1, 0);
+    LLVMTypeRef gang_params[] = { i64, i64, ptr };
+    LLVMValueRef gang_fn = LLVMAddFunction(cg->module, name,
+                                           LLVMFunctionType(void_type, gang_params, 3, 0));
+    LLVMSetLinkage(gang_fn, LLVMInternalLinkage);
+    unsigned noalias = LLVMGetEnumAttributeKindForName("noalias", 7);
+    LLVMAddAttributeAtIndex(gang_fn, 3, LLVMCreateEnumAttribute(ctx, noalias, 0));
+    
+    /* --target-features still apply on top of a level */
+    if (cpu) {
+        add_string_attribute(cg, gang_fn, "target-cpu", cpu);
+        if (cg->features) add_string_attribute(cg, gang_fn, "target-features", cg->features);
+    }
+    if (bits) {
+        char width[16];
+        snprintf(width, sizeof(width), "%u", bits);
+        add_string_attribute(cg, gang_fn, "prefer-vector-width", width);
+    }
+    
+    LLVMBasicBlockRef saved_bb = LLVMGetInsertBlock(cg->builder);
+    LLVMBasicBlockRef entry = LLVMAppendBasicBlockInContext(ctx, gang_fn, "entry");
+    LLVMBasicBlockRef loop_bb = LLVMAppendBasicBlockInContext(ctx, gang_fn, "lane");
+    LLVMBasicBlockRef done_bb = LLVMAppendBasicBlockInContext(ctx, gang_fn, "done");
+    LLVMPositionBuilderAtEnd(cg->builder, entry);
+    
+    LLVMValueRef lo = LLVMGetParam(gang_fn, 0);
+    LLVMValueRef hi = LLVMGetParam(gang_fn, 1);
+    LLVMValueRef env = LLVMGetParam(gang_fn, 2);
+    LLVMValueRef *args = malloc(sizeof(LLVMValueRef) * (nparams + 2));
+    for (size_t i = 0; i < nparams + 1; i++) {
+        LLVMValueRef field = LLVMBuildStructGEP2(cg->builder, env_type, env, i, "");
+        args[i + 1] = LLVMBuildLoad2(cg->builder, params[i + 1], field, "");
+    }
+    LLVMBuildCondBr(cg->builder, LLVMBuildICmp(cg->builder, LLVMIntSLT, lo, hi, ""),
+                    loop_bb, done_bb);
+    
+    LLVMPositionBuilderAtEnd(cg->builder, loop_bb);
+    LLVMValueRef index = LLVMBuildPhi(cg->builder, i64, "index");
+    args[0] = index;
+    LLVMBuildCall2(cg->builder, lane_type, lane_fn, args, nparams + 2, "");
+    LLVMValueRef next = LLVMBuildNSWAdd(cg->builder, index, LLVMConstInt(i64, 1, 0), "next");
+    LLVMValueRef latch = LLVMBuildCondBr(cg->builder,
+        LLVMBuildICmp(cg->builder, LLVMIntSLT, next, hi, ""), loop_bb, done_bb);
+    LLVMValueRef in_vals[] = { lo, next };
+    LLVMBasicBlockRef in_bbs[] = { entry, loop_bb };
+    LLVMAddIncoming(index, in_vals, in_bbs, 2);
+    
+    /*
+     * Lanes are independent by construction. The width is only a hint, and
+     * only on lanes that can vectorize: a call or an early exit keeps the
+     * loop scalar, and a hint there would only make LLVM warn.
+     */
+    if (bits && !calls_out(lane_fn)) {
+        LLVMMetadataRef width = loop_hint(cg, "llvm.loop.vectorize.width",
+                                          LLVMConstInt(LLVMInt32TypeInContext(ctx), bits / 32, 0));
+        set_loop_metadata(cg, latch, loop_metadata(cg, &width, 1));
+    }
+    
+    LLVMPositionBuilderAtEnd(cg->builder, done_bb);
+    LLVMBuildRetVoid(cg->builder);
+    free(args);
+    LLVMPositionBuilderAtEnd(cg->builder, saved_bb);
+    return gang_fn;
+}
+
+static void codegen_gpu_kernel(CodeGen *cg, ASTNode *node) {
+    LLVMContextRef ctx = cg->context;
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(ctx);
+    LLVMTypeRef void_type = LLVMVoidTypeInContext(ctx);
+    const char *name = node->data.gpu_kernel.name;
+    size_t nparams = node->data.gpu_kernel.param_count;
+    
+    if (LLVMGetNamedFunction(cg->module, name)) {
+        fprintf(stderr, "E: %u:%u: kernel '%s' is already defined\n", node->line, node->col, name);
+        return;
+    }
+    
+    /* Lane function: index and count come first */
+    LLVMTypeRef *params = malloc(sizeof(LLVMTypeRef) * (nparams + 2));
+    params[0] = i64;
+    params[1] = i64;
+    for (size_t i = 0; i < nparams; i++)
+        params[i + 2] = get_llvm_type(cg, node->data.gpu_kernel.param_types[i]);
+    
+    LLVMTypeRef lane_type = LLVMFunctionType(void_type, params, nparams + 2, 0);
+    LLVMValueRef lane_fn = LLVMAddFunction(cg->module, name, lane_type);
+    LLVMSetLinkage(lane_fn, LLVMInternalLinkage);
+    unsigned always_inline = LLVMGetEnumAttributeKindForName("alwaysinline", 12);
+    LLVMAddAttributeAtIndex(lane_fn, LLVMAttributeFunctionIndex,
+                            LLVMCreateEnumAttribute(ctx, always_inline, 0));
+    
+    LLVMBasicBlockRef saved_bb = LLVMGetInsertBlock(cg->builder);
+    Scope *saved_scope = cg->current_scope;
+    CoroState *saved_coro = cg->coro;
+    LLVMValueRef saved_region = cg->region;
+    cg->coro = NULL;
+    cg->region = NULL;
+    
+    LLVMPositionBuilderAtEnd(cg->builder, LLVMAppendBasicBlockInContext(ctx, lane_fn, "entry"));
+    cg->current_scope = scope_new(NULL);
+    scope_define(cg->current_scope, "@index", LLVMGetParam(lane_fn, 0), NULL);
+    scope_define(cg->current_scope, "@count", LLVMGetParam(lane_fn, 1), NULL);
+    for (size_t i = 0; i < nparams; i++) {
+        LLVMValueRef param = LLVMGetParam(lane_fn, i + 2);
+        const char *pname = node->data.gpu_kernel.params[i];
+        LLVMSetValueName2(param, pname, strlen(pname));
+        scope_define(cg->current_scope, pname, param, NULL)->ast_type =
+            node->data.gpu_kernel.param_types[i];
+    }
+    region_begin(cg, node->data.gpu_kernel.body);
+    codegen_block(cg, node->data.gpu_kernel.body);
+    region_release(cg, NULL);
+    LLVMBuildRetVoid(cg->builder);
+    scope_free(cg->current_scope);
+    
+    /* Gangs fill the widest registers of the CPU they run on */
+    size_t gang_len = strlen(name) + 32;
+    char *gang_name = malloc(gang_len);
+    snprintf(gang_name, gang_len, "__lp_gang.%s", name);
+    if (kernel_levels(cg)) {
+        LLVMValueRef clones[ISA_LEVELS];
+        char *clone_name = malloc(gang_len + 8);
+        for (size_t i = 1; i < ISA_LEVELS; i++) {
+            snprintf(clone_name, gang_len + 8, "%s.%zu", gang_name, i);
+            clones[i] = build_gang(cg, clone_name, lane_fn, params, nparams,
+                                   isa_levels[i], isa_level_bits[i]);
+        }
+        free(clone_name);
+        level_dispatch(cg, gang_name, clones);
+    } else {
+        build_gang(cg, gang_name, lane_fn, params, nparams, NULL, kernel_vector_bits(cg));
+    }
+    free(gang_name);
+    
+    free(params);
+    cg->current_scope = saved_scope;
+    cg->coro = saved_coro;
+    cg->region = saved_region;
+    LLVMPositionBuilderAtEnd(cg->builder, saved_bb);
+}
+
+/* @launch(kernel, n, args...): run lanes 0..n-1 in gangs on the pool */
+static LLVMValueRef codegen_launch(CodeGen *cg, ASTNode *node) {
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    ASTNode **elems = node->data.builtin.elements;
+    size_t count = node->data.builtin.count;
+    
+    if (count < 2 || elems[0]->type != NODE_IDENT) {
+        fprintf(stderr, "E: %u:%u: usage: @launch(kernel, n, args...)\n", node->line, node->col);
+        return NULL;
+    }
+    
+    const char *name = elems[0]->data.ident.name;
+    size_t gang_len = strlen(name) + 16;
+    char *gang_name = malloc(gang_len);
+    snprintf(gang_name, gang_len, "__lp_gang.%s", name);
+    LLVMValueRef gang_fn = LLVMGetNamedFunction(cg->module, gang_name);
+    free(gang_name);
+    if (!gang_fn) {
+        fprintf(stderr, "E: %u:%u: '%s' is not a kernel\n", node->line, node->col, name);
+        return NULL;
+    }
+    
+    LLVMValueRef lane_fn = LLVMGetNamedFunction(cg->module, name);
+    LLVMTypeRef lane_type = LLVMGlobalGetValueType(lane_fn);
+    unsigned nparams = LLVMCountParamTypes(lane_type);
+    if (count != nparams) {
+        fprintf(stderr, "E: %u:%u: kernel '%s' takes %u arguments, got %zu\n",
+                node->line, node->col, name, nparams - 2, count - 2);
+        return NULL;
+    }
+    
+    LLVMTypeRef *params = malloc(sizeof(LLVMTypeRef) * nparams);
+    LLVMGetParamTypes(lane_type, params);
+    LLVMTypeRef env_type = LLVMStructTypeInContext(cg->context, params + 1, nparams - 1, 0);
+    
+    LLVMValueRef n = NULL;
+    LLVMValueRef env = build_entry_alloca(cg, env_type, "launch");
+    for (size_t i = 1; i < count; i++) {
+        LLVMValueRef val = codegen_expr(cg, elems[i]);
+        if (!val) {
+            free(params);
+            return NULL;
+        }
+        val = codegen_convert(cg, val, params[i], expr_unsigned(elems[i]));
+        if (i == 1) n = val;
+        LLVMBuildStore(cg->builder, val, LLVMBuildStructGEP2(cg->builder, env_type, env, i - 1, ""));
+    }
+    free(params);
+    
+    /* Grain of several full vectors per gang, at the widest level when dispatched */
+    unsigned bits = kernel_levels(cg) ? isa_level_bits[ISA_LEVELS - 1] : kernel_vector_bits(cg);
+    unsigned lanes = (bits ? bits : 128) / 32;
+    
+    LLVMValueRef args[] = {
+        LLVMConstInt(i64, 0, 0), n, gang_fn, env,
+        LLVMConstInt(LLVMInt32TypeInContext(cg->context), SCHED_STEAL, 0),
+        LLVMConstInt(i64, lanes * 16, 0)
+    };
+    LLVMValueRef par_fn = get_parallel_for_func(cg);
+    LLVMBuildCall2(cg->builder, LLVMGlobalGetValueType(par_fn), par_fn, args, 6, "");
+    return NULL;
+}
+
 static void codegen_block(CodeGen *cg, ASTNode *node) {
     Scope *block_scope = scope_new(cg->current_scope);
     Scope *prev = cg->current_scope;
@@ -539,6 +3478,9 @@ static void codegen_stmt(CodeGen *cg, ASTNode *node) {
         case NODE_BLOCK:
             codegen_block(cg, node);
             break;
+        case NODE_GPU_KERNEL:
+            codegen_gpu_kernel(cg, node);
+            break;
         case NODE_BUILTIN:
             codegen_builtin(cg, node);
             break;
@@ -550,7 +3492,38 @@ static void codegen_stmt(CodeGen *cg, ASTNode *node) {
 
 /* ========== Public API ========== */
 
-void codegen_init(CodeGen *cg, const char *target_triple, int opt_level) {
+#if LLVM_VERSION_MAJOR < 18
+/* -ffast-math as the function attributes older LLVMs read instead of instruction flags */
+static void fast_math_attributes(CodeGen *cg) {
+    static const struct { unsigned flag; const char *attr; } attrs[] = {
+        { FM_REASSOC, "unsafe-fp-math" }, { FM_NNAN, "no-nans-fp-math" },
+        { FM_NINF, "no-infs-fp-math" }, { FM_NSZ, "no-signed-zeros-fp-math" },
+        { FM_AFN, "approx-func-fp-math" }
+    };
+    for (LLVMValueRef fn = LLVMGetFirstFunction(cg->module); fn; fn = LLVMGetNextFunction(fn)) {
+        if (LLVMIsDeclaration(fn)) continue;
+        for (size_t i = 0; i < sizeof(attrs) / sizeof(attrs[0]); i++) {
+            if (cg->fast_math & attrs[i].flag) {
+                add_string_attribute(cg, fn, attrs[i].attr, "true");
+            }
+        }
+    }
+}
+#endif
+
+/* glibc's libmvec has vector sin, exp, pow, ... on x86-64 Linux */
+static int has_libmvec(const char *triple) {
+    return strncmp(triple, "x86_64", 6) == 0 && strstr(triple, "linux-gnu") != NULL;
+}
+
+static LLVMCodeGenOptLevel codegen_level(int opt_level) {
+    return opt_level >= 3 ? LLVMCodeGenLevelAggressive :
+           opt_level >= 2 ? LLVMCodeGenLevelDefault :
+           opt_level >= 1 ? LLVMCodeGenLevelLess : LLVMCodeGenLevelNone;
+}
+
+void codegen_init(CodeGen *cg, const char *target_triple, const char *cpu, const char *features,
+                  unsigned fast_math, int opt_level) {
     LLVMInitializeAllTargetInfos();
     LLVMInitializeAllTargets();
     LLVMInitializeAllTargetMCs();
@@ -561,12 +3534,53 @@ void codegen_init(CodeGen *cg, const char *target_triple, int opt_level) {
     cg->module = LLVMModuleCreateWithNameInContext("lambda_photon", cg->context);
     cg->builder = LLVMCreateBuilderInContext(cg->context);
     cg->current_scope = scope_new(NULL);
+    cg->coro = NULL;
+    cg->tail = NULL;
+    cg->region = NULL;
+    cg->has_coroutines = 0;
     cg->opt_level = opt_level;
+    cg->cpu = NULL;
+    cg->features = NULL;
+    cg->fast_math = fast_math;
+    cg->target_machine = NULL;
+#if LLVM_VERSION_MAJOR < 18
+    /* No function attribute stands in for these */
+    fast_math_ignored(NULL, fast_math & (FM_CONTRACT | FM_ARCP), "-ffast-math");
+#endif
     
     /* Set target triple */
     char *triple = target_triple ?  strdup(target_triple) : LLVMGetDefaultTargetTriple();
     LLVMSetTarget(cg->module, triple);
     
+    /* The vectorizer maps math calls to libmvec through the library info of the triple */
+    static int veclib_set;
+    if (has_libmvec(triple) && !veclib_set) {
+        const char *args[] = { "photon", "-vector-library=LIBMVEC-X86" };
+        LLVMParseCommandLineOptions(2, args, NULL);
+        veclib_set = 1;
+    }
+    
+    /* native means the host CPU and everything it supports, plus any features given */
+    if (cpu && strcmp(cpu, "native") == 0) {
+        char *host = LLVMGetDefaultTargetTriple();
+        if (strcmp(triple, host) != 0) {
+            fprintf(stderr, "E: --target-cpu=native needs the host target, compiling for generic\n");
+        } else {
+            char *name = LLVMGetHostCPUName();
+            char *host_features = LLVMGetHostCPUFeatures();
+            size_t len = strlen(host_features) + (features ? strlen(features) + 1 : 0) + 1;
+            cg->cpu = strdup(name);
+            cg->features = malloc(len);
+            snprintf(cg->features, len, "%s%s%s", host_features, features ? "," : "", features ? features : "");
+            LLVMDisposeMessage(name);
+            LLVMDisposeMessage(host_features);
+        }
+        LLVMDisposeMessage(host);
+    } else {
+        if (cpu && strcmp(cpu, "generic") != 0) cg->cpu = strdup(cpu);
+        if (features && *features) cg->features = strdup(features);
+    }
+    
     char *error = NULL;
     LLVMTargetRef target;
     if (LLVMGetTargetFromTriple(triple, &target, &error) != 0) {
@@ -577,18 +3591,80 @@ void codegen_init(CodeGen *cg, const char *target_triple, int opt_level) {
     }
     
     cg->target_machine = LLVMCreateTargetMachine(
-        target, triple, "generic", "",
-        opt_level >= 3 ? LLVMCodeGenLevelAggressive :
-        opt_level >= 2 ?  LLVMCodeGenLevelDefault :
-        opt_level >= 1 ? LLVMCodeGenLevelLess : LLVMCodeGenLevelNone,
+        target, triple, cg->cpu ? cg->cpu : "generic", cg->features ? cg->features : "",
+        codegen_level(opt_level),
         LLVMRelocDefault,
         LLVMCodeModelDefault
     );
     
+    /* Sizes of array elements come from the target's layout */
+    LLVMTargetDataRef layout = LLVMCreateTargetDataLayout(cg->target_machine);
+    LLVMSetModuleDataLayout(cg->module, layout);
+    LLVMDisposeTargetData(layout);
+    
     free(triple);
 }
 
-char *codegen_emit(CodeGen *cg, ASTNode *ast) {
+/* Triples name the same architecture */
+static int same_arch(const char *a, const char *b) {
+    size_t len = strcspn(a, "-");
+    return len == strcspn(b, "-") && strncmp(a, b, len) == 0;
+}
+
+/*
+ * Link the runtime bitcode into the module, then make everything but main
+ * internal: runtime entry points can inline into the loops that call them
+ * and whatever the program does not use is dropped. Without the bitcode
+ * (or when cross-compiling) the archive supplies the runtime at link time.
+ */
+static void link_runtime(CodeGen *cg) {
+    LLVMMemoryBufferRef buf;
+    char *error = NULL;
+    if (LLVMCreateMemoryBufferWithContentsOfFile(LP_RUNTIME_BC, &buf, &error) != 0) {
+        LLVMDisposeMessage(error);
+        return;
+    }
+    LLVMModuleRef rt;
+    int failed = LLVMParseBitcodeInContext2(cg->context, buf, &rt);
+    LLVMDisposeMemoryBuffer(buf);
+    if (failed) return;
+    if (!same_arch(LLVMGetTarget(rt), LLVMGetTarget(cg->module))) {
+        LLVMDisposeModule(rt);
+        return;
+    }
+    
+    /* Compiled for the program's target and CPU, not the build host's */
+    LLVMSetTarget(rt, LLVMGetTarget(cg->module));
+    LLVMSetDataLayout(rt, LLVMGetDataLayoutStr(cg->module));
+    static const char *host_attrs[] = { "target-cpu", "target-features", "tune-cpu" };
+    for (LLVMValueRef fn = LLVMGetFirstFunction(rt); fn; fn = LLVMGetNextFunction(fn)) {
+        for (size_t i = 0; i < sizeof(host_attrs) / sizeof(host_attrs[0]); i++) {
+            LLVMRemoveStringAttributeAtIndex(fn, LLVMAttributeFunctionIndex,
+                                             host_attrs[i], strlen(host_attrs[i]));
+        }
+    }
+    if (LLVMLinkModules2(cg->module, rt) != 0) {
+        fprintf(stderr, "E: cannot link runtime %s\n", LP_RUNTIME_BC);
+        return;
+    }
+    
+    for (LLVMValueRef fn = LLVMGetFirstFunction(cg->module); fn; fn = LLVMGetNextFunction(fn)) {
+        if (!LLVMIsDeclaration(fn) && LLVMGetLinkage(fn) == LLVMExternalLinkage &&
+            strcmp(LLVMGetValueName(fn), "main") != 0) {
+            LLVMSetLinkage(fn, LLVMInternalLinkage);
+        }
+    }
+    for (LLVMValueRef g = LLVMGetFirstGlobal(cg->module); g; g = LLVMGetNextGlobal(g)) {
+        if (!LLVMIsDeclaration(g) && LLVMGetLinkage(g) == LLVMExternalLinkage) {
+            LLVMSetLinkage(g, LLVMInternalLinkage);
+        }
+    }
+}
+
+/* Build main from the program and verify the module */
+static void generate(CodeGen *cg, ASTNode *ast) {
+    analyze_escapes(ast);
+    
     /* Create main function */
     LLVMTypeRef main_type = LLVMFunctionType(
         LLVMInt32TypeInContext(cg->context), NULL, 0, 0);
@@ -609,15 +3685,31 @@ char *codegen_emit(CodeGen *cg, ASTNode *ast) {
     LLVMBuildRet(cg->builder, 
         LLVMConstInt(LLVMInt32TypeInContext(cg->context), 0, 0));
     
+#if LLVM_VERSION_MAJOR < 18
+    if (cg->fast_math) fast_math_attributes(cg);
+#endif
+    
     /* Verify module */
     char *error = NULL;
     if (LLVMVerifyModule(cg->module, LLVMReturnStatusAction, &error) != 0) {
         fprintf(stderr, "E: %s\n", error);
         LLVMDisposeMessage(error);
     }
+}
+
+/* The default<On> pipeline, after linking in the runtime bitcode when with_runtime */
+static void optimize_module(CodeGen *cg, int with_runtime) {
+    /* Coroutines must be split even when not optimizing */
+    if (cg->opt_level == 0 && cg->has_coroutines) {
+        LLVMPassBuilderOptionsRef opts = LLVMCreatePassBuilderOptions();
+        LLVMRunPasses(cg->module, "default<O0>", cg->target_machine, opts);
+        LLVMDisposePassBuilderOptions(opts);
+    }
     
     /* Run LLVM optimization passes */
     if (cg->opt_level > 0) {
+        if (with_runtime) link_runtime(cg);
+        
         const char *passes;
         switch (cg->opt_level) {
             case 1:  passes = "default<O1>"; break;
@@ -633,38 +3725,277 @@ char *codegen_emit(CodeGen *cg, ASTNode *ast) {
         LLVMRunPasses(cg->module, passes, cg->target_machine, opts);
         LLVMDisposePassBuilderOptions(opts);
     }
-    
+}
+
+char *codegen_emit(CodeGen *cg, ASTNode *ast) {
+    generate(cg, ast);
+    optimize_module(cg, 1);
     return LLVMPrintModuleToString(cg->module);
 }
 
+/*
+ * Object code for the linker without a trip through the disk: an anonymous
+ * in-memory file, named by its /proc path, that the linker inherits. Returns
+ * the descriptor, or -1 where there is none (path is then untouched).
+ */
+static int object_memfd(LLVMMemoryBufferRef obj, char *path, size_t size) {
+#ifdef __linux__
+    int fd = memfd_create("photon.o", 0);
+    if (fd < 0) return -1;
+    
+    const char *data = LLVMGetBufferStart(obj);
+    size_t left = LLVMGetBufferSize(obj);
+    while (left > 0) {
+        ssize_t n = write(fd, data, left);
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        data += n;
+        left -= (size_t)n;
+    }
+    snprintf(path, size, "/proc/self/fd/%d", fd);
+    return fd;
+#else
+    (void)obj; (void)path; (void)size;
+    return -1;
+#endif
+}
+
+/* Fallback: <output>.o next to the output */
+static int object_file(LLVMMemoryBufferRef obj, const char *output_file, char *path, size_t size) {
+    snprintf(path, size, "%s.o", output_file);
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "E: cannot write %s\n", path);
+        return 1;
+    }
+    size_t len = LLVMGetBufferSize(obj);
+    int ok = fwrite(LLVMGetBufferStart(obj), 1, len, f) == len;
+    if (fclose(f) != 0) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "E: cannot write %s\n", path);
+        remove(path);
+    }
+    return !ok;
+}
+
+/*
+ * The C compiler driver ($LP_LINKER, default clang) links the object with
+ * the runtime and libc; it is spawned directly, with no shell in between.
+ * Linking in-process is out of scope: lld has only a C++ entry point, is
+ * not part of the LLVM this builds against, and the crt start files and
+ * libc search paths it would need are what the driver works out.
+ */
+static int link_program(CodeGen *cg, const char *obj_file, const char *output_file) {
+    const char *opt_flag = cg->opt_level >= 3 ? "-O3" :
+                           cg->opt_level >= 2 ? "-O2" :
+                           cg->opt_level >= 1 ? "-O1" : "-O0";
+    const char *argv[12];
+    int argc = 0;
+    const char *linker = getenv("LP_LINKER");
+    argv[argc++] = linker && *linker ? linker : "clang";
+    argv[argc++] = opt_flag;
+    argv[argc++] = obj_file;
+    argv[argc++] = LP_RUNTIME_LIB;
+    if (has_libmvec(LLVMGetTarget(cg->module))) argv[argc++] = "-lmvec";
+    argv[argc++] = "-lm";
+    argv[argc++] = "-lpthread";
+    argv[argc++] = "-o";
+    argv[argc++] = output_file;
+    argv[argc] = NULL;
+    
+    pid_t pid;
+    int err = posix_spawnp(&pid, argv[0], NULL, NULL, (char *const *)argv, environ);
+    if (err != 0) {
+        fprintf(stderr, "E: cannot run %s to link: %s (install clang, or set LP_LINKER to a C compiler)\n",
+                argv[0], strerror(err));
+        return 1;
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return 1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
 int codegen_compile(CodeGen *cg, const char *output_file) {
     char *error = NULL;
     
-    /* Emit object file */
-    char obj_file[256];
-    snprintf(obj_file, sizeof(obj_file), "%s.o", output_file);
-    
-    if (LLVMTargetMachineEmitToFile(cg->target_machine, cg->module, 
-                                     obj_file, LLVMObjectFile, &error) != 0) {
+    /* Emit object code into memory */
+    LLVMMemoryBufferRef obj;
+    if (LLVMTargetMachineEmitToMemoryBuffer(cg->target_machine, cg->module,
+                                            LLVMObjectFile, &error, &obj) != 0) {
         fprintf(stderr, "E: %s\n", error);
         LLVMDisposeMessage(error);
         return 1;
     }
     
-    /* Link with system linker - pass optimization flags */
-    char cmd[512];
-    const char *opt_flag = cg->opt_level >= 3 ? "-O3" :
-                           cg->opt_level >= 2 ? "-O2" :
-                           cg->opt_level >= 1 ? "-O1" : "-O0";
-    snprintf(cmd, sizeof(cmd), "clang %s \"%s\" -o \"%s\"", opt_flag, obj_file, output_file);
-    int result = system(cmd);
+    char obj_file[PATH_MAX];
+    int fd = object_memfd(obj, obj_file, sizeof(obj_file));
+    int failed = fd < 0 && object_file(obj, output_file, obj_file, sizeof(obj_file));
+    LLVMDisposeMemoryBuffer(obj);
+    if (failed) return 1;
+    
+    int result = link_program(cg, obj_file, output_file);
     
-    /* Cleanup obj file */
-    remove(obj_file);
+    /* Cleanup object */
+    if (fd >= 0) close(fd);
+    else remove(obj_file);
     
     return result;
 }
 
+/* ========== JIT ========== */
+
+/* FNV-1a, continued from h */
+static uint64_t hash_bytes(uint64_t h, const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+/* LP_RUNTIME_ABI in runtime/runtime.h */
+#define RUNTIME_ABI 1
+
+/*
+ * Cache file for the object code of the unoptimized module: the hash covers
+ * the IR, the compiler and runtime it was built for, and everything else
+ * that shapes the machine code. Returns 0 when
+ * there is no cache directory ($LP_CACHE_DIR, else $XDG_CACHE_HOME/photon,
+ * else ~/.cache/photon).
+ */
+static int cache_path(CodeGen *cg, char *path, size_t size) {
+    char dir[PATH_MAX];
+    const char *env;
+    if ((env = getenv("LP_CACHE_DIR")) && *env) {
+        snprintf(dir, sizeof(dir), "%s", env);
+    } else if ((env = getenv("XDG_CACHE_HOME")) && *env) {
+        snprintf(dir, sizeof(dir), "%s/photon", env);
+    } else if ((env = getenv("HOME")) && *env) {
+        snprintf(dir, sizeof(dir), "%s/.cache", env);
+        mkdir(dir, 0755);
+        snprintf(dir, sizeof(dir), "%s/.cache/photon", env);
+    } else {
+        return 0;
+    }
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) return 0;
+    
+    /* Cached code calls into this process's runtime, so both versions count */
+    char key[512];
+    snprintf(key, sizeof(key), "%s %d %s %d %s %s %s", VERSION, RUNTIME_ABI, LLVM_VERSION_STRING,
+             cg->opt_level, LLVMGetTarget(cg->module),
+             cg->cpu ? cg->cpu : "generic", cg->features ? cg->features : "");
+    char *ir = LLVMPrintModuleToString(cg->module);
+    uint64_t h = hash_bytes(0xcbf29ce484222325ull, key, strlen(key));
+    h = hash_bytes(h, ir, strlen(ir));
+    LLVMDisposeMessage(ir);
+    
+    return snprintf(path, size, "%s/%016llx.o", dir, (unsigned long long)h) < (int)size;
+}
+
+/* Written under a private name, then renamed, so readers never see half a file */
+static void cache_store(LLVMMemoryBufferRef obj, const char *path) {
+    char tmp[PATH_MAX + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return;
+    size_t len = LLVMGetBufferSize(obj);
+    int ok = fwrite(LLVMGetBufferStart(obj), 1, len, f) == len;
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || rename(tmp, path) != 0) remove(tmp);
+}
+
+static int jit_error(LLVMErrorRef err) {
+    char *msg = LLVMGetErrorMessage(err);
+    fprintf(stderr, "E: jit: %s\n", msg);
+    LLVMDisposeErrorMessage(msg);
+    return 1;
+}
+
+/* Position-independent object code for the module, as the JIT loads it */
+static int emit_jit_object(CodeGen *cg, LLVMMemoryBufferRef *obj) {
+    char *triple = LLVMGetTargetMachineTriple(cg->target_machine);
+    LLVMTargetMachineRef tm = LLVMCreateTargetMachine(
+        LLVMGetTargetMachineTarget(cg->target_machine), triple,
+        cg->cpu ? cg->cpu : "generic", cg->features ? cg->features : "",
+        codegen_level(cg->opt_level), LLVMRelocPIC, LLVMCodeModelDefault);
+    LLVMDisposeMessage(triple);
+    
+    char *error = NULL;
+    int failed = LLVMTargetMachineEmitToMemoryBuffer(tm, cg->module, LLVMObjectFile, &error, obj);
+    if (failed) {
+        fprintf(stderr, "E: %s\n", error);
+        LLVMDisposeMessage(error);
+    }
+    LLVMDisposeTargetMachine(tm);
+    return failed;
+}
+
+int codegen_run(CodeGen *cg, ASTNode *ast) {
+    char *host = LLVMGetDefaultTargetTriple();
+    int foreign = strcmp(LLVMGetTarget(cg->module), host) != 0;
+    LLVMDisposeMessage(host);
+    if (foreign) {
+        fprintf(stderr, "E: run needs the host target\n");
+        return 1;
+    }
+    
+    generate(cg, ast);
+    
+    /* A cached object skips optimization and code generation */
+    char path[PATH_MAX];
+    int cached = cache_path(cg, path, sizeof(path));
+    LLVMMemoryBufferRef obj = NULL;
+    char *error = NULL;
+    if (!cached || LLVMCreateMemoryBufferWithContentsOfFile(path, &obj, &error) != 0) {
+        LLVMDisposeMessage(error);
+        obj = NULL;
+    }
+    if (!obj) {
+        /* The runtime is not linked in: the JIT resolves it from this process */
+        optimize_module(cg, 0);
+        if (emit_jit_object(cg, &obj) != 0) return 1;
+        if (cached) cache_store(obj, path);
+    }
+    
+    /* glibc's vector math functions are not in the compiler's own image */
+    if (has_libmvec(LLVMGetTarget(cg->module))) dlopen("libmvec.so.1", RTLD_NOW | RTLD_GLOBAL);
+    
+    LLVMOrcLLJITRef jit;
+    LLVMErrorRef err = LLVMOrcCreateLLJIT(&jit, NULL);
+    if (err) {
+        LLVMDisposeMemoryBuffer(obj);
+        return jit_error(err);
+    }
+    LLVMOrcJITDylibRef dylib = LLVMOrcLLJITGetMainJITDylib(jit);
+    LLVMOrcDefinitionGeneratorRef process;
+    err = LLVMOrcCreateDynamicLibrarySearchGeneratorForProcess(
+        &process, LLVMOrcLLJITGetGlobalPrefix(jit), NULL, NULL);
+    if (!err) {
+        LLVMOrcJITDylibAddGenerator(dylib, process);
+        err = LLVMOrcLLJITAddObjectFile(jit, dylib, obj);
+    } else {
+        LLVMDisposeMemoryBuffer(obj);
+    }
+    
+    LLVMOrcExecutorAddress entry = 0;
+    if (!err) err = LLVMOrcLLJITLookup(jit, &entry, "main");
+    if (err) {
+        jit_error(err);
+        LLVMOrcDisposeLLJIT(jit);
+        return 1;
+    }
+    
+    int status = ((int (*)(void))(uintptr_t)entry)();
+    
+    err = LLVMOrcDisposeLLJIT(jit);
+    if (err) jit_error(err);
+    return status;
+}
+
 void codegen_cleanup(CodeGen *cg) {
     scope_free(cg->current_scope);
     LLVMDisposeBuilder(cg->builder);
@@ -673,4 +4004,6 @@ void codegen_cleanup(CodeGen *cg) {
     if (cg->target_machine) {
         LLVMDisposeTargetMachine(cg->target_machine);
     }
+    free(cg->cpu);
+    free(cg->features);
 }
\ No newline at end of file
@@ -8,10 +8,15 @@
 #include <llvm-c/Analysis.h>
 #include <llvm-c/Transforms/PassBuilder.h>
 
-typedef struct {
+/* Compiler version; photon run's object cache is keyed by it */
+#define VERSION "0.2.0-alpha"
+
+typedef struct Symbol {
     char *name;
     LLVMValueRef value;
-    LLVMTypeRef type;
+    LLVMTypeRef type;      /* slot type if value is a stack slot, NULL for SSA values */
+    Type *ast_type;        /* source-level type when codegen needs it (tasks), may be NULL */
+    LLVMValueRef func;     /* lifted function when the value is a known lambda, else NULL */
     struct Symbol *next;
 } Symbol;
 
@@ -20,18 +25,40 @@ typedef struct Scope {
     struct Scope *parent;
 } Scope;
 
+struct CoroState;
+struct TailState;
+
 typedef struct {
     LLVMContextRef context;
     LLVMModuleRef module;
     LLVMBuilderRef builder;
     LLVMTargetMachineRef target_machine;
     Scope *current_scope;
+    struct CoroState *coro;  /* enclosing async coroutine, NULL in plain functions */
+    struct TailState *tail;  /* enclosing lambda, NULL outside lambdas */
+    LLVMValueRef region;     /* arena mark of the innermost region in this function, or NULL */
+    int has_coroutines;
     int opt_level;
+    char *cpu;               /* --target-cpu, resolved for native; NULL for generic */
+    char *features;          /* --target-features (with the host's for native), or NULL */
+    unsigned fast_math;      /* FastMath flags for float instructions built now */
 } CodeGen;
 
-void codegen_init(CodeGen *cg, const char *target_triple, int opt_level);
+/*
+ * cpu may be "native"; NULL cpu and features compile for the generic CPU of
+ * the triple. fast_math holds the FastMath flags of -ffast-math.
+ */
+void codegen_init(CodeGen *cg, const char *target_triple, const char *cpu, const char *features,
+                  unsigned fast_math, int opt_level);
 char *codegen_emit(CodeGen *cg, ASTNode *ast);
 int codegen_compile(CodeGen *cg, const char *output_file);
+
+/*
+ * Compile the program in memory and call its main instead of emitting it;
+ * returns main's result. Object code is cached by module
+ * hash, so an unchanged program skips optimization on the next run.
+ */
+int codegen_run(CodeGen *cg, ASTNode *ast);
 void codegen_cleanup(CodeGen *cg);
 
 #endif
\ No newline at end of file
@@ -90,6 +90,7 @@ static TokenType identifier_type(Lexer *l) {
     if (len == 2) {
         if (memcmp(l->start, "i8", 2) == 0) return TOK_TYPE_I8;
         if (memcmp(l->start, "u8", 2) == 0) return TOK_TYPE_U8;
+        if (memcmp(l->start, "if", 2) == 0) return TOK_IF;
     } else if (len == 3) {
         if (memcmp(l->start, "i16", 3) == 0) return TOK_TYPE_I16;
         if (memcmp(l->start, "i32", 3) == 0) return TOK_TYPE_I32;
@@ -106,6 +107,8 @@ static TokenType identifier_type(Lexer *l) {
         if (memcmp(l->start, "let", 3) == 0) return TOK_LET;
     } else if (len == 4) {
         if (memcmp(l->start, "void", 4) == 0) return TOK_TYPE_VOID;
+        if (memcmp(l->start, "bool", 4) == 0) return TOK_TYPE_BOOL;
+        if (memcmp(l->start, "else", 4) == 0) return TOK_ELSE;
     }
     
     switch (l->start[0]) {
@@ -265,7 +268,7 @@ void token_list_free(TokenList *list) {
 const char *token_type_str(TokenType t) {
     static const char *names[] = {
         "INT", "FLOAT", "STRING", "IDENT",
-        "LET", "FOR", "IN", "ASYNC", "AWAIT", "GPU", "KERNEL",
+        "LET", "FOR", "IN", "ASYNC", "AWAIT", "GPU", "KERNEL", "IF", "ELSE",
         "PLUS", "MINUS", "STAR", "SLASH", "PERCENT",
         "EQ", "EQEQ", "NEQ", "LT", "GT", "LTE", "GTE",
         "AND", "OR", "NOT", "BITAND", "BITOR", "BITXOR", "SHL", "SHR",
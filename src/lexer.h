@@ -19,6 +19,8 @@ typedef enum {
     TOK_AWAIT,
     TOK_GPU,
     TOK_KERNEL,
+    TOK_IF,
+    TOK_ELSE,
     TOK_PARALLEL,  /* @parallel annotation */
     
     // Type keywords
@@ -35,6 +37,7 @@ typedef enum {
     TOK_TYPE_STR,
     TOK_TYPE_PTR,
     TOK_TYPE_VOID,
+    TOK_TYPE_BOOL,
     
     // Operators
     TOK_PLUS,
@@ -4,26 +4,35 @@
 #include "lexer.h"
 #include "parser.h"
 #include "codegen.h"
+#include "typecheck.h"
 #include "optimize.h"
 
-#define VERSION "0.2.0-alpha"
-
 typedef struct {
     char *input_file;
     char *output_file;
     int emit_llvm;
     int optimize;
     char *target;
+    char *cpu;
+    char *features;
+    unsigned fast_math;
+    int run;            /* photon run: JIT and call main */
 } Options;
 
 static void print_usage(const char *prog) {
     fprintf(stderr, "Lambda Photon %s\n", VERSION);
     fprintf(stderr, "Usage: %s <input.lp> [options]\n", prog);
+    fprintf(stderr, "       %s run <input.lp> [options]\n", prog);
     fprintf(stderr, "Options:\n");
-    fprintf(stderr, "  -o <file>       Output file\n");
-    fprintf(stderr, "  --emit-llvm     Output LLVM IR only\n");
-    fprintf(stderr, "  -O<n>           Optimization level (0-3)\n");
-    fprintf(stderr, "  --version       Show version\n");
+    fprintf(stderr, "  -o <file>                 Output file\n");
+    fprintf(stderr, "  --emit-llvm               Output LLVM IR only\n");
+    fprintf(stderr, "  -O<n>                     Optimization level (0-3)\n");
+    fprintf(stderr, "  --target=<triple>         Target triple (default: host)\n");
+    fprintf(stderr, "  --target-cpu=<cpu>        CPU to compile for, or native (default: generic)\n");
+    fprintf(stderr, "  --target-features=<list>  Extra features, e.g. +avx2,+fma\n");
+    fprintf(stderr, "  -ffast-math               All fast-math flags on float operations\n");
+    fprintf(stderr, "  -ffast-math=<flags>       Some of reassoc,contract,nnan,ninf,nsz,arcp,afn\n");
+    fprintf(stderr, "  --version                 Show version\n");
 }
 
 static char *read_file(const char *path) {
@@ -43,17 +52,49 @@ static char *read_file(const char *path) {
     return buf;
 }
 
+/* Comma-separated FastMath flag names */
+static unsigned parse_fast_math(const char *list) {
+    unsigned flags = 0;
+    while (*list) {
+        size_t len = strcspn(list, ",");
+        unsigned flag = fast_math_flag(list, len);
+        if (!flag) {
+            fprintf(stderr, "E: unknown fast-math flag '%.*s'\n", (int)len, list);
+            exit(1);
+        }
+        flags |= flag;
+        list += len + (list[len] == ',');
+    }
+    return flags;
+}
+
 static Options parse_args(int argc, char **argv) {
     Options opts = {0};
     opts.optimize = 2;
     opts.output_file = "a.out";
     
-    for (int i = 1; i < argc; i++) {
+    int first = 1;
+    if (argc > 1 && strcmp(argv[1], "run") == 0) {
+        opts.run = 1;
+        first = 2;
+    }
+    
+    for (int i = first; i < argc; i++) {
         if (argv[i][0] == '-') {
             if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
                 opts.output_file = argv[++i];
             } else if (strcmp(argv[i], "--emit-llvm") == 0) {
                 opts.emit_llvm = 1;
+            } else if (strncmp(argv[i], "--target=", 9) == 0) {
+                opts.target = argv[i] + 9;
+            } else if (strncmp(argv[i], "--target-cpu=", 13) == 0) {
+                opts.cpu = argv[i] + 13;
+            } else if (strncmp(argv[i], "--target-features=", 18) == 0) {
+                opts.features = argv[i] + 18;
+            } else if (strcmp(argv[i], "-ffast-math") == 0) {
+                opts.fast_math = FM_FAST;
+            } else if (strncmp(argv[i], "-ffast-math=", 12) == 0) {
+                opts.fast_math |= parse_fast_math(argv[i] + 12);
             } else if (strncmp(argv[i], "-O", 2) == 0) {
                 opts.optimize = argv[i][2] - '0';
             } else if (strcmp(argv[i], "--version") == 0) {
@@ -108,15 +149,26 @@ int main(int argc, char **argv) {
         return 1;
     }
     
+    /* Type checking - fills resolved_type, types literals from context */
+    if (typecheck(ast) > 0) {
+        fprintf(stderr, "E: type\n");
+        return 1;
+    }
+    
     /* Optimization - compile-time evaluation */
     ast = optimize(ast);
     
     /* Code generation */
     CodeGen cg;
-    codegen_init(&cg, opts.target, opts.optimize);
-    char *llvm_ir = codegen_emit(&cg, ast);
+    codegen_init(&cg, opts.target, opts.cpu, opts.features, opts.fast_math, opts.optimize);
+    int status = 0;
+    char *llvm_ir = NULL;
     
-    if (opts.emit_llvm) {
+    if (opts.run) {
+        /* JIT: no object file, no link step */
+        status = codegen_run(&cg, ast);
+    } else if (opts.emit_llvm) {
+        llvm_ir = codegen_emit(&cg, ast);
         /* Output LLVM IR */
         if (strcmp(opts.output_file, "a.out") == 0) {
             printf("%s", llvm_ir);
@@ -129,6 +181,7 @@ int main(int argc, char **argv) {
         }
     } else {
         /* Compile to native executable */
+        llvm_ir = codegen_emit(&cg, ast);
         if (codegen_compile(&cg, opts.output_file) != 0) {
             fprintf(stderr, "E: compile\n");
             return 1;
@@ -136,11 +189,11 @@ int main(int argc, char **argv) {
     }
     
     /* Cleanup */
-    LLVMDisposeMessage(llvm_ir);
+    if (llvm_ir) LLVMDisposeMessage(llvm_ir);
     free(source);
     token_list_free(tokens);
     ast_free(ast);
     codegen_cleanup(&cg);
     
-    return 0;
+    return status;
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "optimize.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <math.h>
 
 /* Check if a node is a constant literal */
@@ -41,6 +42,17 @@ static double get_numeric_value(ASTNode *node) {
     return 0.0;
 }
 
+/*
+ * Folding evaluates in int64_t and double, so it only applies where the
+ * checker typed the operation as i64, f64 or bool; narrow, unsigned and
+ * f32 arithmetic is left to codegen.
+ */
+static int folds_exactly(ASTNode *node) {
+    Type *t = node->resolved_type;
+    return !t || t->kind == TYPE_UNKNOWN || t->kind == TYPE_I64 ||
+           t->kind == TYPE_F64 || t->kind == TYPE_BOOL;
+}
+
 /* Evaluate a constant binary expression */
 static ASTNode *eval_binary(ASTNode *node) {
     ASTNode *left = eval_constant(node->data.binary.left);
@@ -109,6 +121,7 @@ static ASTNode *eval_binary(ASTNode *node) {
         }
     }
     
+    result->resolved_type = type_clone(node->resolved_type);
     ast_free(left);
     ast_free(right);
     return result;
@@ -143,6 +156,7 @@ static ASTNode *eval_unary(ASTNode *node) {
             return NULL;
     }
     
+    result->resolved_type = type_clone(node->resolved_type);
     ast_free(operand);
     return result;
 }
@@ -169,17 +183,19 @@ static ASTNode *eval_ternary(ASTNode *node) {
 
 /* Main constant evaluation function */
 ASTNode *eval_constant(ASTNode *node) {
-    if (!node) return NULL;
+    if (!node || !folds_exactly(node)) return NULL;
     
     switch (node->type) {
         case NODE_INT_LIT: {
             ASTNode *copy = ast_new(NODE_INT_LIT, node->line, node->col);
             copy->data.int_val = node->data.int_val;
+            copy->resolved_type = type_clone(node->resolved_type);
             return copy;
         }
         case NODE_FLOAT_LIT: {
             ASTNode *copy = ast_new(NODE_FLOAT_LIT, node->line, node->col);
             copy->data.float_val = node->data.float_val;
+            copy->resolved_type = type_clone(node->resolved_type);
             return copy;
         }
         case NODE_BINARY:
@@ -227,7 +243,8 @@ ASTNode *optimize_const_fold(ASTNode *node) {
             return node;
         }
         
-        case NODE_TERNARY: {
+        case NODE_TERNARY:
+        case NODE_IF: {
             node->data.ternary.cond = optimize_const_fold(node->data.ternary.cond);
             node->data.ternary.then_branch = optimize_const_fold(node->data.ternary.then_branch);
             node->data.ternary.else_branch = optimize_const_fold(node->data.ternary.else_branch);
@@ -252,6 +269,8 @@ ASTNode *optimize_const_fold(ASTNode *node) {
                         result = node->data.ternary.else_branch;
                         node->data.ternary.else_branch = NULL;
                     }
+                    /* A false if without else leaves nothing to run */
+                    if (!result) result = ast_new(NODE_BLOCK, node->line, node->col);
                     ast_free(node);
                     return result;
                 }
@@ -285,6 +304,32 @@ ASTNode *optimize_const_fold(ASTNode *node) {
             return node;
         }
         
+        case NODE_GPU_KERNEL: {
+            node->data.gpu_kernel.body = optimize_const_fold(node->data.gpu_kernel.body);
+            return node;
+        }
+        
+        case NODE_ASYNC:
+        case NODE_AWAIT: {
+            node->data.async_expr.expr = optimize_const_fold(node->data.async_expr.expr);
+            return node;
+        }
+        
+        case NODE_ARRAY: {
+            for (size_t i = 0; i < node->data.array.count; i++) {
+                node->data.array.elements[i] = optimize_const_fold(node->data.array.elements[i]);
+            }
+            node->data.array.repeat = optimize_const_fold(node->data.array.repeat);
+            return node;
+        }
+        
+        case NODE_INDEX: {
+            node->data.index.array = optimize_const_fold(node->data.index.array);
+            node->data.index.index = optimize_const_fold(node->data.index.index);
+            node->data.index.value = optimize_const_fold(node->data.index.value);
+            return node;
+        }
+        
         case NODE_BUILTIN: {
             for (size_t i = 0; i < node->data.builtin.count; i++) {
                 node->data.builtin.elements[i] = optimize_const_fold(node->data.builtin.elements[i]);
@@ -297,6 +342,627 @@ ASTNode *optimize_const_fold(ASTNode *node) {
     }
 }
 
+/* ========== Range Analysis ========== */
+
+/*
+ * Interval analysis over the folded AST. Integer expressions get the range
+ * of values they can take, seeded by literals, immutable let values and
+ * for bounds and narrowed inside if/ternary arms and && / || operands by
+ * their conditions. Array expressions get the range of their length.
+ * Facts codegen can use are recorded on the nodes.
+ */
+
+typedef struct {
+    int64_t lo, hi;
+    int known;          /* 0 for floats, u64 and other values without a range */
+    int cond;           /* relies on a branch condition */
+} Range;
+
+static const Range no_range = { 0, 0, 0, 0 };
+
+/* What is known about a name; for an array, range is its length */
+typedef struct RangeBinding {
+    const char *name;
+    int is_array;
+    Range range;
+    struct RangeBinding *limit;     /* value < measure of limit */
+    struct RangeBinding *same;      /* value (array: length) == measure of same */
+    struct RangeBinding *next;
+} RangeBinding;
+
+/*
+ * The measure of a binding is its value, or its length for an array.
+ * Arms of a ternary and the right operand of && and || may be computed
+ * eagerly by codegen, so facts that rest on their condition are not
+ * recorded there (speculative > 0) where a wrong fact would trap.
+ */
+typedef struct {
+    RangeBinding *bindings;
+    int speculative;
+} RangeState;
+
+static Range range_of(int64_t lo, int64_t hi) {
+    return (Range){ lo, hi, 1, 0 };
+}
+
+static Range type_range(Type *t) {
+    if (!t) return no_range;
+    switch (t->kind) {
+        case TYPE_BOOL:  return range_of(0, 1);
+        case TYPE_I8:    return range_of(INT8_MIN, INT8_MAX);
+        case TYPE_I16:   return range_of(INT16_MIN, INT16_MAX);
+        case TYPE_I32:   return range_of(INT32_MIN, INT32_MAX);
+        case TYPE_I64:   return range_of(INT64_MIN, INT64_MAX);
+        case TYPE_U8:    return range_of(0, UINT8_MAX);
+        case TYPE_U16:   return range_of(0, UINT16_MAX);
+        case TYPE_U32:   return range_of(0, UINT32_MAX);
+        case TYPE_ARRAY: return t->array_len ? range_of((int64_t)t->array_len, (int64_t)t->array_len)
+                                             : range_of(0, INT64_MAX);
+        case TYPE_VECTOR: return range_of((int64_t)t->array_len, (int64_t)t->array_len);
+        default:         return no_range;
+    }
+}
+
+static int is_int_kind(Type *t) {
+    return t && t->kind >= TYPE_I8 && t->kind <= TYPE_U64;
+}
+
+static int is_unsigned_kind(Type *t) {
+    return t && t->kind >= TYPE_U8 && t->kind <= TYPE_U64;
+}
+
+static int range_within(Range r, Range outer) {
+    return r.known && outer.known && r.lo >= outer.lo && r.hi <= outer.hi;
+}
+
+/* r if every value fits t, else all of t */
+static Range range_fit(Range r, Type *t) {
+    return range_within(r, type_range(t)) ? r : type_range(t);
+}
+
+static Range range_union(Range a, Range b) {
+    if (!a.known || !b.known) return no_range;
+    return (Range){ a.lo < b.lo ? a.lo : b.lo, a.hi > b.hi ? a.hi : b.hi, 1, a.cond | b.cond };
+}
+
+/* Exact in int64_t; unknown if that overflows */
+static Range range_add(Range a, Range b) {
+    Range r = { 0, 0, a.known && b.known, a.cond | b.cond };
+    if (r.known && (__builtin_add_overflow(a.lo, b.lo, &r.lo) ||
+                    __builtin_add_overflow(a.hi, b.hi, &r.hi))) r.known = 0;
+    return r;
+}
+
+static Range range_sub(Range a, Range b) {
+    Range r = { 0, 0, a.known && b.known, a.cond | b.cond };
+    if (r.known && (__builtin_sub_overflow(a.lo, b.hi, &r.lo) ||
+                    __builtin_sub_overflow(a.hi, b.lo, &r.hi))) r.known = 0;
+    return r;
+}
+
+static Range range_mul(Range a, Range b) {
+    Range r = { 0, 0, a.known && b.known, a.cond | b.cond };
+    if (!r.known) return r;
+    int64_t corners[4];
+    if (__builtin_mul_overflow(a.lo, b.lo, &corners[0]) ||
+        __builtin_mul_overflow(a.lo, b.hi, &corners[1]) ||
+        __builtin_mul_overflow(a.hi, b.lo, &corners[2]) ||
+        __builtin_mul_overflow(a.hi, b.hi, &corners[3])) return no_range;
+    r.lo = r.hi = corners[0];
+    for (int i = 1; i < 4; i++) {
+        if (corners[i] < r.lo) r.lo = corners[i];
+        if (corners[i] > r.hi) r.hi = corners[i];
+    }
+    return r;
+}
+
+/* Divisor excludes 0 (and -1 when the dividend may be the type's minimum) */
+static Range range_div(Range a, Range b) {
+    Range r = { 0, 0, a.known && b.known, a.cond | b.cond };
+    if (!r.known) return r;
+    int64_t corners[] = { a.lo / b.lo, a.lo / b.hi, a.hi / b.lo, a.hi / b.hi };
+    r.lo = r.hi = corners[0];
+    for (int i = 1; i < 4; i++) {
+        if (corners[i] < r.lo) r.lo = corners[i];
+        if (corners[i] > r.hi) r.hi = corners[i];
+    }
+    return r;
+}
+
+/* |a % b| < |b| and takes the sign of a */
+static Range range_mod(Range a, Range b) {
+    if (!a.known || !b.known || b.lo == INT64_MIN) return no_range;
+    int64_t m = (b.hi > -b.lo ? b.hi : -b.lo) - 1;
+    int cond = a.cond | b.cond;
+    if (a.lo >= 0) return (Range){ 0, a.hi < m ? a.hi : m, 1, cond };
+    if (a.hi <= 0) return (Range){ a.lo > -m ? a.lo : -m, 0, 1, cond };
+    return (Range){ -m, m, 1, cond };
+}
+
+static Range range_bitwise(Operator op, Range a, Range b) {
+    int cond = a.cond | b.cond;
+    int a_pos = a.known && a.lo >= 0, b_pos = b.known && b.lo >= 0;
+    switch (op) {
+        case OP_BITAND:
+            if (a_pos && b_pos) return (Range){ 0, a.hi < b.hi ? a.hi : b.hi, 1, cond };
+            if (a_pos || b_pos) return (Range){ 0, a_pos ? a.hi : b.hi, 1, cond };
+            return no_range;
+        case OP_BITOR:
+        case OP_BITXOR: {
+            if (!a_pos || !b_pos) return no_range;
+            int64_t m = a.hi > b.hi ? a.hi : b.hi;
+            int64_t p = 1;
+            while (p <= m && p < INT64_MAX / 2 + 1) p <<= 1;
+            return (Range){ 0, p > m ? p - 1 : INT64_MAX, 1, cond };
+        }
+        case OP_SHR:
+            if (!a_pos || !b_pos || b.hi > 63) return no_range;
+            return (Range){ a.lo >> b.hi, a.hi >> b.lo, 1, cond };
+        case OP_SHL:
+            if (!a_pos || !b_pos || b.hi > 62 || a.hi > (INT64_MAX >> b.hi)) return no_range;
+            return (Range){ a.lo << b.lo, a.hi << b.hi, 1, cond };
+        default:
+            return no_range;
+    }
+}
+
+/* 32 if a 64-bit t's operands and result all fit its 32-bit counterpart */
+static int narrow_width(Range a, Range b, Range r, Type *t) {
+    Range wr;
+    if (t->kind == TYPE_I64) wr = range_of(INT32_MIN, INT32_MAX);
+    else return 0;
+    /* INT32_MIN / -1 traps in 32 bits, for % as well as / */
+    if (a.lo <= INT32_MIN && b.lo <= -1 && b.hi >= -1) return 0;
+    return range_within(a, wr) && range_within(b, wr) && range_within(r, wr) ? 32 : 0;
+}
+
+static RangeBinding *rng_bind(RangeState *st, const char *name) {
+    RangeBinding *b = calloc(1, sizeof(RangeBinding));
+    b->name = name;
+    b->range = no_range;
+    b->next = st->bindings;
+    st->bindings = b;
+    return b;
+}
+
+static void rng_unwind(RangeState *st, RangeBinding *mark) {
+    while (st->bindings != mark) {
+        RangeBinding *next = st->bindings->next;
+        free(st->bindings);
+        st->bindings = next;
+    }
+}
+
+static RangeBinding *rng_lookup(RangeState *st, const char *name) {
+    for (RangeBinding *b = st->bindings; b; b = b->next) {
+        if (strcmp(b->name, name) == 0) return b;
+    }
+    return NULL;
+}
+
+static RangeBinding *canon(RangeBinding *b) {
+    while (b && b->same) b = b->same;
+    return b;
+}
+
+/* Binding whose measure node's value equals: a name, or @len of an array name */
+static RangeBinding *measure_of(RangeState *st, ASTNode *node) {
+    if (node->type == NODE_IDENT) return canon(rng_lookup(st, node->data.ident.name));
+    if (node->type == NODE_BUILTIN && strcmp(node->data.builtin.name, "len") == 0 &&
+        node->data.builtin.count == 1 && node->data.builtin.elements[0]->type == NODE_IDENT) {
+        RangeBinding *b = rng_lookup(st, node->data.builtin.elements[0]->data.ident.name);
+        return b && b->is_array ? canon(b) : NULL;
+    }
+    return NULL;
+}
+
+static Range rng_expr(RangeState *st, ASTNode *node);
+
+static Operator negate_compare(Operator op) {
+    switch (op) {
+        case OP_LT:  return OP_GTE;
+        case OP_GTE: return OP_LT;
+        case OP_GT:  return OP_LTE;
+        case OP_LTE: return OP_GT;
+        case OP_EQ:  return OP_NEQ;
+        default:     return OP_EQ;
+    }
+}
+
+static Operator swap_compare(Operator op) {
+    switch (op) {
+        case OP_LT:  return OP_GT;
+        case OP_GT:  return OP_LT;
+        case OP_LTE: return OP_GTE;
+        case OP_GTE: return OP_LTE;
+        default:     return op;
+    }
+}
+
+/* Shadow name with what `name op other` adds to it */
+static void refine_var(RangeState *st, const char *name, Operator op, ASTNode *other) {
+    RangeBinding *b = rng_lookup(st, name);
+    Range o = rng_expr(st, other);
+    if (!b || b->is_array || !b->range.known || !o.known) return;
+    
+    Range r = b->range;
+    RangeBinding *limit = b->limit;
+    switch (op) {
+        case OP_LT:
+            if (o.hi == INT64_MIN) return;
+            if (o.hi - 1 < r.hi) r.hi = o.hi - 1;
+            limit = measure_of(st, other);
+            break;
+        case OP_LTE:
+            if (o.hi < r.hi) r.hi = o.hi;
+            break;
+        case OP_GT:
+            if (o.lo == INT64_MAX) return;
+            if (o.lo + 1 > r.lo) r.lo = o.lo + 1;
+            break;
+        case OP_GTE:
+            if (o.lo > r.lo) r.lo = o.lo;
+            break;
+        case OP_EQ:
+            if (o.lo > r.lo) r.lo = o.lo;
+            if (o.hi < r.hi) r.hi = o.hi;
+            break;
+        default:
+            return;
+    }
+    if (r.lo > r.hi) return;
+    
+    RangeBinding *n = rng_bind(st, b->name);
+    n->range = r;
+    n->range.cond = 1;
+    n->limit = limit;
+    n->same = canon(b);
+}
+
+/* Bindings that hold while cond evaluates to truth */
+static void refine(RangeState *st, ASTNode *cond, int truth) {
+    if (!cond) return;
+    
+    if (cond->type == NODE_BUILTIN && cond->data.builtin.count == 1 &&
+        (strcmp(cond->data.builtin.name, "likely") == 0 ||
+         strcmp(cond->data.builtin.name, "unlikely") == 0)) {
+        refine(st, cond->data.builtin.elements[0], truth);
+        return;
+    }
+    if (cond->type == NODE_UNARY && cond->data.unary.op == OP_NOT) {
+        refine(st, cond->data.unary.operand, !truth);
+        return;
+    }
+    if (cond->type != NODE_BINARY) return;
+    
+    Operator op = cond->data.binary.op;
+    ASTNode *left = cond->data.binary.left;
+    ASTNode *right = cond->data.binary.right;
+    if ((op == OP_AND && truth) || (op == OP_OR && !truth)) {
+        refine(st, left, truth);
+        refine(st, right, truth);
+        return;
+    }
+    if (op < OP_EQ || op > OP_GTE) return;
+    
+    /* Unsigned compares reinterpret negative values */
+    if (is_unsigned_kind(left->resolved_type) || is_unsigned_kind(right->resolved_type)) return;
+    if (!truth) op = negate_compare(op);
+    if (left->type == NODE_IDENT) refine_var(st, left->data.ident.name, op, right);
+    if (right->type == NODE_IDENT) refine_var(st, right->data.ident.name, swap_compare(op), left);
+}
+
+static Range rng_binary(RangeState *st, ASTNode *node) {
+    Operator op = node->data.binary.op;
+    ASTNode *left = node->data.binary.left;
+    ASTNode *right = node->data.binary.right;
+    Type *t = node->resolved_type;
+    
+    if (op == OP_AND || op == OP_OR) {
+        rng_expr(st, left);
+        RangeBinding *mark = st->bindings;
+        st->speculative++;
+        refine(st, left, op == OP_AND);
+        rng_expr(st, right);
+        st->speculative--;
+        rng_unwind(st, mark);
+        return range_of(0, 1);
+    }
+    
+    Range a = rng_expr(st, left);
+    Range b = rng_expr(st, right);
+    if (op >= OP_EQ && op <= OP_GTE) return range_of(0, 1);
+    if (!is_int_kind(t)) {
+        /* Float division does not trap, integer lanes of a vector may */
+        int int_lanes = t && t->kind == TYPE_VECTOR && is_int_kind(t->inner);
+        if ((op == OP_DIV || op == OP_MOD) && !int_lanes) node->data.binary.safe_divisor = 1;
+        return no_range;
+    }
+    int trusted = !st->speculative || !(a.cond || b.cond);
+    
+    Range r;
+    switch (op) {
+        case OP_ADD: r = range_add(a, b); break;
+        case OP_SUB: r = range_sub(a, b); break;
+        case OP_MUL: r = range_mul(a, b); break;
+        case OP_DIV:
+        case OP_MOD: {
+            Range tr = type_range(t);
+            int nonzero = b.known && (b.lo > 0 || b.hi < 0);
+            int may_overflow = !is_unsigned_kind(t) && (!a.known || !tr.known || a.lo <= tr.lo) &&
+                               b.lo <= -1 && b.hi >= -1;
+            if (!nonzero || may_overflow) return type_range(t);
+            r = op == OP_DIV ? range_div(a, b) : range_mod(a, b);
+            /* Narrowing holds wherever the division runs; speculating it needs more */
+            node->data.binary.narrow_bits = narrow_width(a, b, r, t);
+            if (trusted) node->data.binary.safe_divisor = 1;
+            break;
+        }
+        default:
+            r = range_bitwise(op, a, b);
+            break;
+    }
+    
+    if ((op == OP_ADD || op == OP_SUB || op == OP_MUL) && trusted && range_within(r, type_range(t))) {
+        node->data.binary.no_wrap = 1;
+    }
+    return range_fit(r, t);
+}
+
+/* Statements of a block in their own scope; the range of the last one */
+static Range rng_block(RangeState *st, ASTNode *block) {
+    RangeBinding *mark = st->bindings;
+    Range last = no_range;
+    for (size_t i = 0; i < block->data.block.count; i++) {
+        last = rng_expr(st, block->data.block.stmts[i]);
+    }
+    rng_unwind(st, mark);
+    return last;
+}
+
+static void rng_lambda(RangeState *st, ASTNode *node) {
+    RangeBinding *mark = st->bindings;
+    int speculative = st->speculative;
+    st->speculative = 0;
+    
+    Type *ft = node->resolved_type;
+    for (size_t i = 0; i < node->data.lambda.param_count; i++) {
+        Type *pt = ft && i < ft->param_count ? ft->params[i] : NULL;
+        RangeBinding *b = rng_bind(st, node->data.lambda.params[i]);
+        b->is_array = pt && pt->kind == TYPE_ARRAY;
+        b->range = type_range(pt);
+    }
+    rng_expr(st, node->data.lambda.body);
+    
+    st->speculative = speculative;
+    rng_unwind(st, mark);
+}
+
+static void rng_let(RangeState *st, ASTNode *node) {
+    ASTNode *value = node->data.let.value;
+    Type *annotation = node->data.let.type_annotation;
+    
+    if (value->type == NODE_LAMBDA) {
+        /* The lambda's own name shadows any outer binding inside it */
+        rng_bind(st, node->data.let.name);
+        rng_lambda(st, value);
+        return;
+    }
+    
+    Range r = rng_expr(st, value);
+    RangeBinding *same = NULL, *limit = NULL;
+    if (value->type == NODE_IDENT) {
+        RangeBinding *alias = rng_lookup(st, value->data.ident.name);
+        same = canon(alias);
+        limit = alias ? alias->limit : NULL;
+    } else if (value->type == NODE_BUILTIN) {
+        same = measure_of(st, value);
+    } else if (value->type == NODE_ARRAY && value->data.array.repeat) {
+        same = measure_of(st, value->data.array.repeat);
+    }
+    
+    RangeBinding *b = rng_bind(st, node->data.let.name);
+    b->is_array = value->resolved_type && value->resolved_type->kind == TYPE_ARRAY;
+    if (annotation && is_int_kind(annotation)) {
+        /* A conversion may truncate; then nothing carries over */
+        b->range = range_fit(r, annotation);
+        if (b->range.lo != r.lo || b->range.hi != r.hi) same = limit = NULL;
+    } else {
+        b->range = r;
+    }
+    b->same = same;
+    b->limit = limit;
+}
+
+static void rng_for(RangeState *st, ASTNode *node) {
+    Range s = rng_expr(st, node->data.for_loop.start);
+    Range e = rng_expr(st, node->data.for_loop.end);
+    RangeBinding *limit = measure_of(st, node->data.for_loop.end);
+    
+    /* Bounds are converted to i64; the variable runs over [start, end) */
+    RangeBinding *mark = st->bindings;
+    RangeBinding *var = rng_bind(st, node->data.for_loop.var);
+    int64_t lo = s.known ? s.lo : INT64_MIN;
+    int64_t hi = (e.known && e.hi > INT64_MIN) ? e.hi - 1 : INT64_MAX;
+    var->range = (Range){ lo, hi < lo ? lo : hi, 1, s.cond | e.cond };
+    var->limit = limit;
+    
+    rng_expr(st, node->data.for_loop.body);
+    rng_unwind(st, mark);
+    
+    if (node->data.for_loop.reduce_var) {
+        RangeBinding *red = rng_bind(st, node->data.for_loop.reduce_var);
+        red->range = type_range(node->resolved_type);
+    }
+}
+
+static Range rng_builtin(RangeState *st, ASTNode *node) {
+    const char *name = node->data.builtin.name;
+    Range first = no_range;
+    for (size_t i = 0; i < node->data.builtin.count; i++) {
+        Range r = rng_expr(st, node->data.builtin.elements[i]);
+        if (i == 0) first = r;
+    }
+    
+    if (strcmp(name, "len") == 0) {
+        return first.known && first.lo >= 0 ? first : range_of(0, INT64_MAX);
+    }
+    if (strcmp(name, "likely") == 0 || strcmp(name, "unlikely") == 0) return first;
+    if (strcmp(name, "index") == 0) return range_of(0, INT64_MAX - 1);
+    if (strcmp(name, "count") == 0) return range_of(0, INT64_MAX);
+    
+    /* Bit counts never exceed the operand's width */
+    if ((strcmp(name, "popcount") == 0 || strcmp(name, "clz") == 0 || strcmp(name, "ctz") == 0) &&
+        is_int_kind(node->resolved_type)) {
+        return range_of(0, 64);
+    }
+    return type_range(node->resolved_type);
+}
+
+static Range rng_index(RangeState *st, ASTNode *node) {
+    ASTNode *array = node->data.index.array;
+    ASTNode *index = node->data.index.index;
+    Range len = rng_expr(st, array);
+    Range idx = rng_expr(st, index);
+    if (node->data.index.value) rng_expr(st, node->data.index.value);
+    
+    RangeBinding *ab = array->type == NODE_IDENT ? rng_lookup(st, array->data.ident.name) : NULL;
+    RangeBinding *ib = index->type == NODE_IDENT ? rng_lookup(st, index->data.ident.name) : NULL;
+    int below_len = (len.known && idx.hi < len.lo) ||
+                    (ab && ab->is_array && ib && ib->limit && ib->limit == canon(ab));
+    if (idx.known && idx.lo >= 0 && below_len) node->data.index.in_bounds = 1;
+    
+    return node->data.index.value ? no_range : type_range(node->resolved_type);
+}
+
+static Range rng_expr(RangeState *st, ASTNode *node) {
+    if (!node) return no_range;
+    
+    switch (node->type) {
+        case NODE_INT_LIT:
+            return range_fit(range_of(node->data.int_val, node->data.int_val), node->resolved_type);
+        
+        case NODE_IDENT: {
+            RangeBinding *b = rng_lookup(st, node->data.ident.name);
+            return b ? b->range : type_range(node->resolved_type);
+        }
+        
+        case NODE_BINARY:
+            return rng_binary(st, node);
+        
+        case NODE_UNARY: {
+            Range r = rng_expr(st, node->data.unary.operand);
+            if (node->data.unary.op == OP_NOT) return range_of(0, 1);
+            if (!r.known || r.lo == INT64_MIN || !is_int_kind(node->resolved_type)) {
+                return type_range(node->resolved_type);
+            }
+            return range_fit((Range){ -r.hi, -r.lo, 1, r.cond }, node->resolved_type);
+        }
+        
+        case NODE_TERNARY:
+        case NODE_IF: {
+            ASTNode *cond = node->data.ternary.cond;
+            rng_expr(st, cond);
+            int ternary = node->type == NODE_TERNARY;
+            
+            RangeBinding *mark = st->bindings;
+            st->speculative++;
+            refine(st, cond, 1);
+            st->speculative -= !ternary;
+            Range t = rng_expr(st, node->data.ternary.then_branch);
+            st->speculative += !ternary;
+            rng_unwind(st, mark);
+            
+            refine(st, cond, 0);
+            st->speculative -= !ternary;
+            Range e = rng_expr(st, node->data.ternary.else_branch);
+            st->speculative -= ternary;
+            rng_unwind(st, mark);
+            
+            if (!node->data.ternary.else_branch) return no_range;
+            return range_fit(range_union(t, e), node->resolved_type);
+        }
+        
+        case NODE_BLOCK:
+            return rng_block(st, node);
+        
+        case NODE_LET:
+            rng_let(st, node);
+            return no_range;
+        
+        case NODE_FOR:
+            rng_for(st, node);
+            return no_range;
+        
+        case NODE_LAMBDA:
+            rng_lambda(st, node);
+            return no_range;
+        
+        case NODE_APPLY:
+            rng_expr(st, node->data.apply.func);
+            for (size_t i = 0; i < node->data.apply.arg_count; i++)
+                rng_expr(st, node->data.apply.args[i]);
+            return type_range(node->resolved_type);
+        
+        case NODE_ARRAY: {
+            for (size_t i = 0; i < node->data.array.count; i++)
+                rng_expr(st, node->data.array.elements[i]);
+            if (!node->data.array.repeat) {
+                return range_of((int64_t)node->data.array.count, (int64_t)node->data.array.count);
+            }
+            /* A negative length stops the program at run time */
+            Range n = rng_expr(st, node->data.array.repeat);
+            if (!n.known || n.hi < 0) return range_of(0, INT64_MAX);
+            return (Range){ n.lo < 0 ? 0 : n.lo, n.hi, 1, n.cond };
+        }
+        
+        case NODE_INDEX:
+            return rng_index(st, node);
+        
+        case NODE_BUILTIN:
+            return rng_builtin(st, node);
+        
+        case NODE_ASYNC:
+        case NODE_AWAIT: {
+            int speculative = st->speculative;
+            st->speculative = 0;
+            rng_expr(st, node->data.async_expr.expr);
+            st->speculative = speculative;
+            return type_range(node->resolved_type);
+        }
+        
+        case NODE_GPU_KERNEL: {
+            /* Kernels see only their parameters */
+            RangeBinding *outer = st->bindings;
+            st->bindings = NULL;
+            for (size_t i = 0; i < node->data.gpu_kernel.param_count; i++) {
+                Type *pt = node->data.gpu_kernel.param_types[i];
+                RangeBinding *b = rng_bind(st, node->data.gpu_kernel.params[i]);
+                b->is_array = pt && pt->kind == TYPE_ARRAY;
+                b->range = type_range(pt);
+            }
+            rng_expr(st, node->data.gpu_kernel.body);
+            rng_unwind(st, NULL);
+            st->bindings = outer;
+            return no_range;
+        }
+        
+        case NODE_PROGRAM:
+            for (size_t i = 0; i < node->data.block.count; i++)
+                rng_expr(st, node->data.block.stmts[i]);
+            return no_range;
+        
+        default:
+            return type_range(node->resolved_type);
+    }
+}
+
+void analyze_ranges(ASTNode *program) {
+    RangeState st = { NULL, 0 };
+    rng_expr(&st, program);
+    rng_unwind(&st, NULL);
+}
+
 /* Run all optimization passes */
 ASTNode *optimize(ASTNode *ast) {
     if (!ast) return NULL;
@@ -304,5 +970,8 @@ ASTNode *optimize(ASTNode *ast) {
     /* Pass 1: Constant folding */
     ast = optimize_const_fold(ast);
     
+    /* Pass 2: Range analysis, over the folded tree */
+    analyze_ranges(ast);
+    
     return ast;
 }
@@ -20,6 +20,13 @@ int is_constant_expr(ASTNode *node);
  */
 ASTNode *eval_constant(ASTNode *node);
 
+/*
+ * Range analysis - compute the values integer expressions can take and
+ * mark array indices that are in bounds, divisions that cannot trap and
+ * arithmetic that cannot wrap or fits a narrower type
+ */
+void analyze_ranges(ASTNode *program);
+
 /*
  * Run all optimization passes on an AST
  */
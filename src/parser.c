@@ -1,6 +1,8 @@
 #include "parser.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 
 static Token *current(Parser *p) {
     return &p->tokens->tokens[p->current];
@@ -29,6 +31,16 @@ static int match(Parser *p, TokenType type) {
     return 0;
 }
 
+static void error(Parser *p, Token *t, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "E: %u:%u: ", t->line, t->col);
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    p->errors++;
+}
+
 static char *copy_token_str(Token *t) {
     char *s = malloc(t->length + 1);
     memcpy(s, t->start, t->length);
@@ -36,6 +48,38 @@ static char *copy_token_str(Token *t) {
     return s;
 }
 
+/*
+ * Vector type name: a scalar type, 'x' and a lane count, as in f32x8 or
+ * boolx16. Returns NULL for any other identifier.
+ */
+#define MAX_LANES 64
+
+static Type *parse_vector_type(Token *t) {
+    static const struct { const char *name; int kind; } scalars[] = {
+        { "i8", TYPE_I8 }, { "i16", TYPE_I16 }, { "i32", TYPE_I32 }, { "i64", TYPE_I64 },
+        { "u8", TYPE_U8 }, { "u16", TYPE_U16 }, { "u32", TYPE_U32 }, { "u64", TYPE_U64 },
+        { "f32", TYPE_F32 }, { "f64", TYPE_F64 }, { "bool", TYPE_BOOL }
+    };
+    for (size_t i = 0; i < sizeof(scalars) / sizeof(scalars[0]); i++) {
+        size_t n = strlen(scalars[i].name);
+        if (t->length < n + 2 || memcmp(t->start, scalars[i].name, n) != 0 || t->start[n] != 'x') {
+            continue;
+        }
+        size_t lanes = 0;
+        for (size_t j = n + 1; j < t->length; j++) {
+            if (t->start[j] < '0' || t->start[j] > '9' || lanes > MAX_LANES) return NULL;
+            lanes = lanes * 10 + (size_t)(t->start[j] - '0');
+        }
+        if (lanes < 2 || lanes > MAX_LANES) return NULL;
+        
+        Type *type = type_new(TYPE_VECTOR);
+        type->inner = type_new(scalars[i].kind);
+        type->array_len = lanes;
+        return type;
+    }
+    return NULL;
+}
+
 /* Parse a type annotation */
 static Type *parse_type(Parser *p) {
     Token *t = current(p);
@@ -55,6 +99,40 @@ static Type *parse_type(Parser *p) {
         case TOK_TYPE_STR: type = type_new(TYPE_STR); break;
         case TOK_TYPE_PTR: type = type_new(TYPE_PTR); break;
         case TOK_TYPE_VOID: type = type_new(TYPE_VOID); break;
+        case TOK_TYPE_BOOL: type = type_new(TYPE_BOOL); break;
+        case TOK_LBRACKET: {
+            /* Array type: [T] or [T; N] */
+            advance(p);
+            type = type_new(TYPE_ARRAY);
+            type->inner = parse_type(p);
+            if (match(p, TOK_SEMICOLON) && check(p, TOK_INT)) {
+                type->array_len = (size_t)current(p)->value.int_val;
+                advance(p);
+            }
+            match(p, TOK_RBRACKET);
+            return type;
+        }
+        case TOK_LPAREN: {
+            /* Function type: (T, ...) -> R */
+            advance(p);
+            type = type_new(TYPE_FUNC);
+            size_t cap = 0;
+            while (!check(p, TOK_RPAREN) && !check(p, TOK_EOF)) {
+                if (type->param_count >= cap) {
+                    cap = cap ? cap * 2 : 4;
+                    type->params = realloc(type->params, sizeof(Type*) * cap);
+                }
+                type->params[type->param_count++] = parse_type(p);
+                if (!match(p, TOK_COMMA)) break;
+            }
+            match(p, TOK_RPAREN);
+            type->ret = match(p, TOK_ARROW) ? parse_type(p) : type_new(TYPE_VOID);
+            return type;
+        }
+        case TOK_IDENT:
+            type = parse_vector_type(t);
+            if (type) break;
+            return type_new(TYPE_I64);
         default:
             /* Unknown type - default to i64 */
             type = type_new(TYPE_I64);
@@ -67,6 +145,27 @@ static Type *parse_type(Parser *p) {
 
 static ASTNode *expression(Parser *p);
 static ASTNode *statement(Parser *p);
+static ASTNode *block(Parser *p);
+
+/* if cond { ... } [else if ... | else { ... }] */
+static ASTNode *if_expr(Parser *p, Token *t) {
+    ASTNode *n = ast_new(NODE_IF, t->line, t->col);
+    n->data.ternary.cond = expression(p);
+    match(p, TOK_LBRACE);
+    n->data.ternary.then_branch = block(p);
+    n->data.ternary.else_branch = NULL;
+    
+    if (match(p, TOK_ELSE)) {
+        Token *e = current(p);
+        if (match(p, TOK_IF)) {
+            n->data.ternary.else_branch = if_expr(p, e);
+        } else {
+            match(p, TOK_LBRACE);
+            n->data.ternary.else_branch = block(p);
+        }
+    }
+    return n;
+}
 
 static ASTNode *primary(Parser *p) {
     Token *t = current(p);
@@ -122,6 +221,10 @@ static ASTNode *primary(Parser *p) {
                 n->data.array.elements[n->data.array.count++] = expression(p);
             } while (match(p, TOK_COMMA));
         }
+        /* [value; n] repeats one value n times */
+        if (n->data.array.count == 1 && match(p, TOK_SEMICOLON)) {
+            n->data.array.repeat = expression(p);
+        }
         match(p, TOK_RBRACKET);
         return n;
     }
@@ -153,21 +256,30 @@ static ASTNode *primary(Parser *p) {
         return n;
     }
     
+    if (match(p, TOK_IF)) {
+        return if_expr(p, t);
+    }
+    
     if (match(p, TOK_BACKSLASH)) {
         ASTNode *n = ast_new(NODE_LAMBDA, t->line, t->col);
         size_t cap = 4;
         n->data.lambda.params = malloc(sizeof(char*) * cap);
-        n->data.lambda.param_types = NULL;
+        n->data.lambda.param_types = malloc(sizeof(Type*) * cap);
         n->data. lambda.param_count = 0;
         
+        /* \x y -> ..., each parameter optionally annotated as x: T */
         while (check(p, TOK_IDENT)) {
             if (n->data. lambda.param_count >= cap) {
                 cap *= 2;
                 n->data.lambda.params = realloc(n->data.lambda.params, 
                                                  sizeof(char*) * cap);
+                n->data.lambda.param_types = realloc(n->data.lambda.param_types,
+                                                     sizeof(Type*) * cap);
             }
-            n->data.lambda.params[n->data. lambda.param_count++] = copy_token_str(current(p));
+            size_t i = n->data.lambda.param_count++;
+            n->data.lambda.params[i] = copy_token_str(current(p));
             advance(p);
+            n->data.lambda.param_types[i] = match(p, TOK_COLON) ? parse_type(p) : NULL;
         }
         
         match(p, TOK_ARROW);
@@ -195,6 +307,29 @@ static ASTNode *postfix(Parser *p) {
             continue;
         }
         
+        /* Application: f(a, b) */
+        if (check(p, TOK_LPAREN)) {
+            advance(p);
+            ASTNode *call = ast_new(NODE_APPLY, t->line, t->col);
+            call->data.apply.func = left;
+            call->data.apply.args = NULL;
+            call->data.apply.arg_count = 0;
+            size_t cap = 0;
+            if (!check(p, TOK_RPAREN)) {
+                do {
+                    if (call->data.apply.arg_count >= cap) {
+                        cap = cap ? cap * 2 : 4;
+                        call->data.apply.args = realloc(call->data.apply.args,
+                                                        sizeof(ASTNode*) * cap);
+                    }
+                    call->data.apply.args[call->data.apply.arg_count++] = expression(p);
+                } while (match(p, TOK_COMMA));
+            }
+            match(p, TOK_RPAREN);
+            left = call;
+            continue;
+        }
+        
         break;
     }
     
@@ -218,6 +353,13 @@ static ASTNode *unary(Parser *p) {
         return n;
     }
     
+    if (match(p, TOK_AWAIT)) {
+        ASTNode *n = ast_new(NODE_AWAIT, t->line, t->col);
+        /* await async e: the task spans the rest of the expression */
+        n->data.async_expr.expr = check(p, TOK_ASYNC) ? expression(p) : unary(p);
+        return n;
+    }
+    
     return postfix(p);
 }
 
@@ -258,9 +400,26 @@ static ASTNode *term(Parser *p) {
     return left;
 }
 
-static ASTNode *comparison(Parser *p) {
+static ASTNode *shift(Parser *p) {
     ASTNode *left = term(p);
     
+    while (check(p, TOK_SHL) || check(p, TOK_SHR)) {
+        Token *t = current(p);
+        Operator op = match(p, TOK_SHL) ? OP_SHL : (advance(p), OP_SHR);
+        
+        ASTNode *n = ast_new(NODE_BINARY, t->line, t->col);
+        n->data.binary.op = op;
+        n->data.binary.left = left;
+        n->data.binary.right = term(p);
+        left = n;
+    }
+    
+    return left;
+}
+
+static ASTNode *comparison(Parser *p) {
+    ASTNode *left = shift(p);
+    
     while (check(p, TOK_LT) || check(p, TOK_GT) || 
            check(p, TOK_LTE) || check(p, TOK_GTE)) {
         Token *t = current(p);
@@ -273,7 +432,7 @@ static ASTNode *comparison(Parser *p) {
         ASTNode *n = ast_new(NODE_BINARY, t->line, t->col);
         n->data.binary.op = op;
         n->data.binary.left = left;
-        n->data.binary.right = term(p);
+        n->data.binary.right = shift(p);
         left = n;
     }
     
@@ -297,15 +456,34 @@ static ASTNode *equality(Parser *p) {
     return left;
 }
 
+/* & ^ | bind tighter than && and looser than comparisons, as in C */
+static ASTNode *bitwise(Parser *p, int level) {
+    static const TokenType tokens[] = { TOK_BITAND, TOK_BITXOR, TOK_BITOR };
+    static const Operator ops[] = { OP_BITAND, OP_BITXOR, OP_BITOR };
+    
+    ASTNode *left = level == 0 ? equality(p) : bitwise(p, level - 1);
+    
+    while (match(p, tokens[level])) {
+        Token *t = previous(p);
+        ASTNode *n = ast_new(NODE_BINARY, t->line, t->col);
+        n->data.binary.op = ops[level];
+        n->data.binary.left = left;
+        n->data.binary.right = level == 0 ? equality(p) : bitwise(p, level - 1);
+        left = n;
+    }
+    
+    return left;
+}
+
 static ASTNode *logical_and(Parser *p) {
-    ASTNode *left = equality(p);
+    ASTNode *left = bitwise(p, 2);
     
     while (match(p, TOK_AND)) {
         Token *t = previous(p);
         ASTNode *n = ast_new(NODE_BINARY, t->line, t->col);
         n->data.binary.op = OP_AND;
         n->data.binary.left = left;
-        n->data.binary.right = equality(p);
+        n->data.binary.right = bitwise(p, 2);
         left = n;
     }
     
@@ -344,9 +522,30 @@ static ASTNode *ternary_expr(Parser *p) {
 }
 
 static ASTNode *expression(Parser *p) {
+    Token *t = current(p);
+    
+    /* async spans the whole expression that follows */
+    if (match(p, TOK_ASYNC)) {
+        ASTNode *n = ast_new(NODE_ASYNC, t->line, t->col);
+        n->data.async_expr.expr = expression(p);
+        return n;
+    }
+    
     return ternary_expr(p);
 }
 
+/* A token no statement can start with is reported and skipped, never looped on */
+static ASTNode *next_statement(Parser *p) {
+    size_t start = p->current;
+    ASTNode *n = statement(p);
+    if (p->current == start) {
+        Token *t = current(p);
+        error(p, t, "unexpected '%.*s'", (int)t->length, t->start);
+        advance(p);
+    }
+    return n;
+}
+
 static ASTNode *block(Parser *p) {
     Token *t = current(p);
     ASTNode *n = ast_new(NODE_BLOCK, t->line, t->col);
@@ -360,31 +559,240 @@ static ASTNode *block(Parser *p) {
             n->data.block.stmts = realloc(n->data.block.stmts, 
                                            sizeof(ASTNode*) * cap);
         }
-        n->data.block.stmts[n->data.block.count++] = statement(p);
+        n->data.block.stmts[n->data.block.count++] = next_statement(p);
     }
     
     match(p, TOK_RBRACE);
     return n;
 }
 
+/* Annotations applied to the following for loop, with @parallel's clauses */
+typedef struct {
+    int parallel;
+    int multiversion;
+    unsigned fast_math;
+    Operator reduce_op;
+    char *reduce_var;
+    Schedule schedule;
+    int64_t chunk;
+    int vectorize;
+    int vector_width;
+    int interleave;
+    int unroll;
+} LoopAnnotation;
+
+static int token_is(Token *t, const char *word) {
+    size_t len = strlen(word);
+    return t->length == len && memcmp(t->start, word, len) == 0;
+}
+
+/* reduce <op> <var> where op is + * & | ^ min max */
+static void parse_reduce_clause(Parser *p, LoopAnnotation *ann) {
+    Token *t = current(p);
+    
+    switch (t->type) {
+        case TOK_PLUS:   ann->reduce_op = OP_ADD; break;
+        case TOK_STAR:   ann->reduce_op = OP_MUL; break;
+        case TOK_BITAND: ann->reduce_op = OP_BITAND; break;
+        case TOK_BITOR:  ann->reduce_op = OP_BITOR; break;
+        case TOK_BITXOR: ann->reduce_op = OP_BITXOR; break;
+        case TOK_IDENT:
+            if (token_is(t, "min")) { ann->reduce_op = OP_MIN; break; }
+            if (token_is(t, "max")) { ann->reduce_op = OP_MAX; break; }
+            /* fallthrough */
+        default:
+            error(p, t, "unknown reduce operator '%.*s'", (int)t->length, t->start);
+            while (!check(p, TOK_COMMA) && !check(p, TOK_RPAREN) && !is_at_end(p)) advance(p);
+            return;
+    }
+    advance(p);
+    
+    if (check(p, TOK_IDENT)) {
+        free(ann->reduce_var);
+        ann->reduce_var = copy_token_str(current(p));
+        advance(p);
+    }
+}
+
+/* Optional integer argument of a schedule clause */
+static int64_t parse_chunk(Parser *p) {
+    if (match(p, TOK_INT)) return previous(p)->value.int_val;
+    return 0;
+}
+
+/*
+ * @parallel(clause, ...)
+ *   reduce <op> <var>
+ *   static [n] | cyclic [n] | dynamic [n] | guided [n]
+ *   grain <n>
+ */
+static void parse_parallel_clauses(Parser *p, LoopAnnotation *ann) {
+    if (!match(p, TOK_LPAREN)) return;
+    
+    while (!check(p, TOK_RPAREN) && !is_at_end(p)) {
+        Token *clause = current(p);
+        advance(p);
+        
+        if (token_is(clause, "reduce")) {
+            parse_reduce_clause(p, ann);
+        } else if (token_is(clause, "static")) {
+            ann->schedule = SCHED_STATIC;
+            ann->chunk = parse_chunk(p);
+        } else if (token_is(clause, "cyclic")) {
+            ann->schedule = SCHED_CYCLIC;
+            ann->chunk = parse_chunk(p);
+        } else if (token_is(clause, "dynamic")) {
+            ann->schedule = SCHED_DYNAMIC;
+            ann->chunk = parse_chunk(p);
+        } else if (token_is(clause, "guided")) {
+            ann->schedule = SCHED_GUIDED;
+            ann->chunk = parse_chunk(p);
+        } else if (token_is(clause, "grain")) {
+            ann->chunk = parse_chunk(p);
+        } else {
+            error(p, clause, "unknown @parallel clause '%.*s'", (int)clause->length, clause->start);
+            while (!check(p, TOK_COMMA) && !check(p, TOK_RPAREN) && !is_at_end(p)) advance(p);
+        }
+        
+        if (!match(p, TOK_COMMA)) break;
+    }
+    if (!match(p, TOK_RPAREN)) error(p, current(p), "expected ')' after @parallel clauses");
+}
+
+/* @fastmath, or @fastmath(flag, ...) with flags reassoc contract nnan ninf nsz arcp afn */
+static unsigned parse_fast_math(Parser *p) {
+    if (!match(p, TOK_LPAREN)) return FM_FAST;
+    
+    unsigned flags = 0;
+    while (!check(p, TOK_RPAREN) && !is_at_end(p)) {
+        Token *flag = advance(p);
+        unsigned bit = fast_math_flag(flag->start, flag->length);
+        if (!bit) error(p, flag, "unknown fast-math flag '%.*s'", (int)flag->length, flag->start);
+        flags |= bit;
+        if (!match(p, TOK_COMMA)) break;
+    }
+    if (!match(p, TOK_RPAREN)) error(p, current(p), "expected ')' after @fastmath flags");
+    return flags;
+}
+
+/* @vectorize(width=N, interleave=M), both optional; N a power of two, M positive */
+static void parse_vectorize(Parser *p, LoopAnnotation *ann) {
+    ann->vectorize = 1;
+    if (!match(p, TOK_LPAREN)) return;
+    
+    while (!check(p, TOK_RPAREN) && !is_at_end(p)) {
+        Token *key = advance(p);
+        match(p, TOK_EQ);
+        Token *arg = current(p);
+        int64_t value = parse_chunk(p);
+        const char *bad = NULL;
+        if (token_is(key, "width")) {
+            if (value <= 0 || value > 1024 || (value & (value - 1)) != 0) bad = "a power of two up to 1024";
+            else ann->vector_width = (int)value;
+        } else if (token_is(key, "interleave")) {
+            if (value <= 0 || value > 1024) bad = "from 1 to 1024";
+            else ann->interleave = (int)value;
+        } else {
+            error(p, key, "unknown @vectorize setting '%.*s'", (int)key->length, key->start);
+        }
+        if (bad) {
+            error(p, arg, "@vectorize %.*s must be %s", (int)key->length, key->start, bad);
+            while (!check(p, TOK_COMMA) && !check(p, TOK_RPAREN) && !is_at_end(p)) advance(p);
+        }
+        if (!match(p, TOK_COMMA)) break;
+    }
+    if (!match(p, TOK_RPAREN)) error(p, current(p), "expected ')' after @vectorize settings");
+}
+
+/* @unroll, @unroll(N) with N from 1 to 1024, or @unroll(full) */
+static int parse_unroll(Parser *p) {
+    if (!match(p, TOK_LPAREN)) return UNROLL_ON;
+    
+    Token *arg = current(p);
+    int64_t count = UNROLL_FULL;
+    if (check(p, TOK_IDENT) && token_is(arg, "full")) advance(p);
+    else count = parse_chunk(p);
+    if (count != UNROLL_FULL && (count <= 0 || count > 1024)) {
+        error(p, arg, "@unroll takes a count from 1 to 1024 or full");
+        while (!check(p, TOK_RPAREN) && !is_at_end(p)) advance(p);
+        count = UNROLL_ON;
+    }
+    if (!match(p, TOK_RPAREN)) error(p, current(p), "expected ')' after @unroll count");
+    return (int)count;
+}
+
+/* gpu kernel name(param: type, ...) { body } */
+static ASTNode *gpu_kernel(Parser *p, Token *t) {
+    ASTNode *n = ast_new(NODE_GPU_KERNEL, t->line, t->col);
+    match(p, TOK_KERNEL);
+    n->data.gpu_kernel.name = copy_token_str(current(p));
+    advance(p);
+    
+    size_t cap = 4;
+    n->data.gpu_kernel.params = malloc(sizeof(char*) * cap);
+    n->data.gpu_kernel.param_types = malloc(sizeof(Type*) * cap);
+    n->data.gpu_kernel.param_count = 0;
+    
+    match(p, TOK_LPAREN);
+    while (check(p, TOK_IDENT)) {
+        if (n->data.gpu_kernel.param_count >= cap) {
+            cap *= 2;
+            n->data.gpu_kernel.params = realloc(n->data.gpu_kernel.params,
+                                                sizeof(char*) * cap);
+            n->data.gpu_kernel.param_types = realloc(n->data.gpu_kernel.param_types,
+                                                     sizeof(Type*) * cap);
+        }
+        size_t i = n->data.gpu_kernel.param_count++;
+        n->data.gpu_kernel.params[i] = copy_token_str(current(p));
+        advance(p);
+        n->data.gpu_kernel.param_types[i] = match(p, TOK_COLON) ? parse_type(p)
+                                                                : type_new(TYPE_I64);
+        if (!match(p, TOK_COMMA)) break;
+    }
+    match(p, TOK_RPAREN);
+    
+    match(p, TOK_LBRACE);
+    n->data.gpu_kernel.body = block(p);
+    match(p, TOK_SEMICOLON);
+    return n;
+}
+
 static ASTNode *statement(Parser *p) {
     Token *t = current(p);
     
-    /* Check for @parallel annotation */
-    int is_parallel = 0;
-    if (match(p, TOK_AT)) {
+    /* Check for @parallel / @multiversion / @fastmath / @vectorize / @unroll annotations */
+    LoopAnnotation ann = { 0, 0, 0, OP_ADD, NULL, SCHED_STEAL, 0, 0, 0, 0, UNROLL_DEFAULT };
+    while (match(p, TOK_AT)) {
         Token *annotation = current(p);
-        if (annotation->length == 8 && memcmp(annotation->start, "parallel", 8) == 0) {
-            is_parallel = 1;
+        if (token_is(annotation, "parallel")) {
+            ann.parallel = 1;
+            advance(p);
+            parse_parallel_clauses(p, &ann);
+        } else if (token_is(annotation, "multiversion")) {
+            ann.multiversion = 1;
+            advance(p);
+        } else if (token_is(annotation, "fastmath")) {
+            advance(p);
+            ann.fast_math |= parse_fast_math(p);
+        } else if (token_is(annotation, "vectorize")) {
+            advance(p);
+            parse_vectorize(p, &ann);
+        } else if (token_is(annotation, "unroll") || token_is(annotation, "nounroll")) {
+            if (ann.unroll != UNROLL_DEFAULT) {
+                error(p, annotation, "a loop takes one of @unroll and @nounroll, once");
+            }
             advance(p);
-            t = current(p);  /* Update t to the for token */
+            ann.unroll = token_is(annotation, "unroll") ? parse_unroll(p) : UNROLL_OFF;
         } else {
-            /* Not @parallel, this is a builtin call - backtrack */
+            /* Not an annotation, this is a builtin call - backtrack */
             p->current--;
+            break;
         }
+        t = current(p);  /* Update t to the for token */
     }
     
     if (match(p, TOK_LET)) {
+        free(ann.reduce_var);
         ASTNode *n = ast_new(NODE_LET, t->line, t->col);
         n->data.let.name = copy_token_str(current(p));
         advance(p);
@@ -397,12 +805,27 @@ static ASTNode *statement(Parser *p) {
         match(p, TOK_EQ);
         n->data.let.value = expression(p);
         match(p, TOK_SEMICOLON);
+        
+        /* @fastmath let f = \x -> ... marks the lambda */
+        if (n->data.let.value && n->data.let.value->type == NODE_LAMBDA) {
+            n->data.let.value->data.lambda.fast_math = ann.fast_math;
+        }
         return n;
     }
     
     if (match(p, TOK_FOR)) {
         ASTNode *n = ast_new(NODE_FOR, t->line, t->col);
-        n->data.for_loop.parallel = is_parallel;
+        n->data.for_loop.parallel = ann.parallel;
+        n->data.for_loop.reduce_op = ann.reduce_op;
+        n->data.for_loop.reduce_var = ann.reduce_var;
+        n->data.for_loop.schedule = ann.schedule;
+        n->data.for_loop.chunk = ann.chunk;
+        n->data.for_loop.multiversion = ann.multiversion;
+        n->data.for_loop.fast_math = ann.fast_math;
+        n->data.for_loop.vectorize = ann.vectorize;
+        n->data.for_loop.vector_width = ann.vector_width;
+        n->data.for_loop.interleave = ann.interleave;
+        n->data.for_loop.unroll = ann.unroll;
         n->data.for_loop.var = copy_token_str(current(p));
         advance(p);
         match(p, TOK_IN);
@@ -415,11 +838,22 @@ static ASTNode *statement(Parser *p) {
         return n;
     }
     
+    free(ann.reduce_var);
+    
+    if (match(p, TOK_GPU)) {
+        return gpu_kernel(p, t);
+    }
+    
     if (match(p, TOK_LBRACE)) {
         return block(p);
     }
     
     ASTNode *expr = expression(p);
+    
+    /* Element store: a[i] = value */
+    if (expr && expr->type == NODE_INDEX && match(p, TOK_EQ)) {
+        expr->data.index.value = expression(p);
+    }
     match(p, TOK_SEMICOLON);
     return expr;
 }
@@ -427,6 +861,7 @@ static ASTNode *statement(Parser *p) {
 void parser_init(Parser *p, TokenList *tokens) {
     p->tokens = tokens;
     p->current = 0;
+    p->errors = 0;
 }
 
 ASTNode *parser_parse(Parser *p) {
@@ -436,14 +871,19 @@ ASTNode *parser_parse(Parser *p) {
     program->data.block.stmts = malloc(sizeof(ASTNode*) * cap);
     program->data.block.count = 0;
     
-    while (!is_at_end(p)) {
+    /* Stop at the first statement with errors rather than resynchronise */
+    while (!is_at_end(p) && p->errors == 0) {
         if (program->data.block. count >= cap) {
             cap *= 2;
             program->data.block. stmts = realloc(program->data.block.stmts,
                                                  sizeof(ASTNode*) * cap);
         }
-        program->data.block.stmts[program->data.block.count++] = statement(p);
+        program->data.block.stmts[program->data.block.count++] = next_statement(p);
     }
     
+    if (p->errors > 0) {
+        ast_free(program);
+        return NULL;
+    }
     return program;
 }
\ No newline at end of file
@@ -7,9 +7,11 @@
 typedef struct {
     TokenList *tokens;
     size_t current;
+    int errors;
 } Parser;
 
 void parser_init(Parser *p, TokenList *tokens);
+/* NULL after reporting errors */
 ASTNode *parser_parse(Parser *p);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,1144 @@
+#include "typecheck.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+/* ========== Environment ========== */
+
+typedef struct Binding {
+    const char *name;
+    Type *type;               /* borrowed from the node that introduced it */
+    struct Binding *next;
+} Binding;
+
+typedef struct Env {
+    Binding *bindings;
+    struct Env *parent;
+} Env;
+
+typedef struct KernelSig {
+    ASTNode *node;
+    struct KernelSig *next;
+} KernelSig;
+
+typedef struct {
+    Env *env;
+    KernelSig *kernels;
+    int in_kernel;
+    int quiet;          /* > 0 while a recursive lambda is pre-checked */
+    int errors;
+} Checker;
+
+static void env_push(Checker *tc) {
+    Env *env = calloc(1, sizeof(Env));
+    env->parent = tc->env;
+    tc->env = env;
+}
+
+static void env_pop(Checker *tc) {
+    Env *env = tc->env;
+    tc->env = env->parent;
+    while (env->bindings) {
+        Binding *next = env->bindings->next;
+        free(env->bindings);
+        env->bindings = next;
+    }
+    free(env);
+}
+
+static void env_bind(Checker *tc, const char *name, Type *type) {
+    Binding *b = malloc(sizeof(Binding));
+    b->name = name;
+    b->type = type;
+    b->next = tc->env->bindings;
+    tc->env->bindings = b;
+}
+
+static Type *env_lookup(Checker *tc, const char *name) {
+    for (Env *env = tc->env; env; env = env->parent)
+        for (Binding *b = env->bindings; b; b = b->next)
+            if (strcmp(b->name, name) == 0) return b->type;
+    return NULL;
+}
+
+static ASTNode *kernel_lookup(Checker *tc, const char *name) {
+    for (KernelSig *k = tc->kernels; k; k = k->next)
+        if (strcmp(k->node->data.gpu_kernel.name, name) == 0) return k->node;
+    return NULL;
+}
+
+static void error(Checker *tc, ASTNode *node, const char *fmt, ...) {
+    if (tc->quiet) return;
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "E: %u:%u: ", node->line, node->col);
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    tc->errors++;
+}
+
+/* ========== Type Predicates ========== */
+
+static int is_int(Type *t)   { return t && t->kind >= TYPE_I8 && t->kind <= TYPE_U64; }
+static int is_float(Type *t) { return t && (t->kind == TYPE_F32 || t->kind == TYPE_F64); }
+static int is_bool(Type *t)  { return t && t->kind == TYPE_BOOL; }
+static int is_unknown(Type *t) { return !t || t->kind == TYPE_UNKNOWN; }
+static int is_numeric(Type *t) { return is_int(t) || is_float(t) || is_bool(t); }
+static int is_vector(Type *t) { return t && t->kind == TYPE_VECTOR; }
+static int is_mask(Type *t)   { return is_vector(t) && is_bool(t->inner); }
+
+static int int_bits(Type *t) {
+    switch (t->kind) {
+        case TYPE_I8:  case TYPE_U8:  return 8;
+        case TYPE_I16: case TYPE_U16: return 16;
+        case TYPE_I32: case TYPE_U32: return 32;
+        default:                      return 64;
+    }
+}
+
+/* A task's result slot, LP_TASK_RESULT in runtime/runtime.h */
+#define TASK_RESULT_BITS 128
+
+/* Scalars, arrays and closures all fit a task's result; a vector may not */
+static int fits_task_result(Type *t) {
+    if (!is_vector(t)) return 1;
+    int lane = is_bool(t->inner) ? 1 : t->inner->kind == TYPE_F32 ? 32 :
+               t->inner->kind == TYPE_F64 ? 64 : int_bits(t->inner);
+    return t->array_len * lane <= TASK_RESULT_BITS;
+}
+
+static const char *type_name(Type *t);
+
+/* [T], [T; N] or TxN, in one of a few rotating buffers so two can share a message */
+static const char *array_name(Type *t) {
+    static char bufs[4][64];
+    static int next;
+    char *buf = bufs[next++ % 4];
+    if (t->kind == TYPE_VECTOR) snprintf(buf, 64, "%sx%zu", type_name(t->inner), t->array_len);
+    else if (t->array_len) snprintf(buf, 64, "[%s; %zu]", type_name(t->inner), t->array_len);
+    else snprintf(buf, 64, "[%s]", type_name(t->inner));
+    return buf;
+}
+
+static const char *type_name(Type *t) {
+    if (!t) return "unknown";
+    switch (t->kind) {
+        case TYPE_VOID:  return "void";
+        case TYPE_BOOL:  return "bool";
+        case TYPE_I8:    return "i8";
+        case TYPE_I16:   return "i16";
+        case TYPE_I32:   return "i32";
+        case TYPE_I64:   return "i64";
+        case TYPE_U8:    return "u8";
+        case TYPE_U16:   return "u16";
+        case TYPE_U32:   return "u32";
+        case TYPE_U64:   return "u64";
+        case TYPE_F32:   return "f32";
+        case TYPE_F64:   return "f64";
+        case TYPE_STR:   return "str";
+        case TYPE_PTR:   return "ptr";
+        case TYPE_ARRAY: return array_name(t);
+        case TYPE_VECTOR: return array_name(t);
+        case TYPE_FUNC:  return "function";
+        case TYPE_ASYNC: return "task";
+        default:         return "unknown";
+    }
+}
+
+/* Exact equality, for array elements, which are never converted */
+static int same_type(Type *a, Type *b) {
+    if (is_unknown(a) || is_unknown(b)) return 1;
+    if (a->kind != b->kind) return 0;
+    if (a->kind == TYPE_ARRAY || a->kind == TYPE_VECTOR)
+        return a->array_len == b->array_len && same_type(a->inner, b->inner);
+    return 1;
+}
+
+/*
+ * Common type of two operands, mirroring codegen's unify_operands:
+ * float beats int, the wider float or int wins, and an int is unsigned if
+ * either side is. Returns NULL if the types do not mix.
+ */
+static Type *join(Type *a, Type *b) {
+    if (is_unknown(a) || is_unknown(b)) return type_new(TYPE_UNKNOWN);
+    if (a->kind == TYPE_ARRAY && b->kind == TYPE_ARRAY) {
+        if (!same_type(a->inner, b->inner)) return NULL;
+        Type *t = type_clone(a);
+        if (a->array_len != b->array_len) t->array_len = 0;
+        return t;
+    }
+    if (is_vector(a) || is_vector(b)) return same_type(a, b) ? type_clone(a) : NULL;
+    if (a->kind == b->kind) return type_clone(a);
+    if (is_float(a) && is_float(b)) return type_new(TYPE_F64);
+    if (is_float(a) && is_numeric(b)) return type_clone(a);
+    if (is_float(b) && is_numeric(a)) return type_clone(b);
+    if (is_bool(a) && is_int(b)) return type_clone(b);
+    if (is_bool(b) && is_int(a)) return type_clone(a);
+    if (is_int(a) && is_int(b)) {
+        int bits = int_bits(a) > int_bits(b) ? int_bits(a) : int_bits(b);
+        int is_unsigned = a->kind >= TYPE_U8 || b->kind >= TYPE_U8;
+        switch (bits) {
+            case 8:  return type_new(is_unsigned ? TYPE_U8 : TYPE_I8);
+            case 16: return type_new(is_unsigned ? TYPE_U16 : TYPE_I16);
+            case 32: return type_new(is_unsigned ? TYPE_U32 : TYPE_I32);
+            default: return type_new(is_unsigned ? TYPE_U64 : TYPE_I64);
+        }
+    }
+    return NULL;
+}
+
+/* Whether a value of type from may initialise or be passed as type to */
+static int assignable(Type *to, Type *from) {
+    if (is_unknown(to) || is_unknown(from)) return 1;
+    if (is_numeric(to) && is_numeric(from)) return 1;
+    if ((to->kind == TYPE_PTR && from->kind == TYPE_STR) ||
+        (to->kind == TYPE_STR && from->kind == TYPE_PTR)) return 1;
+    if (to->kind == TYPE_ARRAY && from->kind == TYPE_ARRAY) {
+        /* [T; N] is also a [T] */
+        return same_type(to->inner, from->inner) &&
+               (to->array_len == 0 || to->array_len == from->array_len);
+    }
+    if (is_vector(to) || is_vector(from)) return same_type(to, from);
+    return to->kind == from->kind;
+}
+
+/* A literal, possibly negated, whose type comes from its context */
+static int is_literal(ASTNode *node) {
+    if (!node) return 0;
+    if (node->type == NODE_UNARY && node->data.unary.op == OP_NEG)
+        return is_literal(node->data.unary.operand);
+    return node->type == NODE_INT_LIT || node->type == NODE_FLOAT_LIT;
+}
+
+/* ========== Inference ========== */
+
+/* Type of statements and empty parses, never owned by a node */
+static Type void_type = { .kind = TYPE_VOID };
+
+static Type *infer(Checker *tc, ASTNode *node, Type *expected);
+static Type *infer_lambda(Checker *tc, ASTNode *node, const char *self_name);
+
+/* Replaces node's type (taking ownership of t) and returns it */
+static Type *set_type(ASTNode *node, Type *t) {
+    type_free(node->resolved_type);
+    node->resolved_type = t;
+    return t;
+}
+
+static Type *infer_int_lit(ASTNode *node, Type *expected) {
+    if (is_float(expected)) {
+        /* 1 in a float context is 1.0 */
+        double v = (double)node->data.int_val;
+        node->type = NODE_FLOAT_LIT;
+        node->data.float_val = v;
+        return set_type(node, type_clone(expected));
+    }
+    if (is_int(expected)) return set_type(node, type_clone(expected));
+    if (is_bool(expected) && (node->data.int_val == 0 || node->data.int_val == 1))
+        return set_type(node, type_clone(expected));
+    return set_type(node, type_new(TYPE_I64));
+}
+
+/* Infer both operands, letting a literal side adopt the other side's type */
+static void infer_operands(Checker *tc, ASTNode *left, ASTNode *right, Type *hint,
+                           Type **lt, Type **rt) {
+    if (is_literal(left) && !is_literal(right)) {
+        *rt = infer(tc, right, hint);
+        *lt = infer(tc, left, *rt);
+    } else if (is_literal(right) && !is_literal(left)) {
+        *lt = infer(tc, left, hint);
+        *rt = infer(tc, right, *lt);
+    } else {
+        *lt = infer(tc, left, hint);
+        *rt = infer(tc, right, hint);
+    }
+}
+
+/* boolxN with the lanes of t */
+static Type *mask_of(Type *t) {
+    Type *m = type_new(TYPE_VECTOR);
+    m->inner = type_new(TYPE_BOOL);
+    m->array_len = t->array_len;
+    return m;
+}
+
+/*
+ * The operand paired with vector type vt, which is either the same vector
+ * or a scalar broadcast to every lane; a literal takes the lanes' type.
+ * Returns 0 after reporting a mismatch.
+ */
+static int check_lanes_operand(Checker *tc, ASTNode *node, ASTNode *operand, Type *t, Type *vt) {
+    if (is_vector(t)) {
+        if (same_type(t, vt)) return 1;
+        error(tc, node, "vector operands %s and %s differ", type_name(vt), type_name(t));
+        return 0;
+    }
+    if (is_literal(operand)) t = infer(tc, operand, vt->inner);
+    /* Only float lanes take a float */
+    Type *lane = vt->inner;
+    if (is_unknown(t) || (is_bool(lane) ? is_bool(t) : is_float(lane) ? is_int(t) || is_float(t)
+                                                                      : is_int(t))) return 1;
+    error(tc, node, "cannot combine %s with %s", type_name(t), type_name(vt));
+    return 0;
+}
+
+/* Operators on vectors work lane by lane; comparisons give a mask */
+static Type *infer_vector_binary(Checker *tc, ASTNode *node, Type *lt, Type *rt) {
+    Operator op = node->data.binary.op;
+    Type *vt = is_vector(lt) ? lt : rt;
+    int compare = op >= OP_EQ && op <= OP_GTE;
+    int bitwise = op >= OP_BITAND && op <= OP_SHR;
+    
+    int ok = is_vector(lt) ? check_lanes_operand(tc, node, node->data.binary.right, rt, vt)
+                           : check_lanes_operand(tc, node, node->data.binary.left, lt, vt);
+    if (!ok) return type_new(TYPE_UNKNOWN);
+    if (compare) return mask_of(vt);
+    if (is_mask(vt) && !bitwise) {
+        error(tc, node, "arithmetic on a mask; combine masks with & | ^");
+        return type_new(TYPE_UNKNOWN);
+    }
+    if (bitwise && is_float(vt->inner)) {
+        error(tc, node, "bitwise operator on a float");
+        return type_new(TYPE_UNKNOWN);
+    }
+    return type_clone(vt);
+}
+
+static Type *infer_binary(Checker *tc, ASTNode *node, Type *expected) {
+    Operator op = node->data.binary.op;
+    ASTNode *left = node->data.binary.left;
+    ASTNode *right = node->data.binary.right;
+    
+    if (op == OP_AND || op == OP_OR) {
+        Type *lt = infer(tc, left, NULL);
+        Type *rt = infer(tc, right, NULL);
+        if (is_vector(lt) || is_vector(rt)) {
+            error(tc, node, "%s on a vector; combine masks with & and |", op == OP_AND ? "&&" : "||");
+        }
+        return set_type(node, type_new(TYPE_BOOL));
+    }
+    
+    int compare = op >= OP_EQ && op <= OP_GTE;
+    int bitwise = op >= OP_BITAND && op <= OP_SHR;
+    Type *hint = (!compare && (is_int(expected) || is_float(expected) || is_vector(expected)))
+               ? expected : NULL;
+    Type *lt, *rt;
+    infer_operands(tc, left, right, hint, &lt, &rt);
+    if (is_unknown(lt) || is_unknown(rt)) {
+        return set_type(node, type_new(compare ? TYPE_BOOL : TYPE_UNKNOWN));
+    }
+    if (is_vector(lt) || is_vector(rt)) return set_type(node, infer_vector_binary(tc, node, lt, rt));
+    
+    if (compare) {
+        if (!(is_numeric(lt) && is_numeric(rt)) && !assignable(lt, rt)) {
+            error(tc, node, "cannot compare %s with %s", type_name(lt), type_name(rt));
+        }
+        return set_type(node, type_new(TYPE_BOOL));
+    }
+    
+    if (!is_numeric(lt) || !is_numeric(rt)) {
+        error(tc, node, "arithmetic on %s and %s", type_name(lt), type_name(rt));
+        return set_type(node, type_new(TYPE_UNKNOWN));
+    }
+    if (bitwise && (is_float(lt) || is_float(rt))) {
+        error(tc, node, "bitwise operator on a float");
+        return set_type(node, type_new(TYPE_UNKNOWN));
+    }
+    
+    /* Arithmetic on comparison results counts in i64, as in C */
+    if (!bitwise && is_bool(lt) && is_bool(rt)) return set_type(node, type_new(TYPE_I64));
+    return set_type(node, join(lt, rt));
+}
+
+static Type *infer_unary(Checker *tc, ASTNode *node, Type *expected) {
+    ASTNode *operand = node->data.unary.operand;
+    
+    if (node->data.unary.op == OP_NOT) {
+        Type *t = infer(tc, operand, NULL);
+        if (is_mask(t)) return set_type(node, type_clone(t));
+        if (is_vector(t)) error(tc, node, "! on a vector; compare its lanes instead");
+        return set_type(node, type_new(TYPE_BOOL));
+    }
+    
+    Type *t = infer(tc, operand, expected);
+    if (is_vector(t) && !is_mask(t)) return set_type(node, type_clone(t));
+    if (!is_unknown(t) && !is_numeric(t)) {
+        error(tc, node, "cannot negate %s", type_name(t));
+        return set_type(node, type_new(TYPE_UNKNOWN));
+    }
+    return set_type(node, type_clone(t));
+}
+
+/* Ternary arms and if blocks; an if with a missing or valueless arm is void */
+static Type *infer_if(Checker *tc, ASTNode *node, Type *expected) {
+    ASTNode *then_node = node->data.ternary.then_branch;
+    ASTNode *else_node = node->data.ternary.else_branch;
+    
+    Type *tt, *et = NULL;
+    if (is_vector(infer(tc, node->data.ternary.cond, NULL))) {
+        error(tc, node->data.ternary.cond, "condition is a vector; pick lanes with @select");
+    }
+    if (node->type == NODE_TERNARY) {
+        infer_operands(tc, then_node, else_node, expected, &tt, &et);
+    } else {
+        tt = infer(tc, then_node, expected);
+        if (else_node) et = infer(tc, else_node, expected);
+    }
+    
+    if (!else_node || tt->kind == TYPE_VOID || et->kind == TYPE_VOID) {
+        return set_type(node, type_new(TYPE_VOID));
+    }
+    
+    /* An arm that recurses into a lambda still being inferred has no type yet */
+    Type *t = is_unknown(tt) ? type_clone(et) : is_unknown(et) ? type_clone(tt) : join(tt, et);
+    if (!t) {
+        if (node->type == NODE_TERNARY) {
+            error(tc, node, "ternary arms have types %s and %s", type_name(tt), type_name(et));
+        }
+        t = type_new(node->type == NODE_TERNARY ? TYPE_UNKNOWN : TYPE_VOID);
+    }
+    return set_type(node, t);
+}
+
+/* Statements of a block in the current scope; returns the last one's type */
+static Type *infer_stmts(Checker *tc, ASTNode *block, Type *expected) {
+    Type *last = NULL;
+    for (size_t i = 0; i < block->data.block.count; i++) {
+        int is_last = i + 1 == block->data.block.count;
+        last = infer(tc, block->data.block.stmts[i], is_last ? expected : NULL);
+    }
+    return last;
+}
+
+static Type *infer_let(Checker *tc, ASTNode *node) {
+    Type *annotation = node->data.let.type_annotation;
+    ASTNode *value = node->data.let.value;
+    Type *t = value->type == NODE_LAMBDA ? infer_lambda(tc, value, node->data.let.name)
+                                         : infer(tc, value, annotation);
+    
+    if (annotation) {
+        if (!assignable(annotation, t)) {
+            error(tc, node, "cannot initialise '%s: %s' with %s", node->data.let.name,
+                  type_name(annotation), type_name(t));
+        }
+        env_bind(tc, node->data.let.name, annotation);
+    } else {
+        if (t->kind == TYPE_VOID) {
+            error(tc, node, "'%s' is initialised with no value", node->data.let.name);
+        }
+        env_bind(tc, node->data.let.name, t);
+    }
+    return set_type(node, type_new(TYPE_VOID));
+}
+
+static Type *infer_for(Checker *tc, ASTNode *node) {
+    Type *i64 = type_new(TYPE_I64);
+    Type *st = infer(tc, node->data.for_loop.start, i64);
+    Type *et = infer(tc, node->data.for_loop.end, i64);
+    if ((!is_unknown(st) && !is_int(st)) || (!is_unknown(et) && !is_int(et))) {
+        error(tc, node, "loop bounds must be integers");
+    }
+    
+    const char *reduce_var = node->data.for_loop.reduce_var;
+    Type *outer = reduce_var ? env_lookup(tc, reduce_var) : NULL;
+    
+    env_push(tc);
+    env_bind(tc, node->data.for_loop.var, i64);
+    Type *last = infer_stmts(tc, node->data.for_loop.body, outer);
+    set_type(node->data.for_loop.body, type_new(TYPE_VOID));
+    env_pop(tc);
+    
+    if (reduce_var) {
+        /* Bound to the loop node's own type, so it outlives the body */
+        Type *red = outer ? type_clone(outer)
+                  : (last && !is_bool(last)) ? type_clone(last) : type_new(TYPE_I64);
+        if (!last || last->kind == TYPE_VOID) {
+            error(tc, node, "reduce %s: loop body must end in an expression", reduce_var);
+        } else if (red->kind == TYPE_VOID) {
+            error(tc, node, "reduction body yields no value");
+        } else if (is_vector(red)) {
+            error(tc, node, "reduction over a vector; fold its lanes with @reduce_add first");
+        } else if (is_float(red) && node->data.for_loop.reduce_op >= OP_BITAND &&
+                   node->data.for_loop.reduce_op <= OP_BITXOR) {
+            error(tc, node, "bitwise reduction over a float");
+        }
+        set_type(node, red);
+        env_bind(tc, reduce_var, node->resolved_type);
+    } else {
+        set_type(node, type_new(TYPE_VOID));
+    }
+    type_free(i64);
+    return node->resolved_type;
+}
+
+/* [T] of element kind, with length known only at run time */
+static Type *array_of(int kind) {
+    Type *t = type_new(TYPE_ARRAY);
+    t->inner = type_new(kind);
+    return t;
+}
+
+/* ========== Vector Builtins ========== */
+
+/* Vector type a lanes builtin produces, taken from the value it initialises */
+static Type *lanes_context(Checker *tc, ASTNode *node, Type *expected) {
+    if (is_vector(expected)) return expected;
+    error(tc, node, "@%s needs a vector type from its context, as in let v: f32x8 = @%s(...)",
+          node->data.builtin.name, node->data.builtin.name);
+    return NULL;
+}
+
+/* The array and index of @load / @store; elem is the lanes' type, if known */
+static void check_lanes_access(Checker *tc, ASTNode *node, Type *elem) {
+    ASTNode **args = node->data.builtin.elements;
+    Type *at = infer(tc, args[0], NULL);
+    Type *i64 = type_new(TYPE_I64);
+    Type *it = infer(tc, args[1], i64);
+    type_free(i64);
+    
+    if (!is_int(it) && !is_unknown(it)) error(tc, args[1], "array index must be an integer");
+    if (is_unknown(at) || !elem) return;
+    if (at->kind != TYPE_ARRAY || is_bool(at->inner) || !same_type(at->inner, elem)) {
+        error(tc, args[0], "@%s of %s lanes needs a [%s], got %s", node->data.builtin.name,
+              type_name(elem), type_name(elem), type_name(at));
+    }
+}
+
+/* Optional last argument of @load / @store: which lanes take part */
+static void check_mask(Checker *tc, ASTNode *arg, Type *vt) {
+    Type *mask = vt ? mask_of(vt) : NULL;
+    Type *t = infer(tc, arg, mask);
+    if (mask && !is_unknown(t) && !same_type(t, mask)) {
+        error(tc, arg, "mask must be %s, got %s", type_name(mask), type_name(t));
+    }
+    type_free(mask);
+}
+
+/* @shuffle(v, lanes...) or @shuffle(v, w, lanes...), lanes constant */
+static Type *infer_shuffle(Checker *tc, ASTNode *node) {
+    ASTNode **args = node->data.builtin.elements;
+    size_t count = node->data.builtin.count;
+    Type *vt = count >= 2 ? infer(tc, args[0], NULL) : NULL;
+    if (!is_vector(vt)) {
+        error(tc, node, "@shuffle takes one or two vectors and constant lane numbers");
+        for (size_t i = vt ? 1 : 0; i < count; i++) infer(tc, args[i], NULL);
+        return type_new(TYPE_UNKNOWN);
+    }
+    
+    size_t first = 1;
+    if (args[1]->type != NODE_INT_LIT) {
+        Type *wt = infer(tc, args[1], vt);
+        if (!same_type(wt, vt)) error(tc, args[1], "@shuffle of %s and %s", type_name(vt), type_name(wt));
+        first = 2;
+    }
+    size_t limit = vt->array_len * first;
+    for (size_t i = first; i < count; i++) {
+        infer(tc, args[i], NULL);
+        if (args[i]->type != NODE_INT_LIT || args[i]->data.int_val < 0 ||
+            (size_t)args[i]->data.int_val >= limit) {
+            error(tc, args[i], "shuffle lanes must be constants below %zu", limit);
+        }
+    }
+    size_t lanes = count - first;
+    if (lanes < 2 || lanes > 64) {
+        error(tc, node, "@shuffle must pick 2 to 64 lanes, got %zu", lanes);
+        return type_new(TYPE_UNKNOWN);
+    }
+    Type *t = type_new(TYPE_VECTOR);
+    t->inner = type_clone(vt->inner);
+    t->array_len = lanes;
+    return t;
+}
+
+/* @select(mask, a, b): a's lanes where mask is set, else b's; either may be a scalar */
+static Type *infer_select(Checker *tc, ASTNode *node, Type *expected) {
+    ASTNode **args = node->data.builtin.elements;
+    if (node->data.builtin.count != 3) {
+        error(tc, node, "@select takes a mask and two values");
+        for (size_t i = 0; i < node->data.builtin.count; i++) infer(tc, args[i], NULL);
+        return type_new(TYPE_UNKNOWN);
+    }
+    Type *mt = infer(tc, args[0], NULL);
+    Type *at, *bt;
+    infer_operands(tc, args[1], args[2], is_vector(expected) ? expected : NULL, &at, &bt);
+    if (is_unknown(mt) || is_unknown(at) || is_unknown(bt)) return type_new(TYPE_UNKNOWN);
+    
+    Type *vt = is_vector(at) ? at : bt;
+    if (!is_mask(mt) || !is_vector(vt) || mt->array_len != vt->array_len) {
+        error(tc, node, "@select needs a mask and values of the same lanes, got %s, %s and %s",
+              type_name(mt), type_name(at), type_name(bt));
+        return type_new(TYPE_UNKNOWN);
+    }
+    int ok = vt == at ? check_lanes_operand(tc, node, args[2], bt, vt)
+                      : check_lanes_operand(tc, node, args[1], at, vt);
+    return ok ? type_clone(vt) : type_new(TYPE_UNKNOWN);
+}
+
+/*
+ * Lanes builtins, or NULL if name is not one. @reduce_add of a mask counts
+ * its set lanes; @reduce_max and @reduce_min of a mask are any and all.
+ */
+static Type *infer_vector_builtin(Checker *tc, ASTNode *node, Type *expected) {
+    const char *name = node->data.builtin.name;
+    ASTNode **args = node->data.builtin.elements;
+    size_t count = node->data.builtin.count;
+    
+    if (strcmp(name, "splat") == 0) {
+        Type *vt = lanes_context(tc, node, expected);
+        Type *t = count == 1 ? infer(tc, args[0], vt ? vt->inner : NULL) : NULL;
+        if (!t) {
+            error(tc, node, "@splat takes one value");
+        } else if (vt && !is_unknown(t) && (is_vector(t) || !assignable(vt->inner, t))) {
+            error(tc, args[0], "cannot splat %s into %s", type_name(t), type_name(vt));
+        }
+        return vt ? type_clone(vt) : type_new(TYPE_UNKNOWN);
+    }
+    
+    if (strcmp(name, "load") == 0) {
+        Type *vt = lanes_context(tc, node, expected);
+        if (count != 2 && count != 3) {
+            error(tc, node, "@load takes an array, an index and optionally a mask");
+            for (size_t i = 0; i < count; i++) infer(tc, args[i], NULL);
+            return type_new(TYPE_UNKNOWN);
+        }
+        check_lanes_access(tc, node, vt ? vt->inner : NULL);
+        if (count == 3) check_mask(tc, args[2], vt);
+        return vt ? type_clone(vt) : type_new(TYPE_UNKNOWN);
+    }
+    
+    if (strcmp(name, "store") == 0) {
+        if (count != 3 && count != 4) {
+            error(tc, node, "@store takes an array, an index, a vector and optionally a mask");
+            for (size_t i = 0; i < count; i++) infer(tc, args[i], NULL);
+            return type_new(TYPE_VOID);
+        }
+        Type *vt = infer(tc, args[2], NULL);
+        if (!is_vector(vt) && !is_unknown(vt)) {
+            error(tc, args[2], "@store writes a vector, got %s", type_name(vt));
+        }
+        vt = is_vector(vt) ? vt : NULL;
+        check_lanes_access(tc, node, vt ? vt->inner : NULL);
+        if (count == 4) check_mask(tc, args[3], vt);
+        return type_new(TYPE_VOID);
+    }
+    
+    if (strcmp(name, "shuffle") == 0) return infer_shuffle(tc, node);
+    if (strcmp(name, "select") == 0) return infer_select(tc, node, expected);
+    
+    if (strcmp(name, "reduce_add") == 0 || strcmp(name, "reduce_max") == 0 ||
+        strcmp(name, "reduce_min") == 0) {
+        Type *t = count == 1 ? infer(tc, args[0], NULL) : NULL;
+        if (!is_vector(t)) {
+            if (!t || !is_unknown(t)) error(tc, node, "@%s takes one vector", name);
+            return type_new(TYPE_UNKNOWN);
+        }
+        if (is_mask(t) && strcmp(name, "reduce_add") == 0) return type_new(TYPE_I64);
+        return type_clone(t->inner);
+    }
+    return NULL;
+}
+
+/* ========== Math Builtins ========== */
+
+/* What the arguments of a math or bit builtin may be */
+typedef enum { ARGS_FLOAT, ARGS_NUMBER, ARGS_INT } ArgKind;
+
+typedef struct {
+    const char *name;
+    size_t args;
+    ArgKind kind;
+} MathBuiltin;
+
+static const MathBuiltin math_builtins[] = {
+    { "sqrt", 1, ARGS_FLOAT },    { "floor", 1, ARGS_FLOAT },   { "ceil", 1, ARGS_FLOAT },
+    { "exp", 1, ARGS_FLOAT },     { "log", 1, ARGS_FLOAT },     { "sin", 1, ARGS_FLOAT },
+    { "cos", 1, ARGS_FLOAT },     { "pow", 2, ARGS_FLOAT },     { "fma", 3, ARGS_FLOAT },
+    { "abs", 1, ARGS_NUMBER },    { "min", 2, ARGS_NUMBER },    { "max", 2, ARGS_NUMBER },
+    { "popcount", 1, ARGS_INT },  { "clz", 1, ARGS_INT },       { "ctz", 1, ARGS_INT },
+    { "bswap", 1, ARGS_INT },     { "rotl", 2, ARGS_INT },      { "rotr", 2, ARGS_INT },
+};
+
+static const MathBuiltin *math_builtin(const char *name) {
+    for (size_t i = 0; i < sizeof(math_builtins) / sizeof(math_builtins[0]); i++)
+        if (strcmp(math_builtins[i].name, name) == 0) return &math_builtins[i];
+    return NULL;
+}
+
+/* Type of an operand list: the vector among them, else the scalars joined */
+static Type *join_operands(Checker *tc, ASTNode *node, ASTNode **args, Type **types, size_t count) {
+    Type *vt = NULL;
+    for (size_t i = 0; i < count; i++) {
+        if (is_unknown(types[i])) return type_new(TYPE_UNKNOWN);
+        if (is_vector(types[i]) && !vt) vt = types[i];
+    }
+    if (vt) {
+        for (size_t i = 0; i < count; i++) {
+            if (types[i] != vt && !check_lanes_operand(tc, node, args[i], types[i], vt)) {
+                return type_new(TYPE_UNKNOWN);
+            }
+        }
+        return type_clone(vt);
+    }
+    
+    Type *t = type_clone(types[0]);
+    for (size_t i = 1; i < count; i++) {
+        Type *j = join(t, types[i]);
+        type_free(t);
+        if (!j) {
+            error(tc, node, "@%s of %s and %s", node->data.builtin.name,
+                  type_name(types[i - 1]), type_name(types[i]));
+            return type_new(TYPE_UNKNOWN);
+        }
+        t = j;
+    }
+    return t;
+}
+
+/*
+ * Math and bit builtins work on a scalar, or lane by lane on a vector. The
+ * operands share one type, literals and broadcast scalars adopting the
+ * others'; an integer given to a float function converts to f64. The
+ * rotate amount of @rotl / @rotr may be any integer.
+ */
+static Type *infer_math_builtin(Checker *tc, ASTNode *node, const MathBuiltin *mb, Type *expected) {
+    ASTNode **args = node->data.builtin.elements;
+    size_t count = node->data.builtin.count;
+    if (count != mb->args) {
+        error(tc, node, "@%s takes %zu argument%s", mb->name, mb->args, mb->args == 1 ? "" : "s");
+        for (size_t i = 0; i < count; i++) infer(tc, args[i], NULL);
+        return type_new(TYPE_UNKNOWN);
+    }
+    size_t operands = mb->kind == ARGS_INT ? 1 : count;
+    
+    /* Literals go last, so they can take the type of the other operands */
+    Type *lane = is_vector(expected) ? expected->inner : expected;
+    Type *hint = (mb->kind == ARGS_FLOAT ? is_float(lane) : mb->kind == ARGS_INT ? is_int(lane)
+                                                           : is_float(lane) || is_int(lane)) ? expected : NULL;
+    Type *types[3] = { NULL, NULL, NULL };
+    Type *known = NULL;
+    for (size_t i = 0; i < operands; i++) {
+        if (is_literal(args[i])) continue;
+        types[i] = infer(tc, args[i], hint);
+        if (!known || is_vector(types[i])) known = types[i];
+    }
+    Type *lit_hint = known ? (is_vector(known) ? known->inner : known)
+                           : (hint && is_vector(hint) ? hint->inner : hint);
+    for (size_t i = 0; i < operands; i++) {
+        if (!types[i]) types[i] = infer(tc, args[i], lit_hint);
+    }
+    Type *t = join_operands(tc, node, args, types, operands);
+    if (is_unknown(t)) return t;
+    
+    Type *elem = is_vector(t) ? t->inner : t;
+    if (mb->kind == ARGS_FLOAT && !is_vector(t) && (is_int(t) || is_bool(t))) {
+        type_free(t);
+        return type_new(TYPE_F64);
+    }
+    int ok = mb->kind == ARGS_FLOAT ? is_float(elem)
+           : mb->kind == ARGS_INT ? is_int(elem) : is_float(elem) || is_int(elem);
+    if (!ok) {
+        error(tc, node, "@%s takes %s, got %s", mb->name,
+              mb->kind == ARGS_FLOAT ? "floats" : mb->kind == ARGS_INT ? "integers" : "numbers",
+              type_name(t));
+    } else if (strcmp(mb->name, "bswap") == 0 && int_bits(elem) == 8) {
+        error(tc, node, "@bswap of a single byte");
+        ok = 0;
+    } else if (count == 2 && mb->kind == ARGS_INT) {
+        Type *amount = infer(tc, args[1], elem);
+        if (!is_unknown(amount) && !is_int(amount) && !(is_vector(t) && same_type(amount, t))) {
+            error(tc, args[1], "rotate amount must be an integer, got %s", type_name(amount));
+            ok = 0;
+        }
+    }
+    if (ok) return t;
+    type_free(t);
+    return type_new(TYPE_UNKNOWN);
+}
+
+static Type *infer_builtin(Checker *tc, ASTNode *node, Type *expected) {
+    const char *name = node->data.builtin.name;
+    ASTNode **args = node->data.builtin.elements;
+    size_t count = node->data.builtin.count;
+    
+    Type *lanes = infer_vector_builtin(tc, node, expected);
+    if (lanes) return set_type(node, lanes);
+    
+    const MathBuiltin *math = math_builtin(name);
+    if (math) return set_type(node, infer_math_builtin(tc, node, math, expected));
+    
+    if (strcmp(name, "print") == 0) {
+        for (size_t i = 0; i < count; i++) {
+            Type *t = infer(tc, args[i], NULL);
+            if (t->kind == TYPE_ARRAY) error(tc, args[i], "cannot print an array; print its elements");
+            if (is_vector(t)) error(tc, args[i], "cannot print a vector; print its lanes");
+        }
+        return set_type(node, type_new(TYPE_VOID));
+    }
+    
+    if (strcmp(name, "len") == 0) {
+        Type *t = count == 1 ? infer(tc, args[0], NULL) : NULL;
+        if (!t || (t->kind != TYPE_ARRAY && !is_unknown(t))) {
+            error(tc, node, "@len takes one array");
+        }
+        return set_type(node, type_new(TYPE_I64));
+    }
+    
+    if (strcmp(name, "mmap") == 0) {
+        Type *t = count == 1 ? infer(tc, args[0], NULL) : NULL;
+        if (!t || (t->kind != TYPE_STR && !is_unknown(t))) {
+            error(tc, node, "@mmap takes a file path");
+        }
+        return set_type(node, array_of(TYPE_U8));
+    }
+    
+    if (strcmp(name, "lines") == 0) {
+        Type *t = count == 1 ? infer(tc, args[0], NULL) : NULL;
+        if (!t || (!is_unknown(t) && (t->kind != TYPE_ARRAY || t->inner->kind != TYPE_U8))) {
+            error(tc, node, "@lines takes a [u8] array");
+        }
+        return set_type(node, array_of(TYPE_I64));
+    }
+    
+    if (strcmp(name, "slice") == 0) {
+        Type *t = count == 3 ? infer(tc, args[0], NULL) : NULL;
+        if (!t || (t->kind != TYPE_ARRAY && !is_unknown(t))) {
+            error(tc, node, "@slice takes an array and two bounds");
+            for (size_t i = t ? 1 : 0; i < count; i++) infer(tc, args[i], NULL);
+            return set_type(node, type_new(TYPE_UNKNOWN));
+        }
+        Type *i64 = type_new(TYPE_I64);
+        for (size_t i = 1; i < 3; i++) {
+            Type *bt = infer(tc, args[i], i64);
+            if (!is_int(bt) && !is_unknown(bt)) error(tc, args[i], "slice bounds must be integers");
+        }
+        type_free(i64);
+        if (is_unknown(t)) return set_type(node, type_new(TYPE_UNKNOWN));
+        
+        /* A view of any length */
+        Type *view = type_clone(t);
+        view->array_len = 0;
+        return set_type(node, view);
+    }
+    
+    if (strcmp(name, "likely") == 0 || strcmp(name, "unlikely") == 0) {
+        if (count != 1) {
+            error(tc, node, "@%s takes one argument", name);
+            return set_type(node, type_new(TYPE_UNKNOWN));
+        }
+        return set_type(node, type_clone(infer(tc, args[0], NULL)));
+    }
+    
+    if (strcmp(name, "index") == 0 || strcmp(name, "count") == 0) {
+        if (!tc->in_kernel) error(tc, node, "@%s outside a gpu kernel", name);
+        return set_type(node, type_new(TYPE_I64));
+    }
+    
+    if (strcmp(name, "launch") == 0) {
+        ASTNode *kernel = (count >= 2 && args[0]->type == NODE_IDENT)
+                        ? kernel_lookup(tc, args[0]->data.ident.name) : NULL;
+        if (!kernel) {
+            error(tc, node, "@launch needs a gpu kernel and a count");
+            for (size_t i = 1; i < count; i++) infer(tc, args[i], NULL);
+            return set_type(node, type_new(TYPE_VOID));
+        }
+        set_type(args[0], type_new(TYPE_FUNC));
+        
+        Type *i64 = type_new(TYPE_I64);
+        Type *nt = infer(tc, args[1], i64);
+        if (!is_int(nt) && !is_unknown(nt)) {
+            error(tc, args[1], "@launch count must be an integer");
+        }
+        type_free(i64);
+        
+        size_t nparams = kernel->data.gpu_kernel.param_count;
+        if (count - 2 != nparams) {
+            error(tc, node, "kernel '%s' takes %zu arguments, got %zu",
+                  kernel->data.gpu_kernel.name, nparams, count - 2);
+        }
+        for (size_t i = 2; i < count; i++) {
+            Type *param = i - 2 < nparams ? kernel->data.gpu_kernel.param_types[i - 2] : NULL;
+            Type *t = infer(tc, args[i], param);
+            if (param && !assignable(param, t)) {
+                error(tc, args[i], "cannot pass %s as %s", type_name(t), type_name(param));
+            }
+        }
+        return set_type(node, type_new(TYPE_VOID));
+    }
+    
+    error(tc, node, "unknown builtin @%s", name);
+    for (size_t i = 0; i < count; i++) infer(tc, args[i], NULL);
+    return set_type(node, type_new(TYPE_UNKNOWN));
+}
+
+static Type *infer_kernel(Checker *tc, ASTNode *node) {
+    if (kernel_lookup(tc, node->data.gpu_kernel.name)) {
+        error(tc, node, "kernel '%s' is already defined", node->data.gpu_kernel.name);
+    } else {
+        KernelSig *k = malloc(sizeof(KernelSig));
+        k->node = node;
+        k->next = tc->kernels;
+        tc->kernels = k;
+    }
+    
+    /* Kernels see only their parameters */
+    Env *saved = tc->env;
+    tc->env = NULL;
+    env_push(tc);
+    for (size_t i = 0; i < node->data.gpu_kernel.param_count; i++)
+        env_bind(tc, node->data.gpu_kernel.params[i], node->data.gpu_kernel.param_types[i]);
+    tc->in_kernel = 1;
+    infer(tc, node->data.gpu_kernel.body, NULL);
+    tc->in_kernel = 0;
+    env_pop(tc);
+    tc->env = saved;
+    
+    return set_type(node, type_new(TYPE_VOID));
+}
+
+/*
+ * Unannotated parameters are i64, as in codegen. A lambda bound by let can
+ * call itself through self_name; its body is first checked quietly with an
+ * unknown return type, which the second pass then sees.
+ */
+static Type *infer_lambda(Checker *tc, ASTNode *node, const char *self_name) {
+    Type *t = type_new(TYPE_FUNC);
+    size_t n = node->data.lambda.param_count;
+    t->param_count = n;
+    t->params = n ? malloc(sizeof(Type*) * n) : NULL;
+    for (size_t i = 0; i < n; i++) {
+        Type *p = node->data.lambda.param_types[i];
+        t->params[i] = p ? type_clone(p) : type_new(TYPE_I64);
+    }
+    set_type(node, t);
+    
+    for (int pass = self_name ? 0 : 1; pass < 2; pass++) {
+        env_push(tc);
+        if (self_name) env_bind(tc, self_name, t);
+        for (size_t i = 0; i < n; i++)
+            env_bind(tc, node->data.lambda.params[i], t->params[i]);
+        tc->quiet += pass == 0;
+        Type *ret = infer(tc, node->data.lambda.body, NULL);
+        tc->quiet -= pass == 0;
+        env_pop(tc);
+        
+        type_free(t->ret);
+        t->ret = is_unknown(ret) && pass == 0 ? type_new(TYPE_I64) : type_clone(ret);
+    }
+    return t;
+}
+
+/*
+ * [a, b, c] has the common type of its elements, [v; n] the type of v;
+ * an annotation or parameter the literal initialises types the elements.
+ * The length is part of the type when it is known here.
+ */
+static Type *infer_array(Checker *tc, ASTNode *node, Type *expected) {
+    Type *hint = (expected && expected->kind == TYPE_ARRAY) ? expected->inner : NULL;
+    Type *elem = hint ? type_clone(hint) : NULL;
+    
+    for (size_t i = 0; i < node->data.array.count; i++) {
+        ASTNode *e = node->data.array.elements[i];
+        Type *t = infer(tc, e, hint ? hint : elem);
+        if (t->kind == TYPE_VOID) {
+            error(tc, e, "array element has no value");
+            continue;
+        }
+        if (hint) {
+            if (!assignable(hint, t))
+                error(tc, e, "cannot store %s in an array of %s", type_name(t), type_name(hint));
+            continue;
+        }
+        Type *j = elem ? join(elem, t) : type_clone(t);
+        if (!j) {
+            error(tc, e, "array elements have types %s and %s", type_name(elem), type_name(t));
+            continue;
+        }
+        type_free(elem);
+        elem = j;
+    }
+    
+    Type *t = type_new(TYPE_ARRAY);
+    t->inner = elem ? elem : type_new(TYPE_UNKNOWN);
+    ASTNode *repeat = node->data.array.repeat;
+    if (repeat) {
+        Type *i64 = type_new(TYPE_I64);
+        Type *nt = infer(tc, repeat, i64);
+        type_free(i64);
+        if (!is_int(nt) && !is_unknown(nt)) error(tc, repeat, "array length must be an integer");
+        if (repeat->type == NODE_INT_LIT && repeat->data.int_val > 0)
+            t->array_len = (size_t)repeat->data.int_val;
+    } else {
+        if (!elem) error(tc, node, "empty array needs a type annotation");
+        t->array_len = node->data.array.count;
+    }
+    return set_type(node, t);
+}
+
+/* a[i], or the store a[i] = v, which is void */
+static Type *infer_index(Checker *tc, ASTNode *node) {
+    Type *at = infer(tc, node->data.index.array, NULL);
+    Type *i64 = type_new(TYPE_I64);
+    Type *it = infer(tc, node->data.index.index, i64);
+    type_free(i64);
+    
+    if (!is_int(it) && !is_unknown(it)) {
+        error(tc, node->data.index.index, "array index must be an integer");
+    }
+    Type *elem = NULL;
+    if (at->kind == TYPE_ARRAY) {
+        elem = at->inner;
+    } else if (is_vector(at)) {
+        /* A single lane; vectors are values, so never stored into */
+        ASTNode *index = node->data.index.index;
+        if (index->type == NODE_INT_LIT &&
+            (index->data.int_val < 0 || (size_t)index->data.int_val >= at->array_len)) {
+            error(tc, index, "lane %lld out of range for %s", (long long)index->data.int_val, type_name(at));
+        }
+        if (node->data.index.value) {
+            error(tc, node, "cannot store into a lane of %s; build a new vector", type_name(at));
+            infer(tc, node->data.index.value, at->inner);
+            return set_type(node, type_new(TYPE_VOID));
+        }
+        return set_type(node, type_clone(at->inner));
+    } else if (!is_unknown(at)) {
+        error(tc, node, "cannot index a value of type %s", type_name(at));
+    }
+    
+    ASTNode *value = node->data.index.value;
+    if (value) {
+        Type *vt = infer(tc, value, elem);
+        if (elem && !assignable(elem, vt)) {
+            error(tc, value, "cannot store %s in an array of %s", type_name(vt), type_name(elem));
+        }
+        return set_type(node, type_new(TYPE_VOID));
+    }
+    return set_type(node, elem ? type_clone(elem) : type_new(TYPE_UNKNOWN));
+}
+
+static Type *infer_apply(Checker *tc, ASTNode *node) {
+    Type *f = infer(tc, node->data.apply.func, NULL);
+    int is_func = f->kind == TYPE_FUNC;
+    
+    if (!is_func && !is_unknown(f)) {
+        error(tc, node, "cannot call a value of type %s", type_name(f));
+    } else if (is_func && node->data.apply.arg_count != f->param_count) {
+        error(tc, node, "function takes %zu arguments, got %zu",
+              f->param_count, node->data.apply.arg_count);
+    }
+    for (size_t i = 0; i < node->data.apply.arg_count; i++) {
+        Type *param = is_func && i < f->param_count ? f->params[i] : NULL;
+        Type *t = infer(tc, node->data.apply.args[i], param);
+        if (param && !assignable(param, t)) {
+            error(tc, node->data.apply.args[i], "cannot pass %s as %s",
+                  type_name(t), type_name(param));
+        }
+    }
+    return set_type(node, (is_func && f->ret) ? type_clone(f->ret) : type_new(TYPE_UNKNOWN));
+}
+
+static Type *infer(Checker *tc, ASTNode *node, Type *expected) {
+    if (!node) return &void_type;
+    
+    switch (node->type) {
+        case NODE_INT_LIT:
+            return infer_int_lit(node, expected);
+        
+        case NODE_FLOAT_LIT:
+            return set_type(node, is_float(expected) ? type_clone(expected) : type_new(TYPE_F64));
+        
+        case NODE_STRING_LIT:
+            return set_type(node, type_new(TYPE_STR));
+        
+        case NODE_IDENT: {
+            Type *t = env_lookup(tc, node->data.ident.name);
+            if (!t) {
+                error(tc, node, "undefined variable '%s'", node->data.ident.name);
+                return set_type(node, type_new(TYPE_UNKNOWN));
+            }
+            return set_type(node, type_clone(t));
+        }
+        
+        case NODE_BINARY:
+            return infer_binary(tc, node, expected);
+        
+        case NODE_UNARY:
+            return infer_unary(tc, node, expected);
+        
+        case NODE_TERNARY:
+        case NODE_IF:
+            return infer_if(tc, node, expected);
+        
+        case NODE_BLOCK: {
+            env_push(tc);
+            Type *last = infer_stmts(tc, node, expected);
+            env_pop(tc);
+            return set_type(node, last ? type_clone(last) : type_new(TYPE_VOID));
+        }
+        
+        case NODE_LET:
+            return infer_let(tc, node);
+        
+        case NODE_FOR:
+            /* A loop is a statement; its own type only names the reduction */
+            infer_for(tc, node);
+            return &void_type;
+        
+        case NODE_BUILTIN:
+            return infer_builtin(tc, node, expected);
+        
+        case NODE_GPU_KERNEL:
+            return infer_kernel(tc, node);
+        
+        case NODE_ASYNC: {
+            Type *t = type_new(TYPE_ASYNC);
+            t->inner = type_clone(infer(tc, node->data.async_expr.expr, NULL));
+            if (!fits_task_result(t->inner)) {
+                error(tc, node, "async of %s: task results are at most %d bytes",
+                      type_name(t->inner), TASK_RESULT_BITS / 8);
+            }
+            return set_type(node, t);
+        }
+        
+        case NODE_AWAIT: {
+            Type *t = infer(tc, node->data.async_expr.expr, NULL);
+            if (t->kind == TYPE_ASYNC) return set_type(node, type_clone(t->inner));
+            if (!is_unknown(t)) error(tc, node, "await on a value that is not a task");
+            return set_type(node, type_new(TYPE_UNKNOWN));
+        }
+        
+        case NODE_LAMBDA:
+            return infer_lambda(tc, node, NULL);
+        
+        case NODE_APPLY:
+            return infer_apply(tc, node);
+        
+        case NODE_ARRAY:
+            return infer_array(tc, node, expected);
+        
+        case NODE_INDEX:
+            return infer_index(tc, node);
+        
+        case NODE_PROGRAM:
+            infer_stmts(tc, node, NULL);
+            return set_type(node, type_new(TYPE_VOID));
+    }
+    return set_type(node, type_new(TYPE_UNKNOWN));
+}
+
+/* ========== Public API ========== */
+
+int typecheck(ASTNode *program) {
+    Checker tc = {0};
+    env_push(&tc);
+    infer(&tc, program, NULL);
+    env_pop(&tc);
+    
+    while (tc.kernels) {
+        KernelSig *next = tc.kernels->next;
+        free(tc.kernels);
+        tc.kernels = next;
+    }
+    return tc.errors;
+}
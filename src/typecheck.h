@@ -0,0 +1,14 @@
+#ifndef LP_TYPECHECK_H
+#define LP_TYPECHECK_H
+
+#include "ast.h"
+
+/*
+ * Type inference and checking - fills resolved_type on every node.
+ * Literals take their type from context (the annotation they initialise,
+ * the other operand, the kernel parameter they are passed to).
+ * Returns the number of errors reported.
+ */
+int typecheck(ASTNode *program);
+
+#endif
@@ -0,0 +1,70 @@
+#!/bin/sh
+# Usage: tests/run.sh <photon>
+# Builds each tests/*.lp at -O0 and -O2 and runs it, then runs it twice with
+# photon run (compiling, then from the object cache), on LP_NUM_THREADS workers
+# (default 4) and compares stdout, then stderr, then "exit N" for a nonzero
+# status with tests/<name>.out, after anything the compiler printed. A failed
+# compile is compared the same way, using the compiler's stderr and status.
+# Warnings (W:) depend on the LLVM photon was built against and are dropped.
+# Programs run in tests/, so they can open data files next to them.
+
+photon=$1
+case $photon in
+    */*) photon=$(cd "$(dirname "$photon")" && pwd)/$(basename "$photon") ;;
+esac
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+LP_NUM_THREADS=${LP_NUM_THREADS:-4}
+export LP_NUM_THREADS
+
+# Drops the warnings from file $1
+strip_warnings() {
+    grep -v '^W: ' "$1" > "$1.w"
+    mv "$1.w" "$1"
+}
+
+total=0
+failed=0
+for src in "$dir"/*.lp; do
+    name=$(basename "$src" .lp)
+    for opt in -O0 -O2; do
+        total=$((total + 1))
+        bin="$tmp/$name"
+        got="$tmp/$name.got"
+        if "$photon" "$src" -o "$bin" $opt > /dev/null 2> "$got"; then
+            (cd "$dir" && "$bin") >> "$got" 2> "$tmp/err"
+            status=$?
+            cat "$tmp/err" >> "$got"
+        else
+            status=$?
+        fi
+        [ $status -ne 0 ] && echo "exit $status" >> "$got"
+        strip_warnings "$got"
+        if ! cmp -s "$dir/$name.out" "$got"; then
+            echo "FAIL $name $opt"
+            diff -u "$dir/$name.out" "$got" | tail -n +3 | head -20
+            failed=$((failed + 1))
+        fi
+        rm -f "$bin"
+    done
+    
+    # photon run: JIT-compiled, then again from the object cache
+    for pass in cold cached; do
+        total=$((total + 1))
+        got="$tmp/$name.got"
+        (cd "$dir" && LP_CACHE_DIR="$tmp/cache" "$photon" run "$name.lp" -O2) > "$got" 2> "$tmp/err"
+        status=$?
+        cat "$tmp/err" >> "$got"
+        [ $status -ne 0 ] && echo "exit $status" >> "$got"
+        strip_warnings "$got"
+        if ! cmp -s "$dir/$name.out" "$got"; then
+            echo "FAIL $name run ($pass)"
+            diff -u "$dir/$name.out" "$got" | tail -n +3 | head -20
+            failed=$((failed + 1))
+        fi
+    done
+done
+
+echo "$((total - failed))/$total passed"
+[ $failed -eq 0 ]